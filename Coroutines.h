@@ -0,0 +1,194 @@
+#ifndef RDMA_HASH_MAP_COROUTINES_H
+#define RDMA_HASH_MAP_COROUTINES_H
+
+#if __cplusplus < 202002L
+#error "Coroutines.h needs C++20"
+#endif
+
+#include <coroutine>
+#include <cstdint>
+#include <exception>
+#include <span>
+#include <utility>
+#include <vector>
+#include "DoorbellMap.h"
+#include "RDMAMessageBuffer.h"
+
+/// Serve many connections from one thread: every connection is handled by a coroutine, which suspends in
+/// co_await receive() / send() instead of spinning, and a Scheduler resumes it once its ring is ready.
+namespace coro {
+
+class Scheduler;
+
+/// A coroutine which runs right away until it first suspends, afterwards it is owned by the Scheduler it was spawned on
+class Task {
+public:
+    struct promise_type {
+        std::exception_ptr exception;
+
+        Task get_return_object() { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+
+        std::suspend_never initial_suspend() noexcept { return {}; }
+
+        /// Stay alive, so the Scheduler can see it finished
+        std::suspend_always final_suspend() noexcept { return {}; }
+
+        void return_void() {}
+
+        void unhandled_exception() { exception = std::current_exception(); }
+    };
+
+    Task(Task &&other) noexcept : handle(std::exchange(other.handle, {})) {}
+
+    Task &operator=(Task &&other) noexcept {
+        std::swap(handle, other.handle);
+        return *this;
+    }
+
+    ~Task() {
+        if (handle) {
+            handle.destroy();
+        }
+    }
+
+private:
+    friend class Scheduler;
+
+    std::coroutine_handle<promise_type> handle;
+
+    explicit Task(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+};
+
+/// Resumes the coroutines whose connections became ready. Receivers are only looked at after their doorbell rang
+class Scheduler {
+    struct Receiver {
+        RDMAMessageBuffer *buffer;
+        std::coroutine_handle<> handle;
+    };
+
+    struct Sender {
+        RDMAMessageBuffer *buffer;
+        std::span<const uint8_t> data;
+        std::coroutine_handle<> handle;
+    };
+
+    std::vector<Task> tasks;
+    std::vector<Receiver> receivers;
+    std::vector<Sender> senders;
+    /// Resumed after the waiting lists have been compacted, a resumed coroutine may wait again right away
+    std::vector<std::coroutine_handle<>> resumable;
+
+public:
+    class ReceiveAwaitable {
+        Scheduler &scheduler;
+        RDMAMessageBuffer &buffer;
+
+    public:
+        ReceiveAwaitable(Scheduler &scheduler, RDMAMessageBuffer &buffer) : scheduler(scheduler), buffer(buffer) {}
+
+        bool await_ready() const { return buffer.hasData(); }
+
+        void await_suspend(std::coroutine_handle<> handle) { scheduler.receivers.push_back({&buffer, handle}); }
+
+        std::vector<uint8_t> await_resume() { return buffer.receive(); }
+    };
+
+    class SendAwaitable {
+        Scheduler &scheduler;
+        RDMAMessageBuffer &buffer;
+        std::span<const uint8_t> data;
+
+    public:
+        SendAwaitable(Scheduler &scheduler, RDMAMessageBuffer &buffer, std::span<const uint8_t> data)
+                : scheduler(scheduler), buffer(buffer), data(data) {}
+
+        bool await_ready() { return buffer.trySend(data.data(), data.size()); }
+
+        void await_suspend(std::coroutine_handle<> handle) { scheduler.senders.push_back({&buffer, data, handle}); }
+
+        void await_resume() {}
+    };
+
+    /// Take over a coroutine, which already ran until its first co_await
+    void spawn(Task task) {
+        if (task.handle.done()) {
+            finish(task);
+            return;
+        }
+        tasks.push_back(std::move(task));
+    }
+
+    /// Resume coroutines until all spawned ones finished. Rethrows the first exception escaping from one of them
+    void run() {
+        while (not tasks.empty()) {
+            poll();
+            for (size_t i = 0; i < tasks.size();) {
+                if (tasks[i].handle.done()) {
+                    auto finished = std::move(tasks[i]);
+                    tasks[i] = std::move(tasks.back());
+                    tasks.pop_back();
+                    finish(finished);
+                } else {
+                    ++i;
+                }
+            }
+        }
+    }
+
+    /// Resume all coroutines whose connection is ready once
+    void poll() {
+        auto &doorbells = DoorbellMap::shared();
+        size_t waiting = 0;
+        for (auto &receiver : receivers) {
+            // Cleared before looking at the ring, a message arriving in between rings again
+            if (doorbells.clear(static_cast<uint32_t>(receiver.buffer->getDoorbell())) &&
+                receiver.buffer->hasData()) {
+                resumable.push_back(receiver.handle);
+            } else {
+                receivers[waiting++] = receiver;
+            }
+        }
+        receivers.resize(waiting);
+
+        waiting = 0;
+        for (auto &sender : senders) {
+            if (sender.buffer->trySend(sender.data.data(), sender.data.size())) {
+                resumable.push_back(sender.handle);
+            } else {
+                senders[waiting++] = sender;
+            }
+        }
+        senders.resize(waiting);
+
+        for (auto handle : resumable) {
+            handle.resume();
+        }
+        resumable.clear();
+    }
+
+private:
+    static void finish(Task &task) {
+        if (task.handle.promise().exception) {
+            std::rethrow_exception(task.handle.promise().exception);
+        }
+    }
+};
+
+/// Awaitable operations on a message buffer, which must only be used by one coroutine at a time
+class AsyncMessageBuffer {
+    RDMAMessageBuffer &buffer;
+    Scheduler &scheduler;
+
+public:
+    AsyncMessageBuffer(RDMAMessageBuffer &buffer, Scheduler &scheduler) : buffer(buffer), scheduler(scheduler) {}
+
+    /// co_await the next message
+    Scheduler::ReceiveAwaitable receive() { return {scheduler, buffer}; }
+
+    /// co_await until data is posted, data has to stay valid until then
+    Scheduler::SendAwaitable send(std::span<const uint8_t> data) { return {scheduler, buffer, data}; }
+};
+
+} // End of namespace coro
+
+#endif //RDMA_HASH_MAP_COROUTINES_H
@@ -0,0 +1,251 @@
+#include "DatagramTransport.h"
+#include <algorithm>
+#include <cstring>
+#include <infiniband/verbs.h>
+#include <random>
+#include <stdexcept>
+#include "rdma/WorkRequest.hpp"
+#include "tcpWrapper.h"
+
+using namespace std;
+using namespace rdma;
+
+static const uint64_t datagramSendId = 46;
+static const auto initialRetransmitTimeout = chrono::microseconds(1000);
+static const auto maxRetransmitTimeout = chrono::microseconds(100 * 1000);
+
+struct DatagramInfo {
+    Address address;
+    uint32_t connection;
+    uint64_t nonce;
+};
+
+static uint64_t randomNonce() {
+    static thread_local mt19937_64 random(random_device{}());
+    return random();
+}
+
+DatagramEndpoint &DatagramEndpoint::forThread() {
+    // Intentionally never destroyed, just like the network
+    static thread_local DatagramEndpoint *endpoint = new DatagramEndpoint(RDMANetworking::sharedNetwork());
+    return *endpoint;
+}
+
+DatagramEndpoint::DatagramEndpoint(Network &network) :
+        network(network),
+        datagramSize(network.getMtu()),
+        completionQueue(network, RECEIVE_BUFFERS + SEND_SLOTS),
+        receiveQueue(network, RECEIVE_BUFFERS),
+        sendSlots(network.getMemorySlab(), network.getMemorySlab().allocate(SEND_SLOTS * datagramSize,
+                                                                          MemoryRegion::Permission::None, 4096)),
+        queuePair(network, completionQueue, receiveQueue, QueuePair::Type::UnreliableDatagram),
+        pool(network, receiveQueue, datagramSize + GRH_SIZE, RECEIVE_BUFFERS) {
+    queuePair.activateDatagrams(QKEY);
+}
+
+Address DatagramEndpoint::getAddress() {
+    return queuePair.getAddress();
+}
+
+uint32_t DatagramEndpoint::add(DatagramTransport &transport) {
+    if (freeConnections.empty()) {
+        transports.push_back(&transport);
+        return static_cast<uint32_t>(transports.size() - 1);
+    }
+    const auto connection = freeConnections.back();
+    freeConnections.pop_back();
+    transports[connection] = &transport;
+    return connection;
+}
+
+void DatagramEndpoint::remove(uint32_t connection) {
+    transports[connection] = nullptr;
+    freeConnections.push_back(connection);
+}
+
+void DatagramEndpoint::post(const AddressHandle &destination, uint32_t qpn, const DatagramHeader &header,
+                            const uint8_t *payload) {
+    // Completions are in order, so a signaled one frees all slots up to it
+    while (sendSlot - completedSlots >= SEND_SLOTS) {
+        if (completionQueue.pollSendCompletionQueue() == datagramSendId) {
+            completedSlots += SEND_SLOTS / 2;
+        }
+    }
+
+    uint8_t *slot = sendSlots.as<uint8_t>() + (sendSlot % SEND_SLOTS) * datagramSize;
+    memcpy(slot, &header, sizeof(header));
+    copy(payload, payload + header.size, slot + sizeof(header));
+    const size_t size = sizeof(header) + header.size;
+
+    DatagramWorkRequest request;
+    request.setLocalAddress(MemoryRegion::Slice(slot, size, sendSlots.slice.lkey));
+    request.setDestination(destination, qpn, QKEY);
+    request.setSendInline(size <= queuePair.getMaxInlineSize());
+    request.setCompletion(sendSlot % (SEND_SLOTS / 2) == SEND_SLOTS / 2 - 1);
+    request.setId(datagramSendId);
+    queuePair.postWorkRequest(request);
+    ++sendSlot;
+}
+
+void DatagramEndpoint::poll() {
+    vector<uint32_t> toAcknowledge;
+    for (auto id = completionQueue.pollRecvCompletionQueue(); id != numeric_limits<uint64_t>::max();
+         id = completionQueue.pollRecvCompletionQueue()) {
+        const uint8_t *datagram = pool.getBuffer(id) + GRH_SIZE;
+        DatagramHeader header;
+        memcpy(&header, datagram, sizeof(header));
+        // A stale nonce belongs to a peer of the transport that had the connection id before, e.g. retransmitting
+        const bool known = header.connection < transports.size() && transports[header.connection] != nullptr &&
+                           transports[header.connection]->getNonce() == header.nonce &&
+                           header.size <= getMaxPayload();
+        if (known && transports[header.connection]->onDatagram(header, datagram + sizeof(header)) &&
+            find(toAcknowledge.begin(), toAcknowledge.end(), header.connection) == toAcknowledge.end()) {
+            toAcknowledge.push_back(header.connection);
+        }
+        pool.release(id);
+    }
+
+    // One acknowledgement per connection and batch
+    for (auto connection : toAcknowledge) {
+        if (transports[connection] != nullptr) {
+            transports[connection]->acknowledge();
+        }
+    }
+}
+
+DatagramTransport::DatagramTransport(int sock) :
+        endpoint(DatagramEndpoint::forThread()),
+        localConnection(endpoint.add(*this)),
+        nonce(randomNonce()) {
+    try {
+        tcp_setBlocking(sock); // just set the socket to block for our setup.
+        DatagramInfo info{endpoint.getAddress(), localConnection, nonce};
+        tcp_write(sock, &info, sizeof(info));
+        tcp_read(sock, &info, sizeof(info));
+        remoteQpn = info.address.qpn;
+        remoteConnection = info.connection;
+        remoteNonce = info.nonce;
+        maxPayload = min<size_t>(endpoint.getMaxPayload(), info.address.mtu - sizeof(DatagramHeader));
+        destination = make_unique<AddressHandle>(endpoint.getNetwork(), info.address);
+    } catch (...) {
+        endpoint.remove(localConnection);
+        throw;
+    }
+}
+
+DatagramTransport::~DatagramTransport() {
+    endpoint.remove(localConnection);
+}
+
+void DatagramTransport::transmit(const Segment &segment) const {
+    DatagramHeader header{remoteConnection, static_cast<uint32_t>(segment.payload.size()), remoteNonce,
+                          segment.sequence, expectedSequence};
+    endpoint.post(*destination, remoteQpn, header, segment.payload.data());
+}
+
+void DatagramTransport::acknowledge() {
+    DatagramHeader header{remoteConnection, 0, remoteNonce, 0, expectedSequence};
+    endpoint.post(*destination, remoteQpn, header, nullptr);
+}
+
+void DatagramTransport::progress() const {
+    endpoint.poll();
+
+    // Go back N: resend everything unacknowledged, backing off while the peer doesn't answer
+    const auto now = chrono::steady_clock::now();
+    if (not unacknowledged.empty() && now - oldestSent > retransmitTimeout) {
+        for (const auto &segment : unacknowledged) {
+            transmit(segment);
+        }
+        oldestSent = now;
+        retransmitTimeout = min(retransmitTimeout * 2, maxRetransmitTimeout);
+    }
+}
+
+bool DatagramTransport::onDatagram(const DatagramHeader &header, const uint8_t *payload) {
+    if (not unacknowledged.empty() && unacknowledged.front().sequence < header.acknowledged) {
+        while (not unacknowledged.empty() && unacknowledged.front().sequence < header.acknowledged) {
+            unacknowledged.pop_front();
+        }
+        oldestSent = chrono::steady_clock::now();
+        retransmitTimeout = initialRetransmitTimeout;
+    }
+    if (header.size == 0) {
+        return false; // pure acknowledgement
+    }
+    if (header.sequence != expectedSequence) {
+        return true; // duplicate or gap, tell the sender what we have
+    }
+    ++expectedSequence;
+
+    // A segment never contains parts of two messages, the first one of a message starts with its length
+    size_t offset = 0;
+    if (not inMessage) {
+        memcpy(&partialLength, payload, sizeof(partialLength));
+        offset = sizeof(partialLength);
+        partial.clear();
+        partial.reserve(partialLength);
+        inMessage = true;
+    }
+    partial.insert(partial.end(), payload + offset, payload + header.size);
+    if (partial.size() == partialLength) {
+        messages.push_back(move(partial));
+        partial = vector<uint8_t>();
+        inMessage = false;
+    }
+    return true;
+}
+
+void DatagramTransport::sendSegment(vector<uint8_t> payload) {
+    while (unacknowledged.size() >= WINDOW) {
+        progress();
+    }
+    if (unacknowledged.empty()) {
+        oldestSent = chrono::steady_clock::now();
+    }
+    unacknowledged.push_back(Segment{nextSequence++, move(payload)});
+    transmit(unacknowledged.back());
+}
+
+void DatagramTransport::send(const uint8_t *data, size_t length) {
+    size_t sent = min(length, maxPayload - sizeof(length));
+    vector<uint8_t> first(sizeof(length) + sent);
+    memcpy(first.data(), &length, sizeof(length));
+    copy(data, data + sent, first.begin() + sizeof(length));
+    sendSegment(move(first));
+    while (sent < length) {
+        const size_t segmentSize = min(maxPayload, length - sent);
+        sendSegment(vector<uint8_t>(data + sent, data + sent + segmentSize));
+        sent += segmentSize;
+    }
+}
+
+bool DatagramTransport::hasData() const {
+    progress();
+    return not messages.empty();
+}
+
+vector<uint8_t> DatagramTransport::waitForMessage() {
+    while (messages.empty()) {
+        progress();
+    }
+    auto message = move(messages.front());
+    messages.pop_front();
+    return message;
+}
+
+vector<uint8_t> DatagramTransport::receive() {
+    return waitForMessage();
+}
+
+size_t DatagramTransport::receive(void *whereTo, size_t maxSize) {
+    while (messages.empty()) {
+        progress();
+    }
+    if (messages.front().size() > maxSize) {
+        throw runtime_error{"plz only read whole messages for now!"};
+    }
+    const auto message = waitForMessage();
+    copy(message.begin(), message.end(), reinterpret_cast<uint8_t *>(whereTo));
+    return message.size();
+}
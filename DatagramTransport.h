@@ -0,0 +1,153 @@
+#ifndef RDMA_HASH_MAP_DATAGRAMTRANSPORT_H
+#define RDMA_HASH_MAP_DATAGRAMTRANSPORT_H
+
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <vector>
+#include "MessageTransport.h"
+#include "RDMAMessageBuffer.h"
+#include "rdma/AddressHandle.hpp"
+#include "rdma/ReceiveBufferPool.hpp"
+
+class DatagramTransport;
+
+/// Starts every datagram
+struct DatagramHeader {
+    /// The receiver's id of the connection
+    uint32_t connection;
+    /// Payload bytes following the header, 0 for a pure acknowledgement
+    uint32_t size;
+    /// The receiver's nonce of the connection, connection ids are reused once their transport is gone
+    uint64_t nonce;
+    /// Sequence number of the segment
+    uint64_t sequence;
+    /// Cumulative acknowledgement: all segments before this one arrived
+    uint64_t acknowledged;
+};
+
+/// The unreliable datagram queue pair of a thread, shared by all DatagramTransports the thread created. Routes
+/// incoming datagrams to their transports by connection id, so the number of queue pairs doesn't grow with the number
+/// of peers. Datagrams whose nonce doesn't match the transport holding their connection id now are dropped.
+class DatagramEndpoint {
+public:
+    /// The endpoint of the calling thread
+    static DatagramEndpoint &forThread();
+
+    rdma::Address getAddress();
+
+    /// Route datagrams with the returned connection id to the transport
+    uint32_t add(DatagramTransport &transport);
+
+    void remove(uint32_t connection);
+
+    /// Send a datagram (header and payload), the payload is copied
+    void post(const rdma::AddressHandle &destination, uint32_t qpn, const DatagramHeader &header,
+              const uint8_t *payload);
+
+    /// Route the received datagrams to their transports
+    void poll();
+
+    /// Maximal payload of a single datagram
+    size_t getMaxPayload() const { return datagramSize - sizeof(DatagramHeader); }
+
+    rdma::Network &getNetwork() { return network; }
+
+    static const uint32_t QKEY = 0x11111111;
+
+private:
+    /// Number of datagrams being sent at the same time, every half of them is signaled
+    static const size_t SEND_SLOTS = 64;
+    /// Receive buffers kept posted, datagrams arriving while none is posted are dropped
+    static const size_t RECEIVE_BUFFERS = 1024;
+    /// Received datagrams are preceded by the global routing header (even if there is none)
+    static const size_t GRH_SIZE = 40;
+
+    rdma::Network &network;
+    const size_t datagramSize;
+    rdma::CompletionQueuePair completionQueue;
+    rdma::ReceiveQueue receiveQueue;
+    rdma::MemorySlab::Allocation sendSlots;
+    rdma::QueuePair queuePair;
+    rdma::ReceiveBufferPool pool;
+    /// The transports by connection id, nullptr once removed
+    std::vector<DatagramTransport *> transports;
+    std::vector<uint32_t> freeConnections;
+    size_t sendSlot = 0;
+    size_t completedSlots = 0;
+
+    DatagramEndpoint(rdma::Network &network);
+};
+
+/// A message transport to a single peer over the thread's DatagramEndpoint. As datagrams may get lost, segments are
+/// numbered, acknowledged cumulatively and retransmitted go-back-N style when the oldest one is not acknowledged in
+/// time. A transport has to be used by the thread that created it.
+class DatagramTransport : public MessageTransport {
+public:
+    /// Exchange the datagram addresses over the given socket
+    DatagramTransport(int sock);
+
+    ~DatagramTransport() override;
+
+    /// Send data to the remote site
+    void send(const uint8_t *data, size_t length) override;
+
+    /// Receive data to a freshly allocated data vector
+    std::vector<uint8_t> receive() override;
+
+    /// Receive to a specific memory region with at last maxSize
+    size_t receive(void *whereTo, size_t maxSize) override;
+
+    /// whether there is data to be read non-blockingly
+    bool hasData() const override;
+
+    /// A datagram for this connection arrived, returns whether it should be acknowledged
+    bool onDatagram(const DatagramHeader &header, const uint8_t *payload);
+
+    /// Send a pure acknowledgement
+    void acknowledge();
+
+    /// Chosen randomly for each transport, so datagrams of its connection id's previous owner don't reach it
+    uint64_t getNonce() const { return nonce; }
+
+private:
+    struct Segment {
+        uint64_t sequence;
+        std::vector<uint8_t> payload;
+    };
+
+    /// Unacknowledged segments in flight
+    static const size_t WINDOW = 128;
+
+    DatagramEndpoint &endpoint;
+    uint32_t localConnection;
+    const uint64_t nonce;
+    uint32_t remoteConnection = 0;
+    uint64_t remoteNonce = 0;
+    uint32_t remoteQpn = 0;
+    /// Payload of our datagrams, so they fit into both sides' MTU
+    size_t maxPayload = 0;
+    std::unique_ptr<rdma::AddressHandle> destination;
+
+    std::deque<Segment> unacknowledged;
+    uint64_t nextSequence = 0;
+    // Retransmission is driven by whoever uses the transport, hasData() included
+    mutable std::chrono::steady_clock::time_point oldestSent;
+    mutable std::chrono::microseconds retransmitTimeout{1000};
+
+    uint64_t expectedSequence = 0;
+    std::vector<uint8_t> partial;
+    size_t partialLength = 0;
+    bool inMessage = false;
+    std::deque<std::vector<uint8_t>> messages;
+
+    void transmit(const Segment &segment) const;
+
+    void sendSegment(std::vector<uint8_t> payload);
+
+    void progress() const;
+
+    std::vector<uint8_t> waitForMessage();
+};
+
+#endif //RDMA_HASH_MAP_DATAGRAMTRANSPORT_H
@@ -0,0 +1,58 @@
+#include "DoorbellMap.h"
+#include <stdexcept>
+#include "RDMAMessageBuffer.h"
+
+using namespace std;
+using namespace rdma;
+
+DoorbellMap &DoorbellMap::shared() {
+    // Intentionally never destroyed, just like the network
+    static auto map = new DoorbellMap();
+    return *map;
+}
+
+DoorbellMap::DoorbellMap() :
+        memory(RDMANetworking::sharedNetwork().getMemorySlab(),
+               RDMANetworking::sharedNetwork().getMemorySlab().allocate(SLOTS, MemoryRegion::Permission::LocalWrite |
+                                                                               MemoryRegion::Permission::RemoteWrite,
+                                                                        4096)),
+        bells(memory.as<volatile uint8_t>()) {
+}
+
+uint32_t DoorbellMap::acquire() {
+    lock_guard<mutex> lock(guard);
+    if (not freeSlots.empty()) {
+        const auto slot = freeSlots.back();
+        freeSlots.pop_back();
+        return slot;
+    }
+    const auto slot = highWater.load(memory_order_relaxed);
+    if (slot == SLOTS) {
+        throw runtime_error{"no free doorbell"};
+    }
+    highWater.store(slot + 1, memory_order_release);
+    return static_cast<uint32_t>(slot);
+}
+
+void DoorbellMap::release(uint32_t slot) {
+    lock_guard<mutex> lock(guard);
+    freeSlots.push_back(slot);
+}
+
+MemoryRegion::Slice DoorbellMap::getSlot(uint32_t slot) const {
+    return MemoryRegion::Slice(memory.as<uint8_t>() + slot, 1, memory.slice.lkey, memory.slice.rkey);
+}
+
+MemoryRegion::Slice DoorbellMap::getSlot(uint32_t slot, Network &network) {
+    if (&network == &RDMANetworking::sharedNetwork()) {
+        return getSlot(slot);
+    }
+    lock_guard<mutex> lock(guard);
+    auto &registration = railRegistrations[&network];
+    if (not registration) {
+        registration = make_unique<MemoryRegion>(memory.slice.address, memory.slice.size, network.getProtectionDomain(),
+                                                 MemoryRegion::Permission::LocalWrite |
+                                                 MemoryRegion::Permission::RemoteWrite);
+    }
+    return registration->slice(slot, 1);
+}
@@ -0,0 +1,78 @@
+#ifndef RDMA_HASH_MAP_DOORBELLMAP_H
+#define RDMA_HASH_MAP_DOORBELLMAP_H
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "rdma/MemoryRegion.hpp"
+#include "rdma/MemorySlab.hpp"
+#include "rdma/Network.hpp"
+
+/// Summary of which connections of this process received messages. Every receiving connection owns a slot, and the
+/// sender writes a 1 into it after each message. A receiver scans the map word by word and only has to look at the rings
+/// of the slots which rang, instead of at every ring.
+/// Slots are bytes rather than bits: remote writes of single bytes can't race with each other, setting bits would need
+/// remote atomics.
+class DoorbellMap {
+public:
+    static const size_t SLOTS = 64 * 1024;
+
+    /// The map of this process
+    static DoorbellMap &shared();
+
+    /// Get a free slot
+    uint32_t acquire();
+
+    void release(uint32_t slot);
+
+    /// The registered byte of the slot, for the remote side to write to
+    rdma::MemoryRegion::Slice getSlot(uint32_t slot) const;
+
+    /// The byte of the slot registered with the network of a connection on another rail
+    rdma::MemoryRegion::Slice getSlot(uint32_t slot, rdma::Network &network);
+
+    /// Clear a single slot, true if it rang. For callers watching a few connections rather than the whole process
+    bool clear(uint32_t slot) {
+        if (bells[slot] == 0) {
+            return false;
+        }
+        bells[slot] = 0;
+        return true;
+    }
+
+    /// Clear the rung slots and call func(uint32_t slot) for each of them
+    template<typename Func>
+    void collect(Func &&func) {
+        const size_t words = (highWater.load(std::memory_order_acquire) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+        for (size_t word = 0; word != words; ++word) {
+            if (reinterpret_cast<const volatile uint64_t *>(bells)[word] == 0) {
+                continue;
+            }
+            for (size_t slot = word * sizeof(uint64_t); slot != (word + 1) * sizeof(uint64_t); ++slot) {
+                if (bells[slot] != 0) {
+                    // Cleared before the ring is looked at, so a message arriving in between rings again
+                    bells[slot] = 0;
+                    func(static_cast<uint32_t>(slot));
+                }
+            }
+        }
+    }
+
+private:
+    rdma::MemorySlab::Allocation memory;
+    volatile uint8_t *bells;
+    /// Slots at or above are not used yet
+    std::atomic<size_t> highWater{0};
+    std::vector<uint32_t> freeSlots;
+    /// Registrations of the map with the protection domains of the other rails
+    std::map<rdma::Network *, std::unique_ptr<rdma::MemoryRegion>> railRegistrations;
+    /// Protect the slots from concurrent acquisition
+    std::mutex guard;
+
+    DoorbellMap();
+};
+
+#endif //RDMA_HASH_MAP_DOORBELLMAP_H
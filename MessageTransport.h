@@ -0,0 +1,33 @@
+#ifndef RDMA_HASH_MAP_MESSAGETRANSPORT_H
+#define RDMA_HASH_MAP_MESSAGETRANSPORT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/// A reliable, message based connection to a single remote site
+class MessageTransport {
+public:
+    virtual ~MessageTransport() = default;
+
+    /// Send data to the remote site
+    virtual void send(const uint8_t *data, size_t length) = 0;
+
+    /// Receive data to a freshly allocated data vector
+    virtual std::vector<uint8_t> receive() = 0;
+
+    /// Receive to a specific memory region with at last maxSize
+    virtual size_t receive(void *whereTo, size_t maxSize) = 0;
+
+    /// whether there is data to be read non-blockingly
+    virtual bool hasData() const = 0;
+
+    /// The slot in the DoorbellMap the remote side rings after each message, -1 if it doesn't. hasData() only has to be
+    /// checked after the doorbell rang (and until it returned false)
+    virtual int64_t getDoorbell() const { return -1; }
+
+    /// Whether hasData() may be called by another thread while this one is receiving
+    virtual bool supportsConcurrentHasData() const { return false; }
+};
+
+#endif //RDMA_HASH_MAP_MESSAGETRANSPORT_H
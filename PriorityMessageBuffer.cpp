@@ -0,0 +1,64 @@
+#include "PriorityMessageBuffer.h"
+#include <algorithm>
+#include "tcpWrapper.h"
+
+using namespace std;
+using namespace rdma;
+
+PriorityMessageBuffer::PriorityMessageBuffer(size_t size, int sock) {
+    tcp_setBlocking(sock); // just set the socket to block for our setup.
+    // Each side writes into the other one's rings, so both have to agree on their sizes
+    uint64_t localSizes[] = {URGENT_SIZE, size};
+    uint64_t remoteSizes[2] = {};
+    tcp_write(sock, localSizes, sizeof(localSizes));
+    tcp_read(sock, remoteSizes, sizeof(remoteSizes));
+
+    auto &network = RDMANetworking::networkForConnection();
+    urgent = make_unique<RDMAMessageBuffer>(max(localSizes[0], remoteSizes[0]), sock, network,
+                                            QueuePair::Profile::latency());
+    bulk = make_unique<RDMAMessageBuffer>(max(localSizes[1], remoteSizes[1]), sock, network);
+}
+
+void PriorityMessageBuffer::send(const uint8_t *data, size_t length) {
+    send(data, length, length < urgentThreshold ? Priority::Urgent : Priority::Bulk);
+}
+
+void PriorityMessageBuffer::send(const uint8_t *data, size_t length, Priority priority) {
+    lane(priority).send(data, length);
+}
+
+PriorityMessageBuffer::Priority PriorityMessageBuffer::nextLane() const {
+    for (;;) {
+        if (urgent->hasData()) {
+            return Priority::Urgent;
+        }
+        if (bulk->hasData()) {
+            return Priority::Bulk;
+        }
+    }
+}
+
+vector<uint8_t> PriorityMessageBuffer::receive() {
+    return lane(nextLane()).receive();
+}
+
+size_t PriorityMessageBuffer::receive(void *whereTo, size_t maxSize) {
+    return lane(nextLane()).receive(whereTo, maxSize);
+}
+
+size_t PriorityMessageBuffer::receive(void *whereTo, size_t maxSize, Priority priority) {
+    return lane(priority).receive(whereTo, maxSize);
+}
+
+bool PriorityMessageBuffer::hasData() const {
+    return urgent->hasData() || bulk->hasData();
+}
+
+bool PriorityMessageBuffer::hasData(Priority priority) const {
+    return lane(priority).hasData();
+}
+
+void PriorityMessageBuffer::setMultiProducer() {
+    urgent->setMultiProducer();
+    bulk->setMultiProducer();
+}
@@ -0,0 +1,66 @@
+#ifndef RDMA_HASH_MAP_PRIORITYMESSAGEBUFFER_H
+#define RDMA_HASH_MAP_PRIORITYMESSAGEBUFFER_H
+
+#include <memory>
+#include <vector>
+#include "MessageTransport.h"
+#include "RDMAMessageBuffer.h"
+
+/// Two ring buffer connections to the same remote site: a small urgent lane for control messages and a bulk lane. Each
+/// lane has its own ring, credits and queue pair, so a large message waiting for space or still being written doesn't
+/// hold back the urgent ones, and receivers look at the urgent lane first. Messages keep their order within a lane,
+/// but urgent messages overtake bulk ones.
+class PriorityMessageBuffer : public MessageTransport {
+public:
+    enum class Priority {
+        Urgent, Bulk
+    };
+
+    /// Size of the urgent ring, if the remote side doesn't ask for a larger one
+    static const size_t URGENT_SIZE = 16 * 1024;
+
+    /// Set up both lanes, size of the bulk lane _must_ be a power of 2. Both sides use the larger of their sizes
+    PriorityMessageBuffer(size_t size, int sock);
+
+    /// Send data on the urgent lane if it is smaller than the urgent threshold, on the bulk lane otherwise
+    void send(const uint8_t *data, size_t length) override;
+
+    /// Send data on the given lane
+    void send(const uint8_t *data, size_t length, Priority priority);
+
+    /// Receive the next message, urgent ones first
+    std::vector<uint8_t> receive() override;
+
+    /// Receive the next message to a specific memory region with at last maxSize, urgent ones first
+    size_t receive(void *whereTo, size_t maxSize) override;
+
+    /// Receive the next message of the given lane
+    size_t receive(void *whereTo, size_t maxSize, Priority priority);
+
+    /// whether there is data to be read non-blockingly
+    bool hasData() const override;
+
+    /// whether there is data on the given lane
+    bool hasData(Priority priority) const;
+
+    /// Both lanes support it
+    bool supportsConcurrentHasData() const override { return true; }
+
+    /// Send messages below threshold bytes on the urgent lane without tagging them, 0 (default) for none
+    void setUrgentThreshold(size_t threshold) { urgentThreshold = threshold; }
+
+    /// Allow several threads to send() concurrently on each lane, see RDMAMessageBuffer::setMultiProducer()
+    void setMultiProducer();
+
+private:
+    std::unique_ptr<RDMAMessageBuffer> urgent;
+    std::unique_ptr<RDMAMessageBuffer> bulk;
+    size_t urgentThreshold = 0;
+
+    RDMAMessageBuffer &lane(Priority priority) const { return priority == Priority::Urgent ? *urgent : *bulk; }
+
+    /// Wait until a message arrived on either lane, returns its lane
+    Priority nextLane() const;
+};
+
+#endif //RDMA_HASH_MAP_PRIORITYMESSAGEBUFFER_H
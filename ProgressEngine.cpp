@@ -0,0 +1,167 @@
+#include "ProgressEngine.h"
+#include <algorithm>
+#include <cstdlib>
+#include <string>
+#include "RDMAMessageBuffer.h"
+#include "Tuning.h"
+
+using namespace std;
+
+ProgressEngine::ReadinessQueue::ReadinessQueue() {
+    for (size_t i = 0; i != CAPACITY; ++i) {
+        entries[i].sequence.store(i, memory_order_relaxed);
+    }
+}
+
+void ProgressEngine::ReadinessQueue::push(int fd) {
+    auto position = tail.load(memory_order_relaxed);
+    while (true) {
+        auto &entry = entries[position & (CAPACITY - 1)];
+        const auto sequence = entry.sequence.load(memory_order_acquire);
+        if (sequence == position) {
+            if (tail.compare_exchange_weak(position, position + 1, memory_order_relaxed)) {
+                entry.fd = fd;
+                entry.sequence.store(position + 1, memory_order_release);
+                return;
+            }
+        } else if (sequence < position) {
+            // Full, the connection stays marked as ready though
+            overflowed.store(true);
+            return;
+        } else {
+            position = tail.load(memory_order_relaxed);
+        }
+    }
+}
+
+bool ProgressEngine::enabled() {
+    static const bool enabled = getenv("RDMA_PROGRESS_THREADS") != nullptr;
+    return enabled;
+}
+
+ProgressEngine &ProgressEngine::shared() {
+    static ProgressEngine engine(max(1ul, stoul(getenv("RDMA_PROGRESS_THREADS"))));
+    return engine;
+}
+
+ProgressEngine::ReadinessQueue &ProgressEngine::queueForThread() {
+    // Pollers may still hold a pointer after the thread exited, so never free the queues
+    static thread_local auto queue = new ReadinessQueue();
+    return *queue;
+}
+
+ProgressEngine::ProgressEngine(size_t threadCount) :
+        yieldAfter(Tuning::get().spinBudget) {
+    for (size_t i = 0; i != threadCount; ++i) {
+        pollers.push_back(make_unique<Poller>());
+    }
+    for (size_t i = 0; i != threadCount; ++i) {
+        pollers[i]->thread = thread([this, i] { run(i); });
+    }
+}
+
+ProgressEngine::~ProgressEngine() {
+    running = false;
+    for (auto &poller : pollers) {
+        poller->thread.join();
+    }
+}
+
+shared_ptr<ProgressEngine::Connection> ProgressEngine::add(int fd, const MessageTransport &transport) {
+    auto connection = make_shared<Connection>(fd, transport);
+    Poller *target = nullptr;
+    size_t fewest = 0;
+    for (auto &poller : pollers) {
+        lock_guard<mutex> lock(poller->guard);
+        if (target == nullptr || poller->connections.size() < fewest) {
+            target = poller.get();
+            fewest = poller->connections.size();
+        }
+    }
+    lock_guard<mutex> lock(target->guard);
+    target->connections.push_back(connection);
+    return connection;
+}
+
+void ProgressEngine::remove(const shared_ptr<Connection> &connection) {
+    lock_guard<mutex> moving(migration);
+    for (auto &poller : pollers) {
+        lock_guard<mutex> lock(poller->guard);
+        auto &connections = poller->connections;
+        auto found = find(connections.begin(), connections.end(), connection);
+        if (found != connections.end()) {
+            connections.erase(found);
+            return;
+        }
+    }
+}
+
+void ProgressEngine::run(size_t index) {
+    try {
+        RDMANetworking::sharedNetwork().pinThreadToLocalCpu(static_cast<unsigned>(index));
+    } catch (const rdma::NetworkException &) {
+        // Already reported, just poll unpinned
+    }
+    auto &self = *pollers[index];
+    size_t idleSweeps = 0;
+    while (running.load(memory_order_relaxed)) {
+        size_t found = 0;
+        {
+            lock_guard<mutex> lock(self.guard);
+            for (auto &connection : self.connections) {
+                if (connection->ready.load(memory_order_relaxed) || not connection->transport.hasData()) {
+                    continue;
+                }
+                ++found;
+                connection->ready.store(true);
+                // Pairs with the application publishing its queue before checking ready
+                auto waiter = connection->waiter.load();
+                if (waiter != nullptr) {
+                    waiter->push(connection->fd);
+                }
+            }
+        }
+        self.load.store(found, memory_order_relaxed);
+
+        if (found != 0) {
+            idleSweeps = 0;
+            continue;
+        }
+        ++idleSweeps;
+        if (idleSweeps % STEAL_AFTER == 0) {
+            steal(self);
+        }
+        if (idleSweeps >= yieldAfter) {
+            this_thread::yield();
+        }
+    }
+}
+
+void ProgressEngine::steal(Poller &thief) {
+    Poller *victim = nullptr;
+    size_t busiest = 1;
+    for (auto &poller : pollers) {
+        const auto load = poller->load.load(memory_order_relaxed);
+        if (poller.get() != &thief && load > busiest) {
+            victim = poller.get();
+            busiest = load;
+        }
+    }
+    if (victim == nullptr) {
+        return;
+    }
+
+    // Never hold both pollers' locks, two pollers might steal from each other
+    lock_guard<mutex> moving(migration);
+    vector<shared_ptr<Connection>> stolen;
+    {
+        lock_guard<mutex> lock(victim->guard);
+        auto &connections = victim->connections;
+        const auto keep = connections.size() - connections.size() / 2;
+        stolen.assign(connections.begin() + keep, connections.end());
+        connections.resize(keep);
+        victim->load.store(0, memory_order_relaxed);
+    }
+    lock_guard<mutex> lock(thief.guard);
+    thief.connections.insert(thief.connections.end(), stolen.begin(), stolen.end());
+}
@@ -0,0 +1,116 @@
+#ifndef RDMA_HASH_MAP_PROGRESSENGINE_H
+#define RDMA_HASH_MAP_PROGRESSENGINE_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "MessageTransport.h"
+
+/// Optional poller threads, which watch connections on behalf of the application threads. Every poller owns a set of
+/// connections and checks them for data, the application threads only learn about connections which became ready
+/// through their ReadinessQueue. Idle pollers steal connections from busy ones.
+/// Enabled with RDMA_PROGRESS_THREADS=<n>, the pollers are pinned to distinct CPUs close to the HCA.
+class ProgressEngine {
+public:
+    /// Lock-free queue of connections (their file descriptors) which became ready, for many pollers and one
+    /// application thread
+    class ReadinessQueue {
+        static const size_t CAPACITY = 1024;
+        static_assert((CAPACITY & (CAPACITY - 1)) == 0, "CAPACITY must be a power of 2");
+
+        struct Entry {
+            /// The position this entry may be pushed to (if equal) or popped from (if one larger)
+            std::atomic<size_t> sequence;
+            int fd;
+        };
+
+        alignas(64) std::atomic<size_t> tail{0};
+        alignas(64) size_t head = 0;
+        /// Set when a push failed, the consumer has to look at all of its connections then
+        std::atomic<bool> overflowed{false};
+        alignas(64) std::array<Entry, CAPACITY> entries;
+
+    public:
+        ReadinessQueue();
+
+        void push(int fd);
+
+        /// Call func(int fd) for every queued connection, true if notifications were lost
+        template<typename Func>
+        bool drain(Func &&func) {
+            while (true) {
+                auto &entry = entries[head & (CAPACITY - 1)];
+                if (entry.sequence.load(std::memory_order_acquire) != head + 1) {
+                    break;
+                }
+                const auto fd = entry.fd;
+                entry.sequence.store(head + CAPACITY, std::memory_order_release);
+                ++head;
+                func(fd);
+            }
+            return overflowed.exchange(false);
+        }
+    };
+
+    /// A connection watched by the engine
+    struct Connection {
+        const int fd;
+        const MessageTransport &transport;
+        /// Set by the poller when the connection has data, cleared by the application once it found no more data
+        std::atomic<bool> ready{false};
+        /// The queue of the thread which polled this connection last
+        std::atomic<ReadinessQueue *> waiter{nullptr};
+
+        Connection(int fd, const MessageTransport &transport) : fd(fd), transport(transport) {}
+    };
+
+    /// Whether RDMA_PROGRESS_THREADS is set
+    static bool enabled();
+
+    /// The engine of this process
+    static ProgressEngine &shared();
+
+    /// The queue of the calling thread
+    static ReadinessQueue &queueForThread();
+
+    /// Hand a connection to the poller with the fewest connections. Only transports which allow concurrent hasData()
+    /// calls can be added
+    std::shared_ptr<Connection> add(int fd, const MessageTransport &transport);
+
+    /// Stop watching a connection, afterwards its transport may be destroyed
+    void remove(const std::shared_ptr<Connection> &connection);
+
+    ~ProgressEngine();
+
+private:
+    struct Poller {
+        std::mutex guard;
+        std::vector<std::shared_ptr<Connection>> connections;
+        /// Connections found ready in the last sweep, a measure for how busy the poller is
+        std::atomic<size_t> load{0};
+        std::thread thread;
+    };
+
+    /// Steal after that many sweeps without finding a ready connection
+    static const size_t STEAL_AFTER = 64;
+    /// Yield the CPU after that many idle sweeps
+    const size_t yieldAfter;
+
+    std::vector<std::unique_ptr<Poller>> pollers;
+    std::atomic<bool> running{true};
+    /// Held while connections move between pollers, so remove() finds them
+    std::mutex migration;
+
+    explicit ProgressEngine(size_t threadCount);
+
+    void run(size_t index);
+
+    /// Take half of the connections of the busiest other poller
+    void steal(Poller &thief);
+};
+
+#endif //RDMA_HASH_MAP_PROGRESSENGINE_H
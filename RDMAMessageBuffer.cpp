@@ -1,131 +1,315 @@
 #include "RDMAMessageBuffer.h"
+#include <algorithm>
 #include <iostream>
+#include <sstream>
+#include <infiniband/verbs.h>
 #include "rdma/WorkRequest.hpp"
+#include "rdma/RegistrationCache.hpp"
 #include "tcpWrapper.h"
+#include "Wraparound.h"
+#include "DoorbellMap.h"
+#include "Tuning.h"
 
 using namespace std;
 using namespace rdma;
 
 static const size_t validity = 0xDEADDEADBEEFBEEF; // arbitrary constant. Just don't use 0
+static const uint64_t zeroCopyWriteId = 43;
+static const uint64_t signaledWriteId = 47;
+/// The most requests a message posts at once: header, payload and footer around the end of the ring, the doorbell and
+/// a read of the remote readPos
+static const size_t maxRequestsPerMessage = 5;
+
+static const uint8_t doorbellRing = 1;
+/// Set in the header of all but the last frame of a message
+static const uint64_t moreSegments = 1ull << 63;
+/// Set in the header of the first frame of a message cut into several, its payload starts with the message's length
+static const uint64_t firstSegment = 1ull << 62;
+static const uint64_t frameFlags = moreSegments | firstSegment;
+
+/// The footer of the frame starting at the given position of the stream. The frames of a connection may arrive out of
+/// order on several queue pairs, but a frame is only valid at its own position
+static size_t footerAt(size_t position) {
+    return validity ^ position;
+}
 
 struct RmrInfo {
     uint32_t bufferKey;
     uint32_t readPosKey;
+    uint32_t doorbellKey;
     uintptr_t bufferAddress;
     uintptr_t readPosAddress;
+    uintptr_t doorbellAddress;
 };
 
-static void receiveAndSetupRmr(int sock, RemoteMemoryRegion &buffer, RemoteMemoryRegion &readPos) {
-    RmrInfo rmrInfo{};
-    tcp_read(sock, &rmrInfo, sizeof(rmrInfo));
+static_assert(sizeof(RmrInfo) <= ConnectionManager::MAX_INFO_SIZE, "fits into a connection request");
+
+static void setupRmr(const RmrInfo &rmrInfo, RemoteMemoryRegion &buffer, RemoteMemoryRegion &readPos,
+                     RemoteMemoryRegion &doorbell) {
     buffer.key = rmrInfo.bufferKey;
     buffer.address = rmrInfo.bufferAddress;
     readPos.key = rmrInfo.readPosKey;
     readPos.address = rmrInfo.readPosAddress;
+    doorbell.key = rmrInfo.doorbellKey;
+    doorbell.address = rmrInfo.doorbellAddress;
+}
+
+static void receiveAndSetupRmr(int sock, RemoteMemoryRegion &buffer, RemoteMemoryRegion &readPos,
+                               RemoteMemoryRegion &doorbell) {
+    RmrInfo rmrInfo{};
+    tcp_read(sock, &rmrInfo, sizeof(rmrInfo));
+    setupRmr(rmrInfo, buffer, readPos, doorbell);
 }
 
-static void sendRmrInfo(int sock, const MemoryRegion &buffer, const MemoryRegion &readPos) {
+static RmrInfo makeRmrInfo(const MemoryRegion::Slice &buffer, const MemoryRegion::Slice &readPos,
+                           const MemoryRegion::Slice &doorbell) {
     RmrInfo rmrInfo{};
-    rmrInfo.bufferKey = buffer.key->rkey;
+    rmrInfo.bufferKey = buffer.rkey;
     rmrInfo.bufferAddress = reinterpret_cast<uintptr_t>(buffer.address);
-    rmrInfo.readPosKey = readPos.key->rkey;
+    rmrInfo.readPosKey = readPos.rkey;
     rmrInfo.readPosAddress = reinterpret_cast<uintptr_t>(readPos.address);
+    rmrInfo.doorbellKey = doorbell.rkey;
+    rmrInfo.doorbellAddress = reinterpret_cast<uintptr_t>(doorbell.address);
+    return rmrInfo;
+}
+
+static void sendRmrInfo(int sock, const MemoryRegion::Slice &buffer, const MemoryRegion::Slice &readPos,
+                        const MemoryRegion::Slice &doorbell) {
+    auto rmrInfo = makeRmrInfo(buffer, readPos, doorbell);
     tcp_write(sock, &rmrInfo, sizeof(rmrInfo));
 }
 
-static void exchangeQPNAndConnect(int sock, Network &network, QueuePair &queuePair) {
-    Address addr{};
-    addr.lid = network.getLID();
-    addr.qpn = queuePair.getQPN();
-    tcp_write(sock, &addr, sizeof(addr)); // Send own qpn to server
+static void exchangeQPNAndConnect(int sock, QueuePair &queuePair, unsigned retryCount) {
+    Address addr = queuePair.getAddress();
+    tcp_write(sock, &addr, sizeof(addr)); // Send own qpn, lid and gid to server
     tcp_read(sock, &addr, sizeof(addr)); // receive qpn
-    queuePair.connect(addr);
-    cout << "connected to qpn " << addr.qpn << " lid: " << addr.lid << endl;
+    queuePair.connect(addr, retryCount);
+    cout << "connected to " << addr << endl;
 }
 
 vector<uint8_t> RDMAMessageBuffer::receive() {
-    size_t receiveSize = 0;
-    auto receiveValidity = static_cast<decltype(validity)>(0);
-    do {
-        readFromReceiveBuffer(readPos, reinterpret_cast<uint8_t *>(&receiveSize), sizeof(receiveSize));
-        readFromReceiveBuffer(readPos + sizeof(receiveSize) + receiveSize,
-                              reinterpret_cast<uint8_t *>(&receiveValidity), sizeof(receiveValidity));
-    } while (receiveValidity != validity);
-
-    auto result = vector<uint8_t>(receiveSize);
-    readFromReceiveBuffer(readPos + sizeof(receiveSize), result.data(), receiveSize);
-    zeroReceiveBuffer(readPos, sizeof(receiveSize) + receiveSize + sizeof(validity));
-
-    readPos += sizeof(receiveSize) + receiveSize + sizeof(validity);
+    vector<uint8_t> result;
+    for (bool more = true; more;) {
+        const size_t readPos = control.readPos.load(memory_order_relaxed); // only ever written by us
+        uint64_t header;
+        while (not frameArrived(readPos, header));
 
+        const size_t frameSize = header & ~frameFlags;
+        size_t payloadPos = readPos + sizeof(header);
+        if (header & firstSegment) {
+            size_t messageLength;
+            readFromReceiveBuffer(payloadPos, reinterpret_cast<uint8_t *>(&messageLength), sizeof(messageLength));
+            payloadPos += sizeof(messageLength);
+            result.reserve(messageLength);
+        }
+        const size_t receiveSize = frameSize - (payloadPos - readPos - sizeof(header));
+        const size_t offset = result.size();
+        result.resize(offset + receiveSize);
+        readFromReceiveBuffer(payloadPos, result.data() + offset, receiveSize);
+        consumeFrame(readPos, frameSize);
+        more = (header & moreSegments) != 0;
+    }
     return result;
 }
 
 size_t RDMAMessageBuffer::receive(void *whereTo, size_t maxSize) {
-    size_t receiveSize = 0;
-    auto receiveValidity = static_cast<decltype(validity)>(0);
-    do {
-        readFromReceiveBuffer(readPos, reinterpret_cast<uint8_t *>(&receiveSize), sizeof(receiveSize));
-        readFromReceiveBuffer(readPos + sizeof(receiveSize) + receiveSize,
-                              reinterpret_cast<uint8_t *>(&receiveValidity),
-                              sizeof(receiveValidity));
-    } while (receiveValidity != validity);
+    size_t received = 0;
+    for (bool more = true; more;) {
+        const size_t readPos = control.readPos.load(memory_order_relaxed); // only ever written by us
+        uint64_t header;
+        while (not frameArrived(readPos, header));
 
-    if (receiveSize > maxSize) {
-        throw runtime_error{"plz only read whole messages for now!"}; // probably buffer partially read msgs
+        // Check the length of the whole message before consuming any of its frames
+        const size_t frameSize = header & ~frameFlags;
+        size_t payloadPos = readPos + sizeof(header);
+        size_t messageLength = frameSize;
+        if (header & firstSegment) {
+            readFromReceiveBuffer(payloadPos, reinterpret_cast<uint8_t *>(&messageLength), sizeof(messageLength));
+            payloadPos += sizeof(messageLength);
+        }
+        if (received == 0 && messageLength > maxSize) {
+            throw runtime_error{"plz only read whole messages for now!"}; // probably buffer partially read msgs
+        }
+        const size_t receiveSize = frameSize - (payloadPos - readPos - sizeof(header));
+        readFromReceiveBuffer(payloadPos, reinterpret_cast<uint8_t *>(whereTo) + received, receiveSize);
+        consumeFrame(readPos, frameSize);
+        received += receiveSize;
+        more = (header & moreSegments) != 0;
     }
-    readFromReceiveBuffer(readPos + sizeof(receiveSize), reinterpret_cast<uint8_t *>(whereTo), receiveSize);
-    zeroReceiveBuffer(readPos, sizeof(receiveSize) + receiveSize + sizeof(validity));
+    return received;
+}
 
-    readPos += sizeof(receiveSize) + receiveSize + sizeof(validity);
+bool RDMAMessageBuffer::frameArrived(size_t readPos, uint64_t &header) const {
+    auto receiveValidity = static_cast<decltype(validity)>(0);
+    readFromReceiveBuffer(readPos, reinterpret_cast<uint8_t *>(&header), sizeof(header));
+    readFromReceiveBuffer(readPos + sizeof(header) + (header & ~frameFlags),
+                          reinterpret_cast<uint8_t *>(&receiveValidity), sizeof(receiveValidity));
+    return receiveValidity == footerAt(readPos);
+}
 
-    return receiveSize;
+void RDMAMessageBuffer::consumeFrame(size_t readPos, size_t length) {
+    zeroReceiveBuffer(readPos, sizeof(uint64_t) + length + sizeof(validity));
+
+    // Release: the zeroed memory has to be in place before the sender may overwrite it
+    control.readPos.store(readPos + sizeof(uint64_t) + length + sizeof(validity), memory_order_release);
 }
 
-RDMAMessageBuffer::RDMAMessageBuffer(size_t size, int sock) :
-        size(size),
-        net(sock),
-        receiveBuffer(make_unique<volatile uint8_t[]>(size)),
-        sendBuffer(make_unique<uint8_t[]>(size)),
-        localSend(sendBuffer.get(), size, net.network.getProtectionDomain(), MemoryRegion::Permission::None),
-        localReceive(const_cast<uint8_t *>(receiveBuffer.get()), size, net.network.getProtectionDomain(),
-                     MemoryRegion::Permission::LocalWrite | MemoryRegion::Permission::RemoteWrite),
-        localReadPos(&readPos, sizeof(readPos), net.network.getProtectionDomain(),
-                     MemoryRegion::Permission::RemoteRead),
-        localCurrentRemoteReceive(const_cast<size_t *>(&currentRemoteReceive), sizeof(currentRemoteReceive),
-                                  net.network.getProtectionDomain(), MemoryRegion::Permission::LocalWrite) {
+static MemorySlab::Allocation allocateFromSlab(Network &network, size_t size, MemoryRegion::Permission permissions,
+                                               size_t alignment = 64) {
+    auto &slab = network.getMemorySlab();
+    return MemorySlab::Allocation(slab, slab.allocate(size, permissions, alignment));
+}
+
+static size_t checkPowerOfTwo(size_t size) {
     const bool powerOfTwo = (size != 0) && !(size & (size - 1));
     if (not powerOfTwo) {
         throw runtime_error{"size should be a power of 2"};
     }
+    return size;
+}
+
+RDMAMessageBuffer::RDMAMessageBuffer(size_t size, Network &network, const QueuePair::Profile &profile,
+                                     RDMANetworking::Unconnected unconnected) :
+        size(checkPowerOfTwo(size)),
+        localSend(allocateFromSlab(network, size, MemoryRegion::Permission::None, 4096)),
+        localReceive(allocateFromSlab(network, size,
+                                      MemoryRegion::Permission::LocalWrite | MemoryRegion::Permission::RemoteWrite,
+                                      4096)),
+        // The remote side reads our readPos, the NIC writes the fetched remote readPos
+        localControl(allocateFromSlab(network, sizeof(ControlBlock),
+                                      MemoryRegion::Permission::LocalWrite | MemoryRegion::Permission::RemoteRead)),
+        net(unconnected, network, 0, profile),
+        receiveBuffer(localReceive.as<volatile uint8_t>()),
+        sendBuffer(localSend.as<uint8_t>()),
+        control(*new(localControl.slice.address) ControlBlock()),
+        flow(SendScheduler::shared(), size),
+        doorbell(DoorbellMap::shared().acquire()) {
+    setInlineThreshold(Tuning::get().inlineThreshold);
+    setSignalInterval(Tuning::get().signalInterval);
+}
 
+RDMAMessageBuffer::RDMAMessageBuffer(size_t size, int sock) :
+        RDMAMessageBuffer(size, sock, RDMANetworking::networkForConnection()) {
+}
+
+RDMAMessageBuffer::RDMAMessageBuffer(size_t size, int sock, Network &network, const QueuePair::Profile &profile) :
+        RDMAMessageBuffer(size, network, profile, RDMANetworking::Unconnected{}) {
     tcp_setBlocking(sock); // just set the socket to block for our setup.
+    connectQueuePairs(sock);
+
+    const auto readPosSlice = MemoryRegion::Slice(&control.readPos, sizeof(control.readPos), localControl.slice.lkey,
+                                                  localControl.slice.rkey);
+    sendRmrInfo(sock, localReceive.slice, readPosSlice, DoorbellMap::shared().getSlot(doorbell, net.network));
+    receiveAndSetupRmr(sock, remoteReceive, remoteReadPos, remoteDoorbell);
+}
 
-    sendRmrInfo(sock, localReceive, localReadPos);
-    receiveAndSetupRmr(sock, remoteReceive, remoteReadPos);
+RDMAMessageBuffer::RDMAMessageBuffer(size_t size, ConnectionManager &manager,
+                                     const ConnectionManager::Rendezvous &rendezvous) :
+        // The connection manager resolves the route from the IP address, we only know the shared network matches it
+        RDMAMessageBuffer(size, RDMANetworking::sharedNetwork(), QueuePair::Profile::standard(),
+                          RDMANetworking::Unconnected{}) {
+    const auto readPosSlice = MemoryRegion::Slice(&control.readPos, sizeof(control.readPos), localControl.slice.lkey,
+                                                  localControl.slice.rkey);
+    const auto localInfo = makeRmrInfo(localReceive.slice, readPosSlice,
+                                       DoorbellMap::shared().getSlot(doorbell, net.network));
+    RmrInfo remoteInfo{};
+    managedConnection = manager.connect(net.queuePair, rendezvous, &localInfo, &remoteInfo, sizeof(remoteInfo));
+    setupRmr(remoteInfo, remoteReceive, remoteReadPos, remoteDoorbell);
 }
 
-/// Higher order wraparound function. Calls the given function func() once or twice, depending on if a wraparound is needed or not
-template<typename Func>
-void wraparound(const size_t totalSize, const size_t todoSize, const size_t pos, Func &&func) {
-    const size_t beginPos = pos & (totalSize - 1);
-    if ((totalSize - beginPos) >= todoSize) {
-        func(0, beginPos, beginPos + todoSize);
+void RDMAMessageBuffer::connectQueuePairs(int sock) {
+    // Both sides open as many queue pairs as the one asking for fewer
+    auto queuePairs = static_cast<uint32_t>(RDMANetworking::queuePairsPerConnection());
+    uint32_t remoteQueuePairs = 0;
+    tcp_write(sock, &queuePairs, sizeof(queuePairs));
+    tcp_read(sock, &remoteQueuePairs, sizeof(remoteQueuePairs));
+    queuePairs = max<uint32_t>(min(queuePairs, remoteQueuePairs), 1);
+
+    net.addQueuePairs(queuePairs - 1);
+    for (size_t i = 0; i != net.getQueuePairCount(); ++i) {
+        exchangeQPNAndConnect(sock, net.getQueuePair(i), 0);
+    }
+    sendQueues.resize(queuePairs);
+    if (queuePairs > 1) {
+        segmentSize = size / (2 * queuePairs);
+    }
+}
+
+RDMAMessageBuffer::~RDMAMessageBuffer() {
+    DoorbellMap::shared().release(doorbell);
+}
+
+void RDMAMessageBuffer::postWithDoorbell(vector<WriteWorkRequest> &writes) {
+    const size_t index = nextQueuePair;
+    nextQueuePair = (nextQueuePair + 1) % sendQueues.size();
+    auto &queue = sendQueues[index];
+
+    // Written after the frame on the same queue pair, so the frame is in place once the doorbell rings
+    WriteWorkRequest ring;
+    ring.setLocalAddress(MemoryRegion::Slice(const_cast<uint8_t *>(&doorbellRing), sizeof(doorbellRing), 0));
+    ring.setRemoteAddress(remoteDoorbell);
+    ring.setSendInline(true);
+    writes.push_back(move(ring));
+
+    if (queue.postedSinceSignal + writes.size() >= signalInterval) {
+        // The completion of the previous signal frees the send queue up to it
+        while (queue.signalPending) {
+            pollSendCompletion();
+        }
+        writes.back().setCompletion(true);
+        writes.back().setId(signaledWriteId | index << 32);
+        queue.signalPending = true;
+        queue.postedSinceSignal = 0;
     } else {
-        const auto fst = beginPos;
-        const auto fstToRead = totalSize - beginPos;
-        const auto snd = 0;
-        const auto sndToRead = todoSize - fstToRead;
-        func(0, fst, fst + fstToRead);
-        func(fstToRead, snd, snd + sndToRead);
+        queue.postedSinceSignal += writes.size();
+    }
+
+    for (size_t i = 0; i + 1 < writes.size(); ++i) {
+        writes[i].setNextWorkRequest(&writes[i + 1]);
+    }
+    net.getQueuePair(index).postWorkRequest(writes.front());
+}
+
+uint64_t RDMAMessageBuffer::pollSendCompletion() {
+    const auto id = net.pollSendCompletionQueue();
+    if (id == ReadWorkRequest::getId()) {
+        readPosPending = false;
+        flow.completed(SendScheduler::Clock::now() - readPosPosted);
+    } else if ((id & 0xFFFFFFFF) == signaledWriteId) {
+        // The upper half is the queue pair's index
+        sendQueues[id >> 32].signalPending = false;
     }
+    return id;
 }
 
-/// func(size_t prevBytes, T* begin, T* end)
-template<typename T, typename Func>
-void wraparound(T *buffer, const size_t totalSize, const size_t todoSize, const size_t pos, Func &&func) {
-    wraparound(totalSize, todoSize, pos, [&](auto prevBytes, auto beginPos, auto endPos) {
-        func(prevBytes, buffer + beginPos, buffer + endPos);
+void RDMAMessageBuffer::flush() {
+    // Completions are in order, so a signaled ring of the doorbell completes after all writes before it
+    for (size_t index = 0; index != sendQueues.size(); ++index) {
+        auto &queue = sendQueues[index];
+        while (queue.signalPending) {
+            pollSendCompletion();
+        }
+        if (queue.postedSinceSignal == 0) {
+            continue;
+        }
+        WriteWorkRequest ring;
+        ring.setLocalAddress(MemoryRegion::Slice(const_cast<uint8_t *>(&doorbellRing), sizeof(doorbellRing), 0));
+        ring.setRemoteAddress(remoteDoorbell);
+        ring.setSendInline(true);
+        ring.setCompletion(true);
+        ring.setId(signaledWriteId | index << 32);
+        queue.signalPending = true;
+        queue.postedSinceSignal = 0;
+        net.getQueuePair(index).postWorkRequest(ring);
+        while (queue.signalPending) {
+            pollSendCompletion();
+        }
+    }
+}
+
+bool RDMAMessageBuffer::completionPending() const {
+    return readPosPending || any_of(sendQueues.begin(), sendQueues.end(), [](const SendQueue &queue) {
+        return queue.signalPending;
     });
 }
 
@@ -136,34 +320,275 @@ void RDMAMessageBuffer::send(const uint8_t *data, size_t length) {
 void RDMAMessageBuffer::send(const uint8_t *data, size_t length, bool inln) {
     const size_t sizeToWrite = sizeof(length) + length + sizeof(validity);
     if (sizeToWrite > size) throw runtime_error{"data > buffersize!"};
+    if (sharedSend) {
+        sendShared(data, length);
+        return;
+    }
+    if (length >= zeroCopyThreshold) {
+        sendZeroCopy(data, length);
+        return;
+    }
+
+    // With several queue pairs, large messages are cut into frames, which are transferred in parallel. The first one
+    // announces the whole length, so a receiver can reject the message before consuming any of it
+    if (length <= segmentSize) {
+        sendFrame(data, length, 0, inln);
+        return;
+    }
+    sendFrame(data, segmentSize, moreSegments | firstSegment, inln, &length);
+    size_t offset = segmentSize;
+    for (; length - offset > segmentSize; offset += segmentSize) {
+        sendFrame(data + offset, segmentSize, moreSegments, inln);
+    }
+    sendFrame(data + offset, length - offset, 0, inln);
+}
 
+void RDMAMessageBuffer::sendFrame(const uint8_t *data, size_t length, uint64_t flags, bool inln,
+                                  const size_t *messageLength) {
+    const size_t prefixSize = messageLength != nullptr ? sizeof(*messageLength) : 0;
+    const size_t sizeToWrite = sizeof(length) + prefixSize + length + sizeof(validity);
+    admitToFlow(sizeToWrite);
     const size_t startOfWrite = sendPos;
+    const uint64_t header = (prefixSize + length) | flags;
+    const size_t footer = footerAt(startOfWrite);
 
-    writeToSendBuffer(reinterpret_cast<const uint8_t *>(&length), sizeof(length));
+    writeToSendBuffer(reinterpret_cast<const uint8_t *>(&header), sizeof(header));
+    if (messageLength != nullptr) {
+        writeToSendBuffer(reinterpret_cast<const uint8_t *>(messageLength), sizeof(*messageLength));
+    }
     writeToSendBuffer(data, length);
-    writeToSendBuffer(reinterpret_cast<const uint8_t *>(&validity), sizeof(validity));
+    writeToSendBuffer(reinterpret_cast<const uint8_t *>(&footer), sizeof(footer));
 
+    vector<WriteWorkRequest> writes;
+    writes.reserve(3);
     wraparound(size, sizeToWrite, startOfWrite, [&](auto, auto beginPos, auto endPos) {
-        const auto sendSlice = localSend.slice(beginPos, endPos - beginPos);
+        const auto sendSlice = MemoryRegion::Slice(sendBuffer + beginPos, endPos - beginPos, localSend.slice.lkey);
         const auto remoteSlice = remoteReceive.slice(beginPos);
-        WriteWorkRequestBuilder(sendSlice, remoteSlice, false)
-                .setInline(inln && sendSlice.size <= net.queuePair.getMaxInlineSize())
-                .send(net.queuePair);
+        writes.push_back(WriteWorkRequestBuilder(sendSlice, remoteSlice, false)
+                                 .setInline(inln && sendSlice.size <= inlineThreshold)
+                                 .build());
     });
+    postWithDoorbell(writes);
 }
 
-void RDMAMessageBuffer::writeToSendBuffer(const uint8_t *data, size_t sizeToWrite) {
+void RDMAMessageBuffer::setInlineThreshold(size_t threshold) {
+    inlineThreshold = min<size_t>(threshold, net.queuePair.getMaxInlineSize());
+}
+
+void RDMAMessageBuffer::setSignalInterval(size_t interval) {
+    // The requests up to the previous signal and since then have to fit
+    const auto maxInterval = max<size_t>(net.queuePair.getProfile().sendWorkRequests / 2, 2 * maxRequestsPerMessage) -
+                             maxRequestsPerMessage;
+    signalInterval = interval == 0 ? maxInterval : min(interval, maxInterval);
+}
+
+void RDMAMessageBuffer::setMultiProducer() {
+    sharedSend = make_unique<SharedSendState>(sendPos);
+}
+
+void RDMAMessageBuffer::sendShared(const uint8_t *data, size_t length) {
+    const size_t sizeToWrite = sizeof(length) + length + sizeof(validity);
+    const size_t startOfWrite = sharedSend->reserved.fetch_add(sizeToWrite);
+    const size_t endOfWrite = startOfWrite + sizeToWrite;
+
+    // Once the remote side consumed up to here, the NIC is done with the old contents of our part of the send buffer.
+    // Until the remote side consumed everything before us, the flow's window applies as well
+    while (not sharedSpaceAllows(startOfWrite, endOfWrite)) {
+        progressSharedSend(true);
+    }
+    commitShared(data, length, startOfWrite);
+}
+
+bool RDMAMessageBuffer::trySendShared(const uint8_t *data, size_t length) {
+    // Reserve only if there is space, a reservation can't be handed back once later senders reserved behind it
+    const size_t sizeToWrite = sizeof(length) + length + sizeof(validity);
+    size_t startOfWrite = sharedSend->reserved.load();
+    do {
+        if (not sharedSpaceAllows(startOfWrite, startOfWrite + sizeToWrite)) {
+            progressSharedSend(true);
+            return false;
+        }
+    } while (not sharedSend->reserved.compare_exchange_weak(startOfWrite, startOfWrite + sizeToWrite));
+    commitShared(data, length, startOfWrite);
+    return true;
+}
+
+bool RDMAMessageBuffer::sharedSpaceAllows(size_t startOfWrite, size_t endOfWrite) const {
+    const size_t remoteReceive = control.currentRemoteReceive.load(memory_order_relaxed);
+    return endOfWrite - remoteReceive <= size &&
+           (startOfWrite == remoteReceive || endOfWrite - remoteReceive <= flow.getWindow());
+}
+
+void RDMAMessageBuffer::commitShared(const uint8_t *data, size_t length, size_t startOfWrite) {
+    const size_t endOfWrite = startOfWrite + sizeof(length) + length + sizeof(validity);
+    size_t writePos = startOfWrite;
+    auto copyToSendBuffer = [&](const uint8_t *source, size_t sizeToCopy) {
+        wraparound(sendBuffer, size, sizeToCopy, writePos, [&](auto prevBytes, auto begin, auto end) {
+            copy(source + prevBytes, source + prevBytes + distance(begin, end), begin);
+        });
+        writePos += sizeToCopy;
+    };
+    const size_t footer = footerAt(startOfWrite);
+    copyToSendBuffer(reinterpret_cast<const uint8_t *>(&length), sizeof(length));
+    copyToSendBuffer(data, length);
+    copyToSendBuffer(reinterpret_cast<const uint8_t *>(&footer), sizeof(footer));
+
+    // Commit in the order of the reservations, so the committed range is always contiguous
+    while (sharedSend->committed.load(memory_order_acquire) != startOfWrite);
+    sharedSend->committed.store(endOfWrite, memory_order_release);
+    progressSharedSend(false);
+}
+
+void RDMAMessageBuffer::progressSharedSend(bool needSpace) {
+    do {
+        unique_lock<mutex> lock(sharedSend->poster, try_to_lock);
+        if (not lock.owns_lock()) {
+            // The owner looks for new commits after unlocking
+            return;
+        }
+        size_t committed;
+        while ((committed = sharedSend->committed.load(memory_order_acquire)) != sharedSend->posted.load()) {
+            const size_t startOfWrite = sharedSend->posted.load();
+            vector<WriteWorkRequest> writes;
+            writes.reserve(3);
+            wraparound(size, committed - startOfWrite, startOfWrite, [&](auto, auto beginPos, auto endPos) {
+                const auto sendSlice = MemoryRegion::Slice(sendBuffer + beginPos, endPos - beginPos,
+                                                           localSend.slice.lkey);
+                writes.push_back(WriteWorkRequestBuilder(sendSlice, remoteReceive.slice(beginPos), false)
+                                         .setInline(sendSlice.size <= inlineThreshold)
+                                         .build());
+            });
+            flow.admit(committed - startOfWrite);
+            postWithDoorbell(writes);
+            sharedSend->posted.store(committed);
+        }
+        if (completionPending()) {
+            pollSendCompletion();
+        }
+        if (needSpace && not readPosPending) {
+            fetchRemoteReadPos();
+        }
+    } while (sharedSend->committed.load() != sharedSend->posted.load());
+}
+
+void RDMAMessageBuffer::sendZeroCopy(const uint8_t *data, size_t length) {
+    const size_t sizeToWrite = sizeof(length) + length + sizeof(validity);
+    const auto payload = net.network.getRegistrationCache().lookup(data, length);
+    admitToFlow(sizeToWrite);
+
+    // Header and footer go through the send buffer, only space is reserved for the payload
+    const size_t startOfWrite = sendPos;
+    const size_t footer = footerAt(startOfWrite);
+    writeToSendBuffer(reinterpret_cast<const uint8_t *>(&length), sizeof(length));
+    waitForSendSpace(length);
+    sendPos += length;
+    writeToSendBuffer(reinterpret_cast<const uint8_t *>(&footer), sizeof(footer));
+
+    // Gather each contiguous part of the remote buffer from header, payload and footer in a single request
+    const size_t payloadBegin = sizeof(length);
+    const size_t payloadEnd = payloadBegin + length;
+    vector<WriteWorkRequest> writes;
+    writes.reserve(3);
+    wraparound(size, sizeToWrite, startOfWrite, [&](auto prevBytes, auto beginPos, auto endPos) {
+        const size_t first = prevBytes;
+        const size_t last = prevBytes + (endPos - beginPos);
+        vector<MemoryRegion::Slice> pieces;
+        auto addPiece = [&](size_t from, size_t to, uint8_t *address, uint32_t lkey) {
+            from = max(from, first);
+            to = min(to, last);
+            if (from < to) {
+                pieces.emplace_back(address + from, to - from, lkey);
+            }
+        };
+        uint8_t *messageInSendBuffer = sendBuffer + beginPos - first; // send buffer position of message byte 0
+        addPiece(0, payloadBegin, messageInSendBuffer, localSend.slice.lkey);
+        addPiece(payloadBegin, payloadEnd, reinterpret_cast<uint8_t *>(payload.slice.address) - payloadBegin,
+                 payload.slice.lkey);
+        addPiece(payloadEnd, sizeToWrite, messageInSendBuffer, localSend.slice.lkey);
+
+        WriteWorkRequest request;
+        request.setLocalAddress(pieces);
+        request.setRemoteAddress(remoteReceive.slice(beginPos));
+        request.setCompletion(last == sizeToWrite);
+        request.setId(zeroCopyWriteId);
+        writes.push_back(move(request));
+    });
+    postWithDoorbell(writes);
+
+    // The application may reuse its memory as soon as we return
+    while (pollSendCompletion() != zeroCopyWriteId);
+}
+
+bool RDMAMessageBuffer::trySend(const uint8_t *data, size_t length) {
+    const size_t sizeToWrite = sizeof(length) + length + sizeof(validity);
+    if (sizeToWrite > size) throw runtime_error{"data > buffersize!"};
+    if (sharedSend) {
+        // sendPos doesn't advance with shared sends, and the queue pair belongs to whoever holds the poster lock
+        return trySendShared(data, length);
+    }
+    if (completionPending()) {
+        pollSendCompletion();
+    }
+    if (sizeToWrite > knownSendSpace() || not windowAllows(sizeToWrite)) {
+        if (not readPosPending) {
+            fetchRemoteReadPos();
+        }
+        return false;
+    }
+    if (not flow.isReady()) {
+        return false;
+    }
+    send(data, length);
+    return true;
+}
+
+size_t RDMAMessageBuffer::knownSendSpace() const {
+    // The NIC's write is complete once we polled its completion, so relaxed loads of currentRemoteReceive are sufficient
+    return size - (sendPos - control.currentRemoteReceive.load(memory_order_relaxed));
+}
+
+void RDMAMessageBuffer::fetchRemoteReadPos() {
+    const auto target = MemoryRegion::Slice(&control.currentRemoteReceive, sizeof(control.currentRemoteReceive),
+                                            localControl.slice.lkey);
+    ReadWorkRequestBuilder(target, remoteReadPos, true)
+            .send(net.queuePair);
+    readPosPending = true;
+    readPosPosted = SendScheduler::Clock::now();
+    ++sendQueues[0].postedSinceSignal;
+}
+
+void RDMAMessageBuffer::awaitRemoteReadPos() {
+    if (not readPosPending) {
+        fetchRemoteReadPos();
+    }
+    while (readPosPending) {
+        pollSendCompletion(); // Poll until read has finished
+    }
+}
+
+void RDMAMessageBuffer::waitForSendSpace(size_t sizeToWrite) {
     // Make sure, there is enough space
-    size_t safeToWrite = size - (sendPos - currentRemoteReceive);
-    while (sizeToWrite > safeToWrite) {
-        ReadWorkRequestBuilder(localCurrentRemoteReceive, remoteReadPos, true)
-                .send(net.queuePair);
-        while (net.completionQueue.pollSendCompletionQueue() !=
-               ReadWorkRequest::getId()); // Poll until read has finished
-        safeToWrite = size - (sendPos - currentRemoteReceive);
+    while (sizeToWrite > knownSendSpace()) {
+        awaitRemoteReadPos();
+    }
+}
+
+bool RDMAMessageBuffer::windowAllows(size_t sizeToWrite) const {
+    const size_t outstanding = sendPos - control.currentRemoteReceive.load(memory_order_relaxed);
+    return outstanding == 0 || outstanding + sizeToWrite <= flow.getWindow();
+}
+
+void RDMAMessageBuffer::admitToFlow(size_t sizeToWrite) {
+    while (not windowAllows(sizeToWrite)) {
+        awaitRemoteReadPos();
     }
+    flow.admit(sizeToWrite);
+}
+
+void RDMAMessageBuffer::writeToSendBuffer(const uint8_t *data, size_t sizeToWrite) {
+    waitForSendSpace(sizeToWrite);
 
-    wraparound(sendBuffer.get(), size, sizeToWrite, sendPos, [&](auto prevBytes, auto begin, auto end) {
+    wraparound(sendBuffer, size, sizeToWrite, sendPos, [&](auto prevBytes, auto begin, auto end) {
         copy(data + prevBytes, data + prevBytes + distance(begin, end), begin);
     });
 
@@ -171,30 +596,162 @@ void RDMAMessageBuffer::writeToSendBuffer(const uint8_t *data, size_t sizeToWrit
 }
 
 void RDMAMessageBuffer::readFromReceiveBuffer(size_t readPos, uint8_t *whereTo, size_t sizeToRead) const {
-    wraparound(receiveBuffer.get(), size, sizeToRead, readPos, [whereTo](auto prevBytes, auto begin, auto end) {
+    wraparound(receiveBuffer, size, sizeToRead, readPos, [whereTo](auto prevBytes, auto begin, auto end) {
         copy(begin, end, whereTo + prevBytes);
     });
     // Don't increment currentRead, we might need to read the same position multiple times!
 }
 
 void RDMAMessageBuffer::zeroReceiveBuffer(size_t beginReceiveCount, size_t sizeToZero) {
-    wraparound(receiveBuffer.get(), size, sizeToZero, beginReceiveCount, [](auto, auto begin, auto end) {
+    wraparound(receiveBuffer, size, sizeToZero, beginReceiveCount, [](auto, auto begin, auto end) {
         fill(begin, end, 0);
     });
 }
 
 bool RDMAMessageBuffer::hasData() const {
-    size_t receiveSize;
-    auto receiveValidity = static_cast<decltype(validity)>(0);
-    readFromReceiveBuffer(readPos, reinterpret_cast<uint8_t *>(&receiveSize), sizeof(receiveSize));
-    readFromReceiveBuffer(readPos + sizeof(receiveSize) + receiveSize, reinterpret_cast<uint8_t *>(&receiveValidity),
-                          sizeof(receiveValidity));
-    return (receiveValidity == validity);
+    // A message is complete enough to be received once its first frame is there
+    uint64_t header;
+    return frameArrived(control.readPos.load(memory_order_relaxed), header);
 }
 
-RDMANetworking::RDMANetworking(int sock) :
-        completionQueue(network),
-        queuePair(network, completionQueue) {
+RDMANetworking::RDMANetworking(int sock, unsigned retryCount, int completionQueueSize) :
+        RDMANetworking(Unconnected{}, completionQueueSize) {
     tcp_setBlocking(sock); // just set the socket to block for our setup.
-    exchangeQPNAndConnect(sock, network, queuePair);
+    exchangeQPNAndConnect(sock, queuePair, retryCount);
+}
+
+RDMANetworking::RDMANetworking(Unconnected unconnected, int completionQueueSize) :
+        RDMANetworking(unconnected, sharedNetwork(), completionQueueSize) {
+}
+
+RDMANetworking::RDMANetworking(Unconnected, Network &network, int completionQueueSize,
+                               const QueuePair::Profile &profile) :
+        network(network),
+        sharedCompletionQueue(&network == &sharedNetwork() ? sharedCompletionQueueForThread() : nullptr),
+        ownCompletionQueue(sharedCompletionQueue ? nullptr : make_unique<CompletionQueuePair>(network, completionQueueSize)),
+        completionQueue(sharedCompletionQueue ? sharedCompletionQueue->getCompletionQueuePair() : *ownCompletionQueue),
+        sharedCompletions(sharedCompletionQueue ? make_unique<SharedCompletionQueue::Endpoint>(*sharedCompletionQueue)
+                                                : nullptr),
+        queuePair(network, completionQueue, profile) {
+    if (sharedCompletions) {
+        sharedCompletions->attach(queuePair.getQPN());
+    }
+    // The connection is polled by the thread setting it up, optionally keep that one close to the device
+    static const bool pinThreads = getenv("RDMA_PIN_THREADS") != nullptr;
+    static thread_local bool pinned = false;
+    if (pinThreads && not pinned) {
+        network.pinThreadToLocalNode();
+        pinned = true;
+    }
+}
+
+void RDMANetworking::addQueuePairs(size_t count) {
+    for (size_t i = 0; i != count; ++i) {
+        stripes.push_back(make_unique<QueuePair>(network, completionQueue, queuePair.getProfile()));
+        if (sharedCompletions) {
+            sharedCompletions->attach(stripes.back()->getQPN());
+        }
+    }
+}
+
+uint64_t RDMANetworking::pollSendCompletionQueue() {
+    return sharedCompletions ? sharedCompletions->pollSendCompletionQueue()
+                             : completionQueue.pollSendCompletionQueue();
+}
+
+uint64_t RDMANetworking::pollRecvCompletionQueue() {
+    return sharedCompletions ? sharedCompletions->pollRecvCompletionQueue()
+                             : completionQueue.pollRecvCompletionQueue();
+}
+
+SharedCompletionQueue *RDMANetworking::sharedCompletionQueueForThread() {
+    // Intentionally never destroyed, just like the network
+    static const auto queues = [] {
+        auto queues = new vector<unique_ptr<SharedCompletionQueue>>();
+        if (const char *count = getenv("RDMA_SHARED_CQ")) {
+            for (int i = max(atoi(count), 1); i != 0; --i) {
+                queues->push_back(make_unique<SharedCompletionQueue>(sharedNetwork()));
+            }
+        }
+        return queues;
+    }();
+    if (queues->empty()) {
+        return nullptr;
+    }
+    static atomic<size_t> nextQueue{0};
+    static thread_local size_t queue = nextQueue++ % queues->size();
+    return (*queues)[queue].get();
+}
+
+static atomic<Network *> sharedNetworkInstance{nullptr};
+
+static Network *createNetwork(const Rail &rail) {
+    auto network = new Network(rail);
+    network->getMemorySlab().setPageSize(MemorySlab::parsePageSize(getenv("RDMA_HUGEPAGES")));
+    return network;
+}
+
+const vector<Network *> &RDMANetworking::rails() {
+    // Intentionally never destroyed: connections living in other static objects may outlive a function local static
+    static auto rails = [] {
+        auto rails = new vector<Network *>();
+        const char *names = getenv("RDMA_RAILS");
+        if (names == nullptr) {
+            rails->push_back(createNetwork(Network::selectRail()));
+        } else if (string(names) == "all") {
+            for (auto &rail : Network::listRails()) {
+                rails->push_back(createNetwork(rail));
+            }
+        } else {
+            stringstream list(names);
+            string name;
+            while (getline(list, name, ',')) {
+                if (not name.empty()) {
+                    rails->push_back(createNetwork(Network::findRail(name)));
+                }
+            }
+        }
+        if (rails->empty()) {
+            string reason = "no rails in RDMA_RAILS=" + string(names);
+            cerr << reason << endl;
+            throw NetworkException(reason);
+        }
+        sharedNetworkInstance = rails->front();
+        return rails;
+    }();
+    return *rails;
+}
+
+Network &RDMANetworking::sharedNetwork() {
+    return *rails().front();
+}
+
+Network &RDMANetworking::networkForConnection() {
+    static const string policy = getenv("RDMA_RAIL_POLICY") ? getenv("RDMA_RAIL_POLICY") : "first";
+    auto &networks = rails();
+    if (policy == "roundrobin") {
+        static atomic<size_t> nextRail{0};
+        return *networks[nextRail++ % networks.size()];
+    }
+    if (policy == "numa") {
+        const auto node = Network::getCurrentNumaNode();
+        for (auto network : networks) {
+            if (network->getNumaNode() == node) {
+                return *network;
+            }
+        }
+    }
+    return *networks.front();
+}
+
+size_t RDMANetworking::queuePairsPerConnection() {
+    static const size_t queuePairs = [] {
+        const char *count = getenv("RDMA_QPS_PER_CONNECTION");
+        return count != nullptr ? max(atoi(count), 1) : 1;
+    }();
+    return queuePairs;
+}
+
+bool RDMANetworking::hasSharedNetwork() {
+    return sharedNetworkInstance.load() != nullptr;
 }
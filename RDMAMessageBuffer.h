@@ -2,58 +2,284 @@
 #define RDMA_HASH_MAP_RDMAMESSAGEBUFFER_H
 
 #include <atomic>
+#include <limits>
+#include <mutex>
+#include "MessageTransport.h"
+#include "SendScheduler.h"
 #include "rdma/Network.hpp"
 #include "rdma/CompletionQueuePair.hpp"
 #include "rdma/QueuePair.hpp"
 #include "rdma/MemoryRegion.hpp"
+#include "rdma/MemorySlab.hpp"
+#include "rdma/WorkRequest.hpp"
+#include "rdma/SharedCompletionQueue.hpp"
+#include "rdma/ConnectionManager.hpp"
 
 struct RDMANetworking {
-    rdma::Network network;
-    rdma::CompletionQueuePair completionQueue;
+    rdma::Network &network;
+    /// The completion queue shared with other connections (nullptr if the connection has its own)
+    rdma::SharedCompletionQueue *sharedCompletionQueue;
+    std::unique_ptr<rdma::CompletionQueuePair> ownCompletionQueue;
+    rdma::CompletionQueuePair &completionQueue;
+    /// Declared before the queue pair, so completions are routed here until the queue pair is gone
+    std::unique_ptr<rdma::SharedCompletionQueue::Endpoint> sharedCompletions;
     rdma::QueuePair queuePair;
+    /// The connection's further queue pairs, on the same network and completion queue
+    std::vector<std::unique_ptr<rdma::QueuePair>> stripes;
 
-    /// Exchange the basic RDMA connection info for the network and queues
-    RDMANetworking(int sock);
+    /// Exchange the basic RDMA connection info for the network and queues. A dedicated completion queue gets at least
+    /// completionQueueSize entries
+    RDMANetworking(int sock, unsigned retryCount = 0, int completionQueueSize = 0);
+
+    struct Unconnected {
+    };
+
+    /// Set up the network and queues, but leave connecting the queue pair to the caller, e.g. the connection manager
+    explicit RDMANetworking(Unconnected, int completionQueueSize = 0);
+
+    /// Set up the queues on the given rail's network, shared completion queues are only used on sharedNetwork()
+    RDMANetworking(Unconnected, rdma::Network &network, int completionQueueSize = 0,
+                   const rdma::QueuePair::Profile &profile = rdma::QueuePair::Profile::standard());
+
+    /// Open count further queue pairs with the resources of the first one, connecting them is left to the caller
+    void addQueuePairs(size_t count);
+
+    /// The index-th queue pair of the connection, 0 is queuePair
+    rdma::QueuePair &getQueuePair(size_t index) { return index == 0 ? queuePair : *stripes[index - 1]; }
+
+    size_t getQueuePairCount() const { return 1 + stripes.size(); }
+
+    /// Poll the next send completion of this connection, numeric_limits<uint64_t>::max() if there is none
+    uint64_t pollSendCompletionQueue();
+
+    /// Poll the next receive completion of this connection, numeric_limits<uint64_t>::max() if there is none
+    uint64_t pollRecvCompletionQueue();
+
+    /// With RDMA_SHARED_CQ=<n>, connections share n completion queues instead of creating their own. All connections set
+    /// up by a thread use the same one of them, so one polling thread per queue does not contend with the others.
+    /// nullptr without RDMA_SHARED_CQ
+    static rdma::SharedCompletionQueue *sharedCompletionQueueForThread();
+
+    /// The network shared by all connections of this process, so they can share registered memory. The first of
+    /// rails()
+    static rdma::Network &sharedNetwork();
+
+    /// The networks of the rails connections may use: RDMA_RAILS=<device>[:<port>],... or "all" active ports, the
+    /// one Network::selectRail() picks without it. Rails of separate fabrics have to be listed in the same order on
+    /// both sides
+    static const std::vector<rdma::Network *> &rails();
+
+    /// The rail for a new ring buffer connection by RDMA_RAIL_POLICY: "first" (default), "roundrobin" or "numa", the
+    /// rail attached to the NUMA node of the calling thread
+    static rdma::Network &networkForConnection();
+
+    /// Whether sharedNetwork() has been created already
+    static bool hasSharedNetwork();
+
+    /// The queue pairs ring buffer connections ask for, RDMA_QPS_PER_CONNECTION (default 1). One queue pair may be
+    /// processed by a single engine of the NIC, which doesn't reach the line rate on its own
+    static size_t queuePairsPerConnection();
 };
 
-class RDMAMessageBuffer {
+/// Writes messages into a ring buffer of the remote site with one-sided RDMA writes. Each frame in the ring is the
+/// length, the payload and a footer tagged with the frame's position in the stream, so the receiver only accepts the
+/// frame it expects next. The frames may take turns on several queue pairs (RDMANetworking::queuePairsPerConnection())
+/// and still are consumed in order
+class RDMAMessageBuffer : public MessageTransport {
 public:
 
     /// Send data to the remote site
-    void send(const uint8_t *data, size_t length);
+    void send(const uint8_t *data, size_t length) override;
 
     void send(const uint8_t *data, size_t length, bool inln);
 
+    /// Send data only if the remote ring has space for it right now. Never waits for the remote side, but starts
+    /// fetching its read position when the known space is too small, so a later call may succeed
+    bool trySend(const uint8_t *data, size_t length);
+
+    /// Wait until every frame sent so far is in the remote ring, e.g. before the queue pairs are destroyed. Not for
+    /// setMultiProducer()
+    void flush();
+
     /// Receive data to a freshly allocated data vector
-    std::vector<uint8_t> receive();
+    std::vector<uint8_t> receive() override;
 
     /// Receive to a specific memory region with at last maxSize
-    size_t receive(void *whereTo, size_t maxSize);
+    size_t receive(void *whereTo, size_t maxSize) override;
 
     /// Construct a message buffer of the given size, exchanging RDMA networking information over the given socket
     /// size _must_ be a power of 2.
     RDMAMessageBuffer(size_t size, int sock);
 
+    /// Construct a message buffer on the given rail's network, with the given resources of its queue pair
+    RDMAMessageBuffer(size_t size, int sock, rdma::Network &network,
+                      const rdma::QueuePair::Profile &profile = rdma::QueuePair::Profile::standard());
+
+    /// Construct a message buffer of the given size, connected through the RDMA connection manager, which carries the
+    /// ring's keys in its private data
+    RDMAMessageBuffer(size_t size, rdma::ConnectionManager &manager,
+                      const rdma::ConnectionManager::Rendezvous &rendezvous);
+
+    ~RDMAMessageBuffer() override;
+
     /// whether there is data to be read non-blockingly
-    bool hasData() const;
+    bool hasData() const override;
+
+    int64_t getDoorbell() const override { return doorbell; }
+
+    /// hasData() only reads the receive buffer and the atomic readPos
+    bool supportsConcurrentHasData() const override { return true; }
+
+    /// Send messages of at least threshold bytes directly from the application's memory instead of copying them into
+    /// the send buffer. The memory is registered through the network's RegistrationCache, so whoever unmaps memory
+    /// has to invalidate it there first
+    void setZeroCopyThreshold(size_t threshold) { zeroCopyThreshold = threshold; }
+
+    /// Allow several threads to send() concurrently. Each sender reserves its space in the ring with a fetch-and-add,
+    /// copies its message and commits it in the order of the reservations. Whoever gets hold of the queue pair posts
+    /// all committed messages with a single write. Has to be set before the first send, disables zero-copy sends.
+    /// trySend() only reserves its space if the ring has room for it already
+    void setMultiProducer();
+
+    /// Post writes of up to threshold bytes inline, as far as the queue pair supports it. Defaults to the tuning
+    void setInlineThreshold(size_t threshold);
+
+    /// Signal every interval work requests, at most as rarely as the send queue allows, 0 for exactly that. Defaults
+    /// to the tuning
+    void setSignalInterval(size_t interval);
+
+    /// The connection's share of the process' send scheduler: its rate limit, weight and adaptive window of bytes
+    /// outstanding in the remote ring
+    SendScheduler::Flow &getSendFlow() { return flow; }
 
 private:
+    /// The words shared with the remote side, the line written by the local receiver (and read remotely) is kept apart
+    /// from the line the NIC writes the fetched remote read position into, so neither invalidates the other
+    struct ControlBlock {
+        /// Consumer line: bytes consumed from the receive buffer. Only written by the receiving thread
+        alignas(64) std::atomic<size_t> readPos{0};
+        /// Producer line: last known readPos of the remote side, written by RDMA reads
+        alignas(64) std::atomic<size_t> currentRemoteReceive{0};
+    };
+    static_assert(sizeof(ControlBlock) == 128, "one cache line per owner");
+
     const size_t size;
+    // The slab allocations are declared before the networking, so the queue pair is gone before they are reused
+    rdma::MemorySlab::Allocation localSend;
+    rdma::MemorySlab::Allocation localReceive;
+    rdma::MemorySlab::Allocation localControl;
     RDMANetworking net;
-    std::unique_ptr<volatile uint8_t[]> receiveBuffer;
-    std::atomic<size_t> readPos{0};
-    std::unique_ptr<uint8_t[]> sendBuffer;
+    volatile uint8_t *receiveBuffer;
+    uint8_t *sendBuffer;
+    ControlBlock &control;
     size_t sendPos = 0;
-    volatile size_t currentRemoteReceive = 0;
-    rdma::MemoryRegion localSend;
-    rdma::MemoryRegion localReceive;
-    rdma::MemoryRegion localReadPos;
-    rdma::MemoryRegion localCurrentRemoteReceive;
+    size_t zeroCopyThreshold = std::numeric_limits<size_t>::max();
+    /// Largest write posted inline
+    size_t inlineThreshold;
+    /// Whether a read of the remote readPos is in flight, and since when
+    bool readPosPending = false;
+    SendScheduler::Clock::time_point readPosPosted;
+    /// The read of the remote readPos queues behind our writes, so its latency tells the flow how congested we are
+    SendScheduler::Flow flow;
+    /// Writes are unsignaled, their entries of the send queue are only freed by a later signaled request. Every
+    /// signalInterval requests of a queue pair, one is signaled, so the send queue of the profile never overflows
+    size_t signalInterval;
+    struct SendQueue {
+        size_t postedSinceSignal = 0;
+        /// Whether a signaled write is in flight
+        bool signalPending = false;
+    };
+    /// By queue pair of the connection, the frames take turns on them
+    std::vector<SendQueue> sendQueues{1};
+    size_t nextQueuePair = 0;
+    /// With several queue pairs, larger messages are cut into frames of this size, which are transferred in parallel
+    size_t segmentSize = std::numeric_limits<size_t>::max();
+
+    /// Send positions of setMultiProducer(), each on its own line
+    struct SharedSendState {
+        /// End of the space reserved by senders
+        alignas(64) std::atomic<size_t> reserved;
+        /// End of the messages completely copied into the send buffer
+        alignas(64) std::atomic<size_t> committed;
+        /// End of the messages posted to the queue pair, only written while holding poster
+        alignas(64) std::atomic<size_t> posted;
+        /// Held while posting and polling the queue pair
+        std::mutex poster;
+
+        explicit SharedSendState(size_t sendPos) : reserved(sendPos), committed(sendPos), posted(sendPos) {}
+    };
+    std::unique_ptr<SharedSendState> sharedSend;
     rdma::RemoteMemoryRegion remoteReceive;
     rdma::RemoteMemoryRegion remoteReadPos;
+    /// Our slot in this process' DoorbellMap, and the remote side's slot in its map
+    uint32_t doorbell;
+    rdma::RemoteMemoryRegion remoteDoorbell;
+    /// Set when connected through the connection manager, disconnects before the queue pair is destroyed
+    std::unique_ptr<rdma::ConnectionManager::Connection> managedConnection;
+
+    /// Set up everything but the connection
+    RDMAMessageBuffer(size_t size, rdma::Network &network, const rdma::QueuePair::Profile &profile,
+                      RDMANetworking::Unconnected);
+
+    /// Open and connect the queue pairs both sides ask for
+    void connectQueuePairs(int sock);
+
+    /// Copy a frame to the send buffer and post it, flags are or-ed into its header. The first frame of a message cut
+    /// into several starts with the message's length
+    void sendFrame(const uint8_t *data, size_t length, uint64_t flags, bool inln,
+                   const size_t *messageLength = nullptr);
+
+    /// Post the writes of a frame, followed by the write ringing the remote doorbell, with a single call on the next
+    /// queue pair
+    void postWithDoorbell(std::vector<rdma::WriteWorkRequest> &writes);
+
+    /// Whether a signaled request is in flight
+    bool completionPending() const;
+
+    /// Whether the frame at readPos arrived completely, fills in its header
+    bool frameArrived(size_t readPos, uint64_t &header) const;
+
+    /// Hand the space of the frame at readPos back to the sender
+    void consumeFrame(size_t readPos, size_t length);
+
+    /// Poll a send completion and note which of our requests completed, numeric_limits<uint64_t>::max() if none did
+    uint64_t pollSendCompletion();
+
+    /// Space in the remote ring as far as we know
+    size_t knownSendSpace() const;
+
+    /// Post a read of the remote readPos into currentRemoteReceive
+    void fetchRemoteReadPos();
+
+    /// Fetch the remote readPos and wait until it arrived
+    void awaitRemoteReadPos();
+
+    void waitForSendSpace(size_t sizeToWrite);
+
+    /// Whether the flow's window allows sizeToWrite more bytes outstanding. A frame larger than the window goes once
+    /// nothing else is outstanding
+    bool windowAllows(size_t sizeToWrite) const;
+
+    /// Wait until the flow's window and rate allow sizeToWrite more bytes
+    void admitToFlow(size_t sizeToWrite);
 
     void writeToSendBuffer(const uint8_t *data, size_t sizeToWrite);
 
+    void sendZeroCopy(const uint8_t *data, size_t length);
+
+    void sendShared(const uint8_t *data, size_t length);
+
+    bool trySendShared(const uint8_t *data, size_t length);
+
+    /// Whether the reserved part of the ring may be written, as far as we know the remote readPos
+    bool sharedSpaceAllows(size_t startOfWrite, size_t endOfWrite) const;
+
+    /// Copy the message to its reserved part of the send buffer and commit it
+    void commitShared(const uint8_t *data, size_t length, size_t startOfWrite);
+
+    /// Post the committed messages, and fetch the remote readPos if needed, unless another sender is doing so already
+    void progressSharedSend(bool needSpace);
+
     void readFromReceiveBuffer(size_t readPos, uint8_t *whereTo, size_t sizeToRead) const;
 
     void zeroReceiveBuffer(size_t beginReceiveCount, size_t sizeToZero);
@@ -0,0 +1,161 @@
+#include "RDMASendReceiveTransport.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include "rdma/WorkRequest.hpp"
+
+using namespace std;
+using namespace rdma;
+
+const size_t RDMASendReceiveTransport::FRAGMENT_SIZE;
+const uint64_t RDMASendReceiveTransport::COPIED_OUT;
+
+static const uint64_t sendCompletionId = 44;
+
+/// Number of fragments a message of the given length is sent in
+static size_t fragmentsFor(size_t length) {
+    const size_t fragmentSize = RDMASendReceiveTransport::FRAGMENT_SIZE;
+    return (sizeof(length) + length + fragmentSize - 1) / fragmentSize;
+}
+
+RDMASendReceiveTransport::RDMASendReceiveTransport(int sock) :
+        pool(receivePool()),
+        sendSlots(RDMANetworking::sharedNetwork().getMemorySlab(),
+                  RDMANetworking::sharedNetwork().getMemorySlab().allocate(SEND_SLOTS * FRAGMENT_SIZE,
+                                                                           MemoryRegion::Permission::None, 4096)),
+        // Retry RNR NAKs indefinitely (7), they only tell us the remote pool is exhausted right now. A dedicated
+        // completion queue has to hold the completions of all receive buffers we might consume
+        net(sock, 7, static_cast<int>(pool.getBufferCount())) {
+}
+
+void RDMASendReceiveTransport::send(const uint8_t *data, size_t length) {
+    size_t sent = min(length, FRAGMENT_SIZE - sizeof(length));
+    sendFragment(&length, data, sent);
+    while (sent < length) {
+        const size_t fragmentSize = min(FRAGMENT_SIZE, length - sent);
+        sendFragment(nullptr, data + sent, fragmentSize);
+        sent += fragmentSize;
+    }
+}
+
+void RDMASendReceiveTransport::sendFragment(const size_t *header, const uint8_t *data, size_t size) {
+    // Completions are in order, so a signaled one frees all slots up to it
+    while (sendSlot - completedSlots >= SEND_SLOTS) {
+        if (net.pollSendCompletionQueue() == sendCompletionId) {
+            completedSlots += SEND_SLOTS / 2;
+        }
+    }
+
+    uint8_t *slot = sendSlots.as<uint8_t>() + (sendSlot % SEND_SLOTS) * FRAGMENT_SIZE;
+    size_t fragmentSize = 0;
+    if (header) {
+        memcpy(slot, header, sizeof(*header));
+        fragmentSize += sizeof(*header);
+    }
+    copy(data, data + size, slot + fragmentSize);
+    fragmentSize += size;
+
+    SendWorkRequest request;
+    request.setLocalAddress(MemoryRegion::Slice(slot, fragmentSize, sendSlots.slice.lkey));
+    request.setSendInline(fragmentSize <= net.queuePair.getMaxInlineSize());
+    request.setCompletion(sendSlot % (SEND_SLOTS / 2) == SEND_SLOTS / 2 - 1);
+    request.setId(sendCompletionId);
+    net.queuePair.postWorkRequest(request);
+    ++sendSlot;
+}
+
+void RDMASendReceiveTransport::pollArrivals() const {
+    for (auto id = net.pollRecvCompletionQueue(); id != numeric_limits<uint64_t>::max();
+         id = net.pollRecvCompletionQueue()) {
+        const uint8_t *buffer = pool.getBuffer(id);
+        if (missing == 0) {
+            size_t length;
+            memcpy(&length, buffer, sizeof(length));
+            if (fragmentsFor(length) == 1) {
+                arrived.push_back(Arrival{id, {}});
+                continue;
+            }
+            // Holding on to the buffers until the last fragment arrived could exhaust the shared pool
+            partial.reserve(length);
+            partial.assign(buffer + sizeof(length), buffer + FRAGMENT_SIZE);
+            missing = length - partial.size();
+        } else {
+            const size_t fragmentSize = min(FRAGMENT_SIZE, missing);
+            partial.insert(partial.end(), buffer, buffer + fragmentSize);
+            missing -= fragmentSize;
+            if (missing == 0) {
+                arrived.push_back(Arrival{COPIED_OUT, move(partial)});
+                partial = vector<uint8_t>();
+            }
+        }
+        pool.release(id);
+    }
+}
+
+size_t RDMASendReceiveTransport::messageLength() const {
+    const auto &message = arrived.front();
+    if (message.buffer == COPIED_OUT) {
+        return message.data.size();
+    }
+    size_t length;
+    memcpy(&length, pool.getBuffer(message.buffer), sizeof(length));
+    return length;
+}
+
+bool RDMASendReceiveTransport::hasData() const {
+    pollArrivals();
+    return not arrived.empty();
+}
+
+size_t RDMASendReceiveTransport::waitForMessage() const {
+    while (not hasData());
+    return messageLength();
+}
+
+void RDMASendReceiveTransport::consumeMessage(uint8_t *whereTo, size_t length) {
+    auto &message = arrived.front();
+    if (message.buffer == COPIED_OUT) {
+        copy(message.data.begin(), message.data.end(), whereTo);
+    } else {
+        const uint8_t *buffer = pool.getBuffer(message.buffer);
+        copy(buffer + sizeof(length), buffer + sizeof(length) + length, whereTo);
+        pool.release(message.buffer);
+    }
+    arrived.pop_front();
+}
+
+vector<uint8_t> RDMASendReceiveTransport::receive() {
+    const size_t length = waitForMessage();
+    if (arrived.front().buffer == COPIED_OUT) {
+        auto result = move(arrived.front().data);
+        arrived.pop_front();
+        return result;
+    }
+    auto result = vector<uint8_t>(length);
+    consumeMessage(result.data(), result.size());
+    return result;
+}
+
+size_t RDMASendReceiveTransport::receive(void *whereTo, size_t maxSize) {
+    const size_t length = waitForMessage();
+    if (length > maxSize) {
+        throw runtime_error{"plz only read whole messages for now!"};
+    }
+    consumeMessage(reinterpret_cast<uint8_t *>(whereTo), length);
+    return length;
+}
+
+ReceiveBufferPool &RDMASendReceiveTransport::receivePool() {
+    // Intentionally never destroyed, just like the network
+    static auto pool = [] {
+        const char *count = getenv("RDMA_RECEIVE_BUFFERS");
+        size_t buffers = count ? stoul(string(count)) : DEFAULT_RECEIVE_BUFFERS;
+        // Refills are batched, and on a shared completion queue a connection's completions beyond CAPACITY spill
+        const size_t minimum = 2 * ReceiveBufferPool::REFILL_BATCH;
+        const size_t maximum = CompletionRing::CAPACITY;
+        buffers = min(max(buffers, minimum), maximum);
+        auto &network = RDMANetworking::sharedNetwork();
+        return new ReceiveBufferPool(network, network.getSharedReceiveQueue(), FRAGMENT_SIZE, buffers);
+    }();
+    return *pool;
+}
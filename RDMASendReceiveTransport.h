@@ -0,0 +1,76 @@
+#ifndef RDMA_HASH_MAP_RDMASENDRECEIVETRANSPORT_H
+#define RDMA_HASH_MAP_RDMASENDRECEIVETRANSPORT_H
+
+#include <deque>
+#include <limits>
+#include "MessageTransport.h"
+#include "RDMAMessageBuffer.h"
+#include "rdma/ReceiveBufferPool.hpp"
+
+/// Sends messages with two-sided SENDs into the buffers of a process wide ReceiveBufferPool, which are posted to the
+/// network's shared receive queue. So the receive memory is sized by the aggregated load instead of growing with every
+/// connection. Messages are split into fragments of FRAGMENT_SIZE, the first one starts with the message length.
+/// While the receiving pool is exhausted, the sender's NIC gets RNR NAKs and retries. Fragments of larger messages are
+/// copied out and their buffers released as they arrive, so messages of any size complete, however small the pool.
+class RDMASendReceiveTransport : public MessageTransport {
+public:
+    /// Size of the receive buffers and therefore the maximal size of a single SEND
+    static const size_t FRAGMENT_SIZE = 16 * 1024;
+
+    /// Default number of receive buffers in the pool, can be set with RDMA_RECEIVE_BUFFERS
+    static const size_t DEFAULT_RECEIVE_BUFFERS = 256;
+
+    /// Exchange the RDMA connection info over the given socket
+    RDMASendReceiveTransport(int sock);
+
+    /// Send data to the remote site
+    void send(const uint8_t *data, size_t length) override;
+
+    /// Receive data to a freshly allocated data vector
+    std::vector<uint8_t> receive() override;
+
+    /// Receive to a specific memory region with at last maxSize
+    size_t receive(void *whereTo, size_t maxSize) override;
+
+    /// whether there is data to be read non-blockingly
+    bool hasData() const override;
+
+    /// The receive buffers shared by all connections of this process
+    static rdma::ReceiveBufferPool &receivePool();
+
+private:
+    /// Number of fragments being sent at the same time, every half of them is signaled
+    static const size_t SEND_SLOTS = 8;
+
+    rdma::ReceiveBufferPool &pool;
+    // Declared before the networking, so the queue pair is gone before the slots are reused
+    rdma::MemorySlab::Allocation sendSlots;
+    // Polling for arrived fragments does not change what a receiver observes, so it is allowed in hasData()
+    mutable RDMANetworking net;
+    /// A message received completely. It stays in its receive buffer if it fit into a single fragment, otherwise it
+    /// has been copied out
+    struct Arrival {
+        uint64_t buffer;
+        std::vector<uint8_t> data;
+    };
+    static const uint64_t COPIED_OUT = std::numeric_limits<uint64_t>::max();
+    /// Received messages, not consumed yet
+    mutable std::deque<Arrival> arrived;
+    /// The message whose fragments are arriving, and the number of its bytes still missing
+    mutable std::vector<uint8_t> partial;
+    mutable size_t missing = 0;
+    size_t sendSlot = 0;
+    size_t completedSlots = 0;
+
+    void sendFragment(const size_t *header, const uint8_t *data, size_t size);
+
+    void pollArrivals() const;
+
+    size_t messageLength() const;
+
+    size_t waitForMessage() const;
+
+    void consumeMessage(uint8_t *whereTo, size_t length);
+};
+
+#endif //RDMA_HASH_MAP_RDMASENDRECEIVETRANSPORT_H
@@ -0,0 +1,127 @@
+#include "SendScheduler.h"
+#include <algorithm>
+#include <cstdlib>
+#include <thread>
+
+using namespace std;
+
+const size_t SendScheduler::FLOW_BURST;
+const size_t SendScheduler::PROCESS_BURST;
+const size_t SendScheduler::MIN_WINDOW;
+const size_t SendScheduler::WINDOW_INCREASE;
+
+static double gigabitsFromEnv(const char *name) {
+    const char *gigabits = getenv(name);
+    return gigabits != nullptr ? atof(gigabits) : 0;
+}
+
+void SendScheduler::TokenBucket::setRate(double gigabitsPerSecond, size_t burst) {
+    rate = max(gigabitsPerSecond, 0.0) / 8;
+    this->burst = burst;
+    tokens = burst;
+    refilled = Clock::now();
+}
+
+void SendScheduler::TokenBucket::refill(Clock::time_point now) {
+    const auto elapsed = chrono::duration<double, nano>(now - refilled).count();
+    tokens = min(tokens + elapsed * rate, burst);
+    refilled = now;
+}
+
+bool SendScheduler::TokenBucket::tryTake(size_t length, Clock::time_point now) {
+    if (not isReady(now)) {
+        return false;
+    }
+    tokens -= length;
+    return true;
+}
+
+bool SendScheduler::TokenBucket::isReady(Clock::time_point now) {
+    if (not isLimited()) {
+        return true;
+    }
+    refill(now);
+    return tokens > 0;
+}
+
+SendScheduler::Flow::Flow(SendScheduler &scheduler, size_t maxWindow) :
+        scheduler(scheduler),
+        window(maxWindow),
+        maxWindow(maxWindow),
+        targetLatency(scheduler.defaultTargetLatency) {
+    setRateLimit(scheduler.defaultRateLimit);
+}
+
+void SendScheduler::Flow::admit(size_t length) {
+    while (not bucket.tryTake(length, Clock::now())) {
+        this_thread::yield();
+    }
+    scheduler.schedule(*this, length);
+}
+
+void SendScheduler::Flow::completed(Clock::duration latency) {
+    if (targetLatency == Clock::duration::zero()) {
+        return;
+    }
+    const auto now = Clock::now();
+    const auto current = getWindow();
+    if (latency <= targetLatency) {
+        window.store(min(current + WINDOW_INCREASE, maxWindow), memory_order_relaxed);
+        return;
+    }
+    // Shrink in proportion to how far the latency is above the target, at most once per round trip and by half
+    if (now - lastDecrease < latency) {
+        return;
+    }
+    const auto excess = chrono::duration<double>(latency - targetLatency) / latency;
+    window.store(max(static_cast<size_t>(current * max(1 - 0.8 * excess, 0.5)), min(MIN_WINDOW, maxWindow)),
+                 memory_order_relaxed);
+    lastDecrease = now;
+}
+
+void SendScheduler::Flow::setRateLimit(double gigabitsPerSecond) {
+    bucket.setRate(gigabitsPerSecond, FLOW_BURST);
+}
+
+void SendScheduler::Flow::setWeight(double weight) {
+    this->weight = max(weight, 1e-3);
+}
+
+void SendScheduler::Flow::setTargetLatency(Clock::duration latency) {
+    targetLatency = latency;
+    window.store(maxWindow, memory_order_relaxed);
+}
+
+SendScheduler &SendScheduler::shared() {
+    // Intentionally never destroyed, just like the network
+    static auto scheduler = new SendScheduler();
+    return *scheduler;
+}
+
+SendScheduler::SendScheduler() :
+        defaultRateLimit(gigabitsFromEnv("RDMA_RATE_LIMIT_GBITS")),
+        defaultTargetLatency(chrono::microseconds(getenv("RDMA_TARGET_LATENCY_US") != nullptr
+                                                  ? atol(getenv("RDMA_TARGET_LATENCY_US")) : 0)) {
+    processBucket.setRate(gigabitsFromEnv("RDMA_PROCESS_GBITS"), PROCESS_BURST);
+}
+
+void SendScheduler::schedule(Flow &flow, size_t length) {
+    // Only set up once, so no need for the lock to see there's nothing to share
+    if (not processBucket.isLimited()) {
+        return;
+    }
+
+    // Start-time fair queuing: each request gets a start tag in virtual time, and the waiting request with the
+    // smallest one goes next, so flows share the rate in proportion to their weights
+    unique_lock<mutex> lock(guard);
+    const double start = max(virtualTime, flow.finish);
+    flow.finish = start + length / flow.weight;
+    const auto ticket = waiting.emplace(start, &flow);
+    while (waiting.begin() != ticket || not processBucket.tryTake(length, Clock::now())) {
+        lock.unlock();
+        this_thread::yield();
+        lock.lock();
+    }
+    waiting.erase(ticket);
+    virtualTime = start;
+}
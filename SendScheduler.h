@@ -0,0 +1,113 @@
+#ifndef RDMA_HASH_MAP_SENDSCHEDULER_H
+#define RDMA_HASH_MAP_SENDSCHEDULER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <map>
+#include <mutex>
+
+/// Paces the send path of the ring buffer connections of this process, so a connection streaming large writes can't
+/// fill the port and inflate the latency of everyone else. Each connection is a Flow, which
+/// - is limited by a token bucket (RDMA_RATE_LIMIT_GBITS, default unlimited),
+/// - keeps at most a window of bytes outstanding in the remote ring. The window shrinks while the completion latency
+///   of the connection's requests exceeds a target (RDMA_TARGET_LATENCY_US, default off) and grows below it,
+/// - shares the rate of the process (RDMA_PROCESS_GBITS, default unlimited) with the other flows by weighted fair
+///   queuing, in proportion to its weight.
+class SendScheduler {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    /// Tokens refill at a rate, up to a burst. A request takes its tokens as long as some are left, so requests larger
+    /// than the burst pass as well and are paid back afterwards
+    class TokenBucket {
+        /// In bytes per nanosecond, 0 for unlimited
+        double rate = 0;
+        double burst = 0;
+        double tokens = 0;
+        Clock::time_point refilled;
+
+        void refill(Clock::time_point now);
+
+    public:
+        /// Limit to the rate, 0 for unlimited
+        void setRate(double gigabitsPerSecond, size_t burst);
+
+        bool isLimited() const { return rate > 0; }
+
+        /// Take length tokens, false if there are none left
+        bool tryTake(size_t length, Clock::time_point now);
+
+        /// Whether tryTake() would succeed
+        bool isReady(Clock::time_point now);
+    };
+
+    /// The send path of a connection
+    class Flow {
+        friend class SendScheduler;
+
+        SendScheduler &scheduler;
+        TokenBucket bucket;
+        double weight = 1;
+        /// Finish tag of the flow's last request in the virtual time of the scheduler
+        double finish = 0;
+        /// Read by all senders of a multi-producer connection
+        std::atomic<size_t> window;
+        const size_t maxWindow;
+        Clock::duration targetLatency;
+        Clock::time_point lastDecrease;
+
+    public:
+        /// A flow which never has more than maxWindow bytes (the size of its ring) outstanding
+        Flow(SendScheduler &scheduler, size_t maxWindow);
+
+        /// Wait until length more bytes may be posted
+        void admit(size_t length);
+
+        /// Whether admit() passes the flow's rate limit right away
+        bool isReady() { return bucket.isReady(Clock::now()); }
+
+        /// A request of the flow completed after the given latency, adapts the window
+        void completed(Clock::duration latency);
+
+        /// Bytes the flow may have outstanding
+        size_t getWindow() const { return window.load(std::memory_order_relaxed); }
+
+        /// Limit the flow's rate, 0 for unlimited
+        void setRateLimit(double gigabitsPerSecond);
+
+        /// The flow's share of the process' rate, relative to the other flows (default 1)
+        void setWeight(double weight);
+
+        /// Adapt the window to keep the completion latency below the target, zero for always using the whole ring
+        void setTargetLatency(Clock::duration latency);
+    };
+
+    /// The scheduler of this process
+    static SendScheduler &shared();
+
+private:
+    /// Of requests, bursts of flows and the process
+    static const size_t FLOW_BURST = 64 * 1024;
+    static const size_t PROCESS_BURST = 256 * 1024;
+    /// Bounds of the window, and its growth per completion below the target latency
+    static const size_t MIN_WINDOW = 4 * 1024;
+    static const size_t WINDOW_INCREASE = 4 * 1024;
+
+    const double defaultRateLimit;
+    const Clock::duration defaultTargetLatency;
+
+    std::mutex guard;
+    TokenBucket processBucket;
+    /// Start tag of the request admitted last
+    double virtualTime = 0;
+    /// The requests waiting for the process' rate by start tag
+    std::multimap<double, Flow *> waiting;
+
+    SendScheduler();
+
+    /// Wait until it's the request's turn in the process' rate
+    void schedule(Flow &flow, size_t length);
+};
+
+#endif //RDMA_HASH_MAP_SENDSCHEDULER_H
@@ -0,0 +1,190 @@
+#include "SharedInboundRing.h"
+#include <algorithm>
+#include <infiniband/verbs.h>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include "rdma/WorkRequest.hpp"
+#include "tcpWrapper.h"
+#include "Wraparound.h"
+
+using namespace std;
+using namespace rdma;
+
+static const size_t validity = 0xDEADDEADBEEFBEEF; // arbitrary constant. Just don't use 0
+static const uint64_t reserveId = 45;
+
+/// A frame is the length, the connection key, the payload and the validity footer
+static const size_t headerSize = sizeof(size_t) + sizeof(uint64_t);
+
+struct RingInfo {
+    uint64_t connectionKey;
+    uint64_t size;
+    uint32_t ringKey;
+    uint32_t controlKey;
+    uintptr_t ringAddress;
+    uintptr_t tailAddress;
+    uintptr_t headAddress;
+};
+
+static MemorySlab::Allocation allocateFromSlab(size_t size, MemoryRegion::Permission permissions,
+                                               size_t alignment = 64) {
+    auto &slab = RDMANetworking::sharedNetwork().getMemorySlab();
+    return MemorySlab::Allocation(slab, slab.allocate(size, permissions, alignment));
+}
+
+static size_t checkPowerOfTwo(size_t size) {
+    const bool powerOfTwo = (size != 0) && !(size & (size - 1));
+    if (not powerOfTwo) {
+        throw runtime_error{"size should be a power of 2"};
+    }
+    return size;
+}
+
+SharedInboundRing::SharedInboundRing(size_t size) :
+        size(checkPowerOfTwo(size)),
+        localReceive(allocateFromSlab(size,
+                                      MemoryRegion::Permission::LocalWrite | MemoryRegion::Permission::RemoteWrite,
+                                      4096)),
+        // Clients add to the tail remotely and read the head
+        localControl(allocateFromSlab(sizeof(ControlBlock), MemoryRegion::Permission::LocalWrite |
+                                                            MemoryRegion::Permission::RemoteRead |
+                                                            MemoryRegion::Permission::RemoteAtomic)),
+        receiveBuffer(localReceive.as<volatile uint8_t>()),
+        control(*new(localControl.slice.address) ControlBlock()) {
+}
+
+uint64_t SharedInboundRing::accept(int sock) {
+    connections.push_back(make_unique<RDMANetworking>(sock));
+
+    // The connection id in the lower half, a tag only this client knows in the upper one
+    static thread_local mt19937_64 random(random_device{}());
+    const uint64_t connectionId = connections.size() - 1;
+    keys.push_back(random() << 32 | connectionId);
+
+    RingInfo info{};
+    info.connectionKey = keys.back();
+    info.size = size;
+    info.ringKey = localReceive.slice.rkey;
+    info.controlKey = localControl.slice.rkey;
+    info.ringAddress = reinterpret_cast<uintptr_t>(localReceive.slice.address);
+    info.tailAddress = reinterpret_cast<uintptr_t>(&control.tail);
+    info.headAddress = reinterpret_cast<uintptr_t>(&control.head);
+    tcp_write(sock, &info, sizeof(info));
+    return connectionId;
+}
+
+bool SharedInboundRing::frameAt(size_t head, size_t &length) const {
+    size_t frameValidity = 0;
+    wraparound(receiveBuffer, size, sizeof(length), head, [&](auto prevBytes, auto begin, auto end) {
+        copy(begin, end, reinterpret_cast<uint8_t *>(&length) + prevBytes);
+    });
+    if (length > size - headerSize - sizeof(validity)) {
+        return false; // only partially written
+    }
+    wraparound(receiveBuffer, size, sizeof(validity), head + headerSize + length,
+               [&](auto prevBytes, auto begin, auto end) {
+                   copy(begin, end, reinterpret_cast<uint8_t *>(&frameValidity) + prevBytes);
+               });
+    return frameValidity == validity;
+}
+
+bool SharedInboundRing::hasData() const {
+    size_t length;
+    return frameAt(control.head.load(memory_order_relaxed), length);
+}
+
+SharedInboundRing::Message SharedInboundRing::receive() {
+    const size_t head = control.head.load(memory_order_relaxed); // only ever written by us
+    size_t length = 0;
+    while (not frameAt(head, length));
+
+    uint64_t key = 0;
+    Message message{0, vector<uint8_t>(length)};
+    wraparound(receiveBuffer, size, sizeof(key), head + sizeof(length), [&](auto prevBytes, auto begin, auto end) {
+        copy(begin, end, reinterpret_cast<uint8_t *>(&key) + prevBytes);
+    });
+    message.connection = key & 0xFFFFFFFF;
+    wraparound(receiveBuffer, size, length, head + headerSize, [&](auto prevBytes, auto begin, auto end) {
+        copy(begin, end, message.data.data() + prevBytes);
+    });
+    const size_t frameSize = headerSize + length + sizeof(validity);
+    wraparound(receiveBuffer, size, frameSize, head, [](auto, auto begin, auto end) {
+        fill(begin, end, 0);
+    });
+
+    // Release: the zeroed memory has to be in place before the clients may overwrite it
+    control.head.store(head + frameSize, memory_order_release);
+
+    if (message.connection >= keys.size() || keys[message.connection] != key) {
+        string reason = "dropped a frame with the unknown connection key " + to_string(key);
+        cerr << reason << endl;
+        throw runtime_error(reason);
+    }
+    return message;
+}
+
+SharedInboundRingSender::SharedInboundRingSender(int sock) : net(sock) {
+    RingInfo info{};
+    tcp_read(sock, &info, sizeof(info));
+    connectionKey = info.connectionKey;
+    ringSize = info.size;
+    remoteRing = RemoteMemoryRegion(info.ringAddress, info.ringKey);
+    remoteTail = RemoteMemoryRegion(info.tailAddress, info.controlKey);
+    remoteHead = RemoteMemoryRegion(info.headAddress, info.controlKey);
+
+    localSend = make_unique<MemorySlab::Allocation>(allocateFromSlab(ringSize, MemoryRegion::Permission::None, 4096));
+    localControl = make_unique<MemorySlab::Allocation>(allocateFromSlab(sizeof(ControlBlock),
+                                                                        MemoryRegion::Permission::LocalWrite));
+    control = new(localControl->slice.address) ControlBlock();
+}
+
+size_t SharedInboundRingSender::reserve(size_t frameSize) {
+    // Reserve our part of the ring. Its completion also means all our earlier writes completed, as the send queue
+    // completes in order, so the send buffer is free again afterwards
+    const auto reservedSlice = MemoryRegion::Slice(&control->reserved, sizeof(control->reserved),
+                                                   localControl->slice.lkey);
+    auto reservation = AtomicFetchAndAddWorkRequestBuilder(reservedSlice, remoteTail, frameSize, true).build();
+    reservation.setId(reserveId);
+    net.queuePair.postWorkRequest(reservation);
+    while (net.pollSendCompletionQueue() != reserveId);
+    const size_t begin = control->reserved;
+
+    // Wait until the server consumed everything up to the end of our part
+    while (begin + frameSize - control->remoteHead.load(memory_order_relaxed) > ringSize) {
+        const auto target = MemoryRegion::Slice(&control->remoteHead, sizeof(control->remoteHead),
+                                                localControl->slice.lkey);
+        ReadWorkRequestBuilder(target, remoteHead, true)
+                .send(net.queuePair);
+        while (net.pollSendCompletionQueue() != ReadWorkRequest::getId()); // Poll until read has finished
+    }
+    return begin;
+}
+
+void SharedInboundRingSender::send(const uint8_t *data, size_t length) {
+    const size_t frameSize = headerSize + length + sizeof(validity);
+    if (frameSize > ringSize) throw runtime_error{"data > buffersize!"};
+
+    const size_t begin = reserve(frameSize);
+
+    // Build the frame in the send buffer, at the offset it will have in the remote ring
+    uint8_t *sendBuffer = localSend->as<uint8_t>();
+    auto writeFrame = [&](size_t offset, const void *source, size_t sourceSize) {
+        auto bytes = reinterpret_cast<const uint8_t *>(source);
+        wraparound(sendBuffer, ringSize, sourceSize, begin + offset, [&](auto prevBytes, auto first, auto last) {
+            copy(bytes + prevBytes, bytes + prevBytes + distance(first, last), first);
+        });
+    };
+    writeFrame(0, &length, sizeof(length));
+    writeFrame(sizeof(length), &connectionKey, sizeof(connectionKey));
+    writeFrame(headerSize, data, length);
+    writeFrame(headerSize + length, &validity, sizeof(validity));
+
+    wraparound(ringSize, frameSize, begin, [&](auto, auto beginPos, auto endPos) {
+        const auto sendSlice = MemoryRegion::Slice(sendBuffer + beginPos, endPos - beginPos, localSend->slice.lkey);
+        WriteWorkRequestBuilder(sendSlice, remoteRing.slice(beginPos), false)
+                .setInline(sendSlice.size <= net.queuePair.getMaxInlineSize())
+                .send(net.queuePair);
+    });
+}
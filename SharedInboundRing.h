@@ -0,0 +1,92 @@
+#ifndef RDMA_HASH_MAP_SHAREDINBOUNDRING_H
+#define RDMA_HASH_MAP_SHAREDINBOUNDRING_H
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include "RDMAMessageBuffer.h"
+
+/// A single receive ring shared by all clients of a server. Clients reserve space for a message with a remote
+/// fetch-and-add on the ring's tail, then write the message, tagged with their connection id, into the reserved space.
+/// The server only polls this one ring, and its memory scales with throughput instead of with the number of clients.
+/// Frames are consumed in ring order: a client that reserved space but didn't write yet holds back later messages.
+/// The connection id in each frame comes with a random tag handed out by accept(), so a client can't
+/// pass its messages off as another client's.
+class SharedInboundRing {
+public:
+    struct Message {
+        uint64_t connection;
+        std::vector<uint8_t> data;
+    };
+
+    /// Construct a ring of the given size, size _must_ be a power of 2
+    SharedInboundRing(size_t size);
+
+    /// Connect a SharedInboundRingSender over the given socket, returns the id its messages are tagged with
+    uint64_t accept(int sock);
+
+    /// Receive the next message (blocking), throws if the frame's key doesn't belong to an accepted client
+    Message receive();
+
+    /// whether there is a message to be read non-blockingly
+    bool hasData() const;
+
+private:
+    /// The tail is only ever modified by remote atomics, the head only by the server, each has a line of its own
+    struct ControlBlock {
+        /// Bytes reserved by the clients
+        alignas(64) std::atomic<uint64_t> tail{0};
+        /// Bytes consumed by the server
+        alignas(64) std::atomic<size_t> head{0};
+    };
+    static_assert(sizeof(ControlBlock) == 128, "one cache line per owner");
+
+    const size_t size;
+    rdma::MemorySlab::Allocation localReceive;
+    rdma::MemorySlab::Allocation localControl;
+    volatile uint8_t *receiveBuffer;
+    ControlBlock &control;
+    /// One queue pair per client, RC can't do without
+    std::vector<std::unique_ptr<RDMANetworking>> connections;
+    /// The keys of the clients by connection id
+    std::vector<uint64_t> keys;
+
+    bool frameAt(size_t head, size_t &length) const;
+};
+
+/// The client side of a SharedInboundRing
+class SharedInboundRingSender {
+public:
+    /// Connect to a SharedInboundRing::accept() over the given socket
+    SharedInboundRingSender(int sock);
+
+    /// Send data to the server's ring
+    void send(const uint8_t *data, size_t length);
+
+    /// The id the server sees our messages with
+    uint64_t getConnectionId() const { return connectionKey & 0xFFFFFFFF; }
+
+private:
+    /// Landing zones of the fetch-and-add and of the reads of the remote head
+    struct ControlBlock {
+        alignas(64) uint64_t reserved = 0;
+        alignas(64) std::atomic<size_t> remoteHead{0};
+    };
+
+    size_t ringSize = 0;
+    /// Written into each frame, the connection id in the lower half
+    uint64_t connectionKey = 0;
+    rdma::RemoteMemoryRegion remoteRing;
+    rdma::RemoteMemoryRegion remoteTail;
+    rdma::RemoteMemoryRegion remoteHead;
+    // Sized by the server's ring, so allocated once connected. Still declared before the networking, so the queue
+    // pair is gone before they are reused
+    std::unique_ptr<rdma::MemorySlab::Allocation> localSend;
+    std::unique_ptr<rdma::MemorySlab::Allocation> localControl;
+    RDMANetworking net;
+    ControlBlock *control = nullptr;
+
+    size_t reserve(size_t frameSize);
+};
+
+#endif //RDMA_HASH_MAP_SHAREDINBOUNDRING_H
@@ -0,0 +1,205 @@
+#include "SharedMemoryTransport.h"
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "tcpWrapper.h"
+#include "Wraparound.h"
+
+using namespace std;
+
+static const size_t validity = 0xDEADDEADBEEFBEEF; // same constant as RDMAMessageBuffer
+
+const size_t SharedMemoryTransport::CONTROL_SIZE;
+
+namespace {
+    /// What the remote side needs to open our ring
+    struct RingInfo {
+        pid_t pid;
+        int fd;
+        size_t size;
+        /// Identifies the memfd, the pid may name another process in our PID namespace
+        ino_t inode;
+    };
+
+    ino_t inodeOf(int fd) {
+        struct stat status{};
+        return fstat(fd, &status) == 0 ? status.st_ino : 0;
+    }
+
+    size_t checkPowerOfTwo(size_t size) {
+        const bool powerOfTwo = (size != 0) && !(size & (size - 1));
+        if (not powerOfTwo) {
+            throw runtime_error{"size should be a power of 2"};
+        }
+        return size;
+    }
+
+    int createRing(size_t length) {
+        const int fd = memfd_create("rdma_tests ring", MFD_CLOEXEC);
+        if (fd < 0 || ftruncate(fd, static_cast<off_t>(length)) != 0) {
+            string reason = "creating a shared memory ring failed with error " + to_string(errno) + ": " +
+                            strerror(errno);
+            cerr << reason << endl;
+            throw runtime_error{reason};
+        }
+        return fd;
+    }
+
+    uint8_t *mapRing(int fd, size_t length) {
+        void *mapping = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+        if (mapping == MAP_FAILED) {
+            string reason = "mapping a shared memory ring failed with error " + to_string(errno) + ": " +
+                            strerror(errno);
+            cerr << reason << endl;
+            throw runtime_error{reason};
+        }
+        return reinterpret_cast<uint8_t *>(mapping);
+    }
+
+    /// Exchange the rings' info and map the remote side's ring. If either side can't, both release their own ring and
+    /// throw SharedMemoryTransport::Unavailable
+    uint8_t *openRemoteRing(int sock, int memfd, uint8_t *localMapping, size_t length) {
+        tcp_setBlocking(sock); // just set the socket to block for our setup.
+        RingInfo info{getpid(), memfd, length, inodeOf(memfd)};
+        tcp_write(sock, &info, sizeof(info));
+        tcp_read(sock, &info, sizeof(info));
+        if (info.size != length) {
+            throw runtime_error{"shared memory rings of both sides have to be the same size"};
+        }
+
+        // The pid is only valid in the remote side's PID namespace, which needn't be ours
+        const string path = "/proc/" + to_string(info.pid) + "/fd/" + to_string(info.fd);
+        const int fd = open(path.c_str(), O_RDWR | O_CLOEXEC);
+        string reason;
+        uint8_t *mapping = nullptr;
+        if (fd < 0) {
+            reason = "opening the remote ring " + path + " failed with error " + to_string(errno) + ": " +
+                     strerror(errno);
+        } else if (inodeOf(fd) != info.inode) {
+            reason = path + " is not the remote ring";
+            ::close(fd);
+        } else {
+            mapping = mapRing(fd, length);
+            ::close(fd);
+        }
+
+        // Once both sides mapped the other's ring, the memfds are not needed anymore
+        bool mapped = mapping != nullptr;
+        bool remoteMapped = false;
+        tcp_write(sock, &mapped, sizeof(mapped));
+        tcp_read(sock, &remoteMapped, sizeof(remoteMapped));
+        if (mapped && remoteMapped) {
+            return mapping;
+        }
+        if (mapped) {
+            munmap(mapping, length);
+            reason = "the remote side couldn't open our shared memory ring";
+        }
+        munmap(localMapping, length);
+        ::close(memfd);
+        cerr << reason << endl;
+        throw SharedMemoryTransport::Unavailable{reason};
+    }
+}
+
+SharedMemoryTransport::SharedMemoryTransport(size_t size, int sock) :
+        size(checkPowerOfTwo(size)),
+        memfd(createRing(CONTROL_SIZE + size)),
+        localMapping(mapRing(memfd, CONTROL_SIZE + size)),
+        localControl(*new(localMapping) ControlBlock()),
+        remoteMapping(openRemoteRing(sock, memfd, localMapping, CONTROL_SIZE + size)),
+        remoteControl(*reinterpret_cast<ControlBlock *>(remoteMapping)),
+        receiveBuffer(localMapping + CONTROL_SIZE),
+        remoteReceiveBuffer(remoteMapping + CONTROL_SIZE) {
+    ::close(memfd);
+}
+
+SharedMemoryTransport::~SharedMemoryTransport() {
+    munmap(localMapping, CONTROL_SIZE + size);
+    munmap(remoteMapping, CONTROL_SIZE + size);
+}
+
+void SharedMemoryTransport::send(const uint8_t *data, size_t length) {
+    const size_t sizeToWrite = sizeof(length) + length + sizeof(validity);
+    if (sizeToWrite > size) throw runtime_error{"data > buffersize!"};
+
+    // Acquire: the receiver zeroed the memory before releasing it
+    while (size - (sendPos - remoteControl.readPos.load(memory_order_acquire)) < sizeToWrite);
+
+    writeToRemote(reinterpret_cast<const uint8_t *>(&length), sizeof(length));
+    writeToRemote(data, length);
+    // The footer marks the message as complete, so it has to become visible last
+    atomic_thread_fence(memory_order_release);
+    writeToRemote(reinterpret_cast<const uint8_t *>(&validity), sizeof(validity));
+}
+
+void SharedMemoryTransport::writeToRemote(const uint8_t *data, size_t sizeToWrite) {
+    wraparound(remoteReceiveBuffer, size, sizeToWrite, sendPos, [&](auto prevBytes, auto begin, auto end) {
+        copy(data + prevBytes, data + prevBytes + distance(begin, end), begin);
+    });
+    sendPos += sizeToWrite;
+}
+
+void SharedMemoryTransport::readFromReceiveBuffer(size_t readPos, uint8_t *whereTo, size_t sizeToRead) const {
+    wraparound(receiveBuffer, size, sizeToRead, readPos, [whereTo](auto prevBytes, auto begin, auto end) {
+        copy(begin, end, whereTo + prevBytes);
+    });
+}
+
+size_t SharedMemoryTransport::waitForMessage() const {
+    const size_t readPos = localControl.readPos.load(memory_order_relaxed); // only ever written by us
+    size_t receiveSize = 0;
+    size_t receiveValidity = 0;
+    do {
+        readFromReceiveBuffer(readPos, reinterpret_cast<uint8_t *>(&receiveSize), sizeof(receiveSize));
+        readFromReceiveBuffer(readPos + sizeof(receiveSize) + receiveSize,
+                              reinterpret_cast<uint8_t *>(&receiveValidity), sizeof(receiveValidity));
+    } while (receiveValidity != validity);
+    // Pairs with the sender's fence before the footer
+    atomic_thread_fence(memory_order_acquire);
+    return receiveSize;
+}
+
+void SharedMemoryTransport::consumeMessage(uint8_t *whereTo, size_t length) {
+    const size_t readPos = localControl.readPos.load(memory_order_relaxed);
+    readFromReceiveBuffer(readPos + sizeof(length), whereTo, length);
+    const size_t messageSize = sizeof(length) + length + sizeof(validity);
+    wraparound(receiveBuffer, size, messageSize, readPos, [](auto, auto begin, auto end) {
+        fill(begin, end, 0);
+    });
+
+    // Release: the zeroed memory has to be in place before the sender may overwrite it
+    localControl.readPos.store(readPos + messageSize, memory_order_release);
+}
+
+vector<uint8_t> SharedMemoryTransport::receive() {
+    const auto receiveSize = waitForMessage();
+    auto result = vector<uint8_t>(receiveSize);
+    consumeMessage(result.data(), receiveSize);
+    return result;
+}
+
+size_t SharedMemoryTransport::receive(void *whereTo, size_t maxSize) {
+    const auto receiveSize = waitForMessage();
+    if (receiveSize > maxSize) {
+        throw runtime_error{"plz only read whole messages for now!"}; // probably buffer partially read msgs
+    }
+    consumeMessage(reinterpret_cast<uint8_t *>(whereTo), receiveSize);
+    return receiveSize;
+}
+
+bool SharedMemoryTransport::hasData() const {
+    const size_t readPos = localControl.readPos.load(memory_order_relaxed);
+    size_t receiveSize;
+    size_t receiveValidity = 0;
+    readFromReceiveBuffer(readPos, reinterpret_cast<uint8_t *>(&receiveSize), sizeof(receiveSize));
+    readFromReceiveBuffer(readPos + sizeof(receiveSize) + receiveSize, reinterpret_cast<uint8_t *>(&receiveValidity),
+                          sizeof(receiveValidity));
+    return (receiveValidity == validity);
+}
@@ -0,0 +1,71 @@
+#ifndef RDMA_HASH_MAP_SHAREDMEMORYTRANSPORT_H
+#define RDMA_HASH_MAP_SHAREDMEMORYTRANSPORT_H
+
+#include <atomic>
+#include <stdexcept>
+#include "MessageTransport.h"
+
+/// Ring buffer connection between two processes on the same host, without involving the NIC. Every side puts its
+/// receive ring into a memfd, the other side opens it through /proc/<pid>/fd and maps it. Messages are framed like the
+/// ones of RDMAMessageBuffer: length, payload and validity footer, written by the sender right into the remote ring.
+/// Opening the remote memfd needs the same permissions as ptrace (e.g. the same user).
+class SharedMemoryTransport : public MessageTransport {
+public:
+    /// Thrown on both sides, when either of them couldn't open the other's ring (e.g. different PID namespaces or
+    /// users). The socket can be used to set up another transport afterwards
+    struct Unavailable : std::runtime_error {
+        using std::runtime_error::runtime_error;
+    };
+
+    /// Set up the rings over the given socket, size _must_ be a power of 2
+    SharedMemoryTransport(size_t size, int sock);
+
+    ~SharedMemoryTransport() override;
+
+    /// Send data to the remote site
+    void send(const uint8_t *data, size_t length) override;
+
+    /// Receive data to a freshly allocated data vector
+    std::vector<uint8_t> receive() override;
+
+    /// Receive to a specific memory region with at last maxSize
+    size_t receive(void *whereTo, size_t maxSize) override;
+
+    /// whether there is data to be read non-blockingly
+    bool hasData() const override;
+
+    /// hasData() only reads the ring and the atomic readPos
+    bool supportsConcurrentHasData() const override { return true; }
+
+private:
+    /// Placed in front of the ring, on a page of its own
+    struct ControlBlock {
+        /// Bytes consumed from the ring, only written by its receiver
+        alignas(64) std::atomic<size_t> readPos{0};
+    };
+
+    static const size_t CONTROL_SIZE = 4096;
+    static_assert(sizeof(ControlBlock) <= CONTROL_SIZE, "control block has to fit in front of the ring");
+
+    const size_t size;
+    /// Our ring, only open until the remote side mapped it
+    const int memfd;
+    uint8_t *localMapping;
+    ControlBlock &localControl;
+    uint8_t *remoteMapping;
+    ControlBlock &remoteControl;
+    volatile uint8_t *receiveBuffer;
+    uint8_t *remoteReceiveBuffer;
+    size_t sendPos = 0;
+
+    void writeToRemote(const uint8_t *data, size_t sizeToWrite);
+
+    void readFromReceiveBuffer(size_t readPos, uint8_t *whereTo, size_t sizeToRead) const;
+
+    /// Spin until the next message arrived, returns its length
+    size_t waitForMessage() const;
+
+    void consumeMessage(uint8_t *whereTo, size_t length);
+};
+
+#endif //RDMA_HASH_MAP_SHAREDMEMORYTRANSPORT_H
@@ -0,0 +1,284 @@
+#include "StreamMultiplexer.h"
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <random>
+#include <stdexcept>
+#include <thread>
+#include "tcpWrapper.h"
+#include "Tuning.h"
+
+using namespace std;
+
+namespace {
+    /// Identifies this process to its peers
+    uint64_t processToken() {
+        static const uint64_t token = [] {
+            random_device device;
+            return (uint64_t(device()) << 32) | device();
+        }();
+        return token;
+    }
+
+    /// The multiplexers of this process, by the remote process' token and the multiplexer's id
+    mutex registryGuard;
+    map<pair<uint64_t, uint64_t>, shared_ptr<StreamMultiplexer>> registry;
+    uint64_t nextMultiplexer = 1;
+
+    shared_ptr<StreamMultiplexer> lookup(uint64_t remoteToken, uint64_t id) {
+        lock_guard<mutex> lock(registryGuard);
+        auto multiplexer = registry.find(make_pair(remoteToken, id));
+        return multiplexer != registry.end() ? multiplexer->second : nullptr;
+    }
+
+    /// The id of the most recent multiplexer to the remote process (0 if there is none)
+    uint64_t latest(uint64_t remoteToken) {
+        lock_guard<mutex> lock(registryGuard);
+        auto multiplexer = registry.lower_bound(make_pair(remoteToken + 1, uint64_t(0)));
+        if (multiplexer == registry.begin() || (--multiplexer)->first.first != remoteToken) {
+            return 0;
+        }
+        return multiplexer->first.second;
+    }
+
+    void publish(uint64_t remoteToken, uint64_t id, shared_ptr<StreamMultiplexer> multiplexer) {
+        lock_guard<mutex> lock(registryGuard);
+        registry[make_pair(remoteToken, id)] = move(multiplexer);
+    }
+
+    void unpublish(const pair<uint64_t, uint64_t> &key, const StreamMultiplexer *multiplexer) {
+        lock_guard<mutex> lock(registryGuard);
+        auto published = registry.find(key);
+        if (published != registry.end() && published->second.get() == multiplexer) {
+            registry.erase(published);
+        }
+    }
+}
+
+void StreamMultiplexer::dropIdle() {
+    lock_guard<mutex> lock(registryGuard);
+    for (auto multiplexer = registry.begin(); multiplexer != registry.end();) {
+        // Streams keep a reference, so nobody else can start using an unreferenced one meanwhile
+        if (multiplexer->second.use_count() == 1 && multiplexer->second->idle()) {
+            multiplexer = registry.erase(multiplexer);
+        } else {
+            ++multiplexer;
+        }
+    }
+}
+
+unique_ptr<MultiplexedStream> StreamMultiplexer::openStream(int sock) {
+    // The last stream of a multiplexer can't always drop it, the remote side might not have closed all of its yet
+    dropIdle();
+
+    tcp_setBlocking(sock); // just set the socket to block for our setup.
+    uint64_t token = processToken();
+    uint64_t remoteToken = 0;
+    tcp_write(sock, &token, sizeof(token));
+    tcp_read(sock, &remoteToken, sizeof(remoteToken));
+    if (remoteToken == token) {
+        throw runtime_error{"both ends of the socket have the same process token"};
+    }
+
+    // The side with the lower token proposes the multiplexer to use, the other one accepts it if it knows it. Otherwise
+    // both set up a new one. A multiplexer is published by the follower before the leader, so the follower knows every
+    // multiplexer the leader may propose later
+    const bool leader = token < remoteToken;
+    shared_ptr<StreamMultiplexer> multiplexer;
+    uint64_t id = 0;
+    if (leader) {
+        id = latest(remoteToken);
+        tcp_write(sock, &id, sizeof(id));
+        uint8_t accepted = 0;
+        tcp_read(sock, &accepted, sizeof(accepted));
+        if (accepted) {
+            multiplexer = lookup(remoteToken, id);
+        } else {
+            {
+                lock_guard<mutex> lock(registryGuard);
+                id = nextMultiplexer++;
+            }
+            tcp_write(sock, &id, sizeof(id));
+            multiplexer = make_shared<StreamMultiplexer>(sock);
+            multiplexer->registryKey = make_pair(remoteToken, id);
+            uint8_t ready = 0;
+            tcp_read(sock, &ready, sizeof(ready));
+            publish(remoteToken, id, multiplexer);
+        }
+    } else {
+        tcp_read(sock, &id, sizeof(id));
+        multiplexer = id != 0 ? lookup(remoteToken, id) : nullptr;
+        uint8_t accepted = multiplexer != nullptr;
+        tcp_write(sock, &accepted, sizeof(accepted));
+        if (not accepted) {
+            tcp_read(sock, &id, sizeof(id));
+            multiplexer = make_shared<StreamMultiplexer>(sock);
+            multiplexer->registryKey = make_pair(remoteToken, id);
+            publish(remoteToken, id, multiplexer);
+            uint8_t ready = 1;
+            tcp_write(sock, &ready, sizeof(ready));
+        }
+    }
+
+    // Each side tells the other one its id of the stream
+    auto stream = make_unique<MultiplexedStream>(multiplexer);
+    tcp_write(sock, &stream->localStream, sizeof(stream->localStream));
+    tcp_read(sock, &stream->remoteStream, sizeof(stream->remoteStream));
+    return stream;
+}
+
+StreamMultiplexer::StreamMultiplexer(int sock) : connection(BUFFER_SIZE, sock) {
+}
+
+uint32_t StreamMultiplexer::add(MultiplexedStream &stream) {
+    lock_guard<mutex> lock(guard);
+    // Ids are never reused, the remote side might still send to a closed stream
+    const auto id = nextStream++;
+    streams[id] = &stream;
+    ++openPairs;
+    return id;
+}
+
+void StreamMultiplexer::close(MultiplexedStream &stream) {
+    unique_lock<mutex> lock(guard);
+    // A close arriving from now on finds no stream and closes the pair instead
+    pump();
+    streams.erase(stream.localStream);
+    if (stream.remoteClosed) {
+        --openPairs;
+    }
+    sendFrame(lock, stream.remoteStream, FrameType::Close, nullptr, 0);
+    if (openPairs == 0) {
+        // Our close has to arrive before the queue pair is gone with the multiplexer
+        connection.flush();
+        lock.unlock();
+        unpublish(registryKey, this);
+    }
+}
+
+bool StreamMultiplexer::idle() {
+    lock_guard<mutex> lock(guard);
+    pump();
+    if (openPairs != 0) {
+        return false;
+    }
+    connection.flush();
+    return true;
+}
+
+void StreamMultiplexer::sendFrame(unique_lock<mutex> &lock, uint32_t stream, FrameType type, const uint8_t *data,
+                                  size_t length) {
+    vector<uint8_t> frame(sizeof(FrameHeader) + length);
+    const FrameHeader header{stream, type};
+    memcpy(frame.data(), &header, sizeof(header));
+    copy(data, data + length, frame.begin() + sizeof(header));
+
+    // The remote side may be waiting for space in our ring just as well, so keep draining it, and let the other
+    // streams in between
+    while (not connection.trySend(frame.data(), frame.size())) {
+        pump();
+        lock.unlock();
+        this_thread::yield();
+        lock.lock();
+    }
+}
+
+void StreamMultiplexer::pump() {
+    while (connection.hasData()) {
+        auto frame = connection.receive();
+        FrameHeader header;
+        memcpy(&header, frame.data(), sizeof(header));
+        auto stream = streams.find(header.stream);
+        if (stream == streams.end()) {
+            if (header.type == FrameType::Close) {
+                --openPairs; // both ends closed
+            }
+            continue; // closed in the meantime
+        }
+        if (header.type == FrameType::Close) {
+            stream->second->remoteClosed = true;
+        } else if (header.type == FrameType::Credit) {
+            int64_t credit;
+            memcpy(&credit, frame.data() + sizeof(header), sizeof(credit));
+            stream->second->credit += credit;
+        } else {
+            frame.erase(frame.begin(), frame.begin() + sizeof(header));
+            stream->second->inbox.push_back(move(frame));
+        }
+    }
+}
+
+MultiplexedStream::MultiplexedStream(shared_ptr<StreamMultiplexer> multiplexer) :
+        multiplexer(move(multiplexer)),
+        localStream(this->multiplexer->add(*this)) {
+    setCreditReturnFraction(Tuning::get().creditReturnFraction);
+}
+
+MultiplexedStream::~MultiplexedStream() {
+    multiplexer->close(*this);
+}
+
+void MultiplexedStream::send(const uint8_t *data, size_t length) {
+    // A message larger than the credit still goes out once half the window is free, so large messages can't starve
+    const auto size = static_cast<int64_t>(length);
+    unique_lock<mutex> lock(multiplexer->guard);
+    for (;;) {
+        multiplexer->pump();
+        if (credit >= size || credit >= WINDOW / 2) {
+            credit -= size;
+            multiplexer->sendFrame(lock, remoteStream, StreamMultiplexer::FrameType::Data, data, length);
+            return;
+        }
+        lock.unlock();
+        lock.lock();
+    }
+}
+
+void MultiplexedStream::setCreditReturnFraction(double fraction) {
+    // A sender waits for half the window at most, larger batches could keep the credit from ever coming back
+    lock_guard<mutex> lock(multiplexer->guard);
+    creditBatch = max<int64_t>(1, static_cast<int64_t>(WINDOW * min(fraction, 0.5)));
+}
+
+vector<uint8_t> MultiplexedStream::nextMessage(size_t maxSize) {
+    unique_lock<mutex> lock(multiplexer->guard);
+    for (;;) {
+        multiplexer->pump();
+        if (inbox.empty()) {
+            lock.unlock();
+            lock.lock();
+            continue;
+        }
+        if (inbox.front().size() > maxSize) {
+            throw runtime_error{"plz only read whole messages for now!"};
+        }
+        auto message = move(inbox.front());
+        inbox.pop_front();
+
+        // Hand the consumed bytes back in batches
+        consumed += message.size();
+        if (consumed >= creditBatch) {
+            const int64_t returned = consumed;
+            consumed = 0;
+            multiplexer->sendFrame(lock, remoteStream, StreamMultiplexer::FrameType::Credit,
+                                   reinterpret_cast<const uint8_t *>(&returned), sizeof(returned));
+        }
+        return message;
+    }
+}
+
+vector<uint8_t> MultiplexedStream::receive() {
+    return nextMessage(numeric_limits<size_t>::max());
+}
+
+size_t MultiplexedStream::receive(void *whereTo, size_t maxSize) {
+    const auto message = nextMessage(maxSize);
+    copy(message.begin(), message.end(), reinterpret_cast<uint8_t *>(whereTo));
+    return message.size();
+}
+
+bool MultiplexedStream::hasData() const {
+    lock_guard<mutex> lock(multiplexer->guard);
+    multiplexer->pump();
+    return not inbox.empty();
+}
@@ -0,0 +1,124 @@
+#ifndef RDMA_HASH_MAP_STREAMMULTIPLEXER_H
+#define RDMA_HASH_MAP_STREAMMULTIPLEXER_H
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "MessageTransport.h"
+#include "RDMAMessageBuffer.h"
+
+class MultiplexedStream;
+
+/// Carries many logical streams between two processes over a single RDMAMessageBuffer, so the number of queue pairs
+/// grows with the number of remote processes instead of the number of sockets. Incoming frames are dispatched to their
+/// streams right away, and per stream credit keeps a slow reader from filling the shared ring.
+/// Frames are only dispatched while some stream of the multiplexer is used. A sender waiting for space in the shared
+/// ring keeps dispatching, so both sides sending at once can't deadlock. Closing a stream tells the remote side, and a
+/// multiplexer is dropped once both ends of all its streams are closed.
+class StreamMultiplexer {
+    friend class MultiplexedStream;
+
+public:
+    /// Size of the shared ring
+    static const size_t BUFFER_SIZE = 1024 * 1024;
+
+    /// Open a stream to the process at the other end of the socket, over the multiplexer already shared with that
+    /// process or a new one
+    static std::unique_ptr<MultiplexedStream> openStream(int sock);
+
+    StreamMultiplexer(int sock);
+
+private:
+    enum class FrameType : uint32_t {
+        Data,
+        Credit,
+        /// The sender's end of the stream is closed, nothing follows for it
+        Close
+    };
+
+    struct FrameHeader {
+        /// The receiver's id of the stream
+        uint32_t stream;
+        FrameType type;
+    };
+
+    /// Protects everything below, including the state of the streams
+    std::mutex guard;
+    RDMAMessageBuffer connection;
+    std::unordered_map<uint32_t, MultiplexedStream *> streams;
+    uint32_t nextStream = 0;
+    /// Streams with at least one end still open, the remote side writes to us until there are none
+    size_t openPairs = 0;
+    /// The remote process' token and our id, under which the multiplexer is published
+    std::pair<uint64_t, uint64_t> registryKey;
+
+    uint32_t add(MultiplexedStream &stream);
+
+    /// Tell the remote side the stream is closed, and drop the multiplexer from the registry if it was the last one
+    void close(MultiplexedStream &stream);
+
+    /// Whether both ends of all streams are closed, after dispatching the arrived frames
+    bool idle();
+
+    /// Drop the published multiplexers without streams whose remote side closed all of its streams in the meantime
+    static void dropIdle();
+
+    /// Send a frame once the shared ring has space for it, dispatching arrived frames meanwhile. The lock on guard is
+    /// released while waiting, never held across a blocking send
+    void sendFrame(std::unique_lock<std::mutex> &lock, uint32_t stream, FrameType type, const uint8_t *data,
+                   size_t length);
+
+    /// Dispatch all arrived frames to their streams
+    void pump();
+};
+
+/// A logical stream of a StreamMultiplexer
+class MultiplexedStream : public MessageTransport {
+    friend class StreamMultiplexer;
+
+public:
+    /// Bytes a sender may have in flight, before the receiver consumed them
+    static const int64_t WINDOW = 64 * 1024;
+
+    MultiplexedStream(std::shared_ptr<StreamMultiplexer> multiplexer);
+
+    ~MultiplexedStream() override;
+
+    /// Send data to the remote site
+    void send(const uint8_t *data, size_t length) override;
+
+    /// Receive data to a freshly allocated data vector
+    std::vector<uint8_t> receive() override;
+
+    /// Receive to a specific memory region with at last maxSize
+    size_t receive(void *whereTo, size_t maxSize) override;
+
+    /// whether there is data to be read non-blockingly
+    bool hasData() const override;
+
+    /// Hand consumed bytes back to the sender once they are this fraction of the window, at most half of it. Defaults
+    /// to the tuning
+    void setCreditReturnFraction(double fraction);
+
+private:
+    std::shared_ptr<StreamMultiplexer> multiplexer;
+    uint32_t localStream;
+    uint32_t remoteStream = 0;
+    /// Received messages, not consumed yet
+    std::deque<std::vector<uint8_t>> inbox;
+    /// Bytes we may still send
+    int64_t credit = WINDOW;
+    /// Bytes consumed, but not yet handed back to the sender
+    int64_t consumed = 0;
+    /// The remote side closed its end
+    bool remoteClosed = false;
+    /// Consumed bytes are handed back in batches of at least that size
+    int64_t creditBatch;
+
+    std::vector<uint8_t> nextMessage(size_t maxSize);
+};
+
+#endif //RDMA_HASH_MAP_STREAMMULTIPLEXER_H
@@ -0,0 +1,86 @@
+#include "StripedMessageBuffer.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include "tcpWrapper.h"
+
+using namespace std;
+using namespace rdma;
+
+StripedMessageBuffer::StripedMessageBuffer(size_t size, int sock) :
+        // Leaves room for framing and keeps several chunks in flight on each lane
+        chunkSize(size / 4),
+        sendStaging(sizeof(uint64_t) + size / 4),
+        receiveStaging(sizeof(uint64_t) + size / 4) {
+    tcp_setBlocking(sock); // just set the socket to block for our setup.
+    const auto &rails = RDMANetworking::rails();
+    auto localRails = static_cast<uint32_t>(rails.size());
+    uint32_t remoteRails = 0;
+    tcp_write(sock, &localRails, sizeof(localRails));
+    tcp_read(sock, &remoteRails, sizeof(remoteRails));
+    // Both sides set up the lanes in the order of their rails
+    for (uint32_t i = 0; i != min(localRails, remoteRails); ++i) {
+        lanes.push_back(make_unique<RDMAMessageBuffer>(size, sock, *rails[i]));
+    }
+}
+
+void StripedMessageBuffer::send(const uint8_t *data, size_t length) {
+    const uint64_t header = length;
+    auto &announcing = *lanes[nextSendLane];
+    nextSendLane = (nextSendLane + 1) % lanes.size();
+    if (length < chunkSize) {
+        memcpy(sendStaging.data(), &header, sizeof(header));
+        memcpy(sendStaging.data() + sizeof(header), data, length);
+        announcing.send(sendStaging.data(), sizeof(header) + length);
+        return;
+    }
+
+    // Only the header, a message of 8 bytes with a non-zero length is never inline
+    announcing.send(reinterpret_cast<const uint8_t *>(&header), sizeof(header));
+    for (size_t offset = 0; offset < length; offset += chunkSize) {
+        // Posting returns before the NIC is done, so the lanes transfer their chunks at the same time
+        lanes[nextSendLane]->send(data + offset, min(chunkSize, length - offset));
+        nextSendLane = (nextSendLane + 1) % lanes.size();
+    }
+}
+
+size_t StripedMessageBuffer::receiveHeader() {
+    const auto received = lanes[nextReceiveLane]->receive(receiveStaging.data(), receiveStaging.size());
+    nextReceiveLane = (nextReceiveLane + 1) % lanes.size();
+    uint64_t header;
+    memcpy(&header, receiveStaging.data(), sizeof(header));
+    receivedInline = received == sizeof(header) + header;
+    return header;
+}
+
+void StripedMessageBuffer::receivePayload(uint8_t *whereTo, size_t length) {
+    if (receivedInline) {
+        memcpy(whereTo, receiveStaging.data() + sizeof(uint64_t), length);
+        return;
+    }
+    for (size_t offset = 0; offset < length; offset += chunkSize) {
+        lanes[nextReceiveLane]->receive(whereTo + offset, min(chunkSize, length - offset));
+        nextReceiveLane = (nextReceiveLane + 1) % lanes.size();
+    }
+}
+
+vector<uint8_t> StripedMessageBuffer::receive() {
+    const auto length = receiveHeader();
+    auto result = vector<uint8_t>(length);
+    receivePayload(result.data(), length);
+    return result;
+}
+
+size_t StripedMessageBuffer::receive(void *whereTo, size_t maxSize) {
+    const auto length = receiveHeader();
+    if (length > maxSize) {
+        throw runtime_error{"plz only read whole messages for now!"};
+    }
+    receivePayload(reinterpret_cast<uint8_t *>(whereTo), length);
+    return length;
+}
+
+bool StripedMessageBuffer::hasData() const {
+    // A striped message is complete enough to be received once its header is there
+    return lanes[nextReceiveLane]->hasData();
+}
@@ -0,0 +1,52 @@
+#ifndef RDMA_HASH_MAP_STRIPEDMESSAGEBUFFER_H
+#define RDMA_HASH_MAP_STRIPEDMESSAGEBUFFER_H
+
+#include <memory>
+#include <vector>
+#include "MessageTransport.h"
+#include "RDMAMessageBuffer.h"
+
+/// Ring buffer connections on several rails (RDMANetworking::rails()), so bulk transfers get the bandwidth of all of
+/// them. Small messages go to the lanes one after another, large ones are announced on one lane and cut into chunks,
+/// which are written to the following lanes in parallel. The receiver walks the lanes in the same order and gets
+/// everything in order without sequence numbers.
+class StripedMessageBuffer : public MessageTransport {
+public:
+    /// Set up a ring of the given size on each rail both sides have, size _must_ be a power of 2
+    StripedMessageBuffer(size_t size, int sock);
+
+    /// Send data to the remote site
+    void send(const uint8_t *data, size_t length) override;
+
+    /// Receive data to a freshly allocated data vector
+    std::vector<uint8_t> receive() override;
+
+    /// Receive to a specific memory region with at last maxSize
+    size_t receive(void *whereTo, size_t maxSize) override;
+
+    /// whether there is data to be read non-blockingly
+    bool hasData() const override;
+
+    /// The number of rails used
+    size_t getLaneCount() const { return lanes.size(); }
+
+private:
+    std::vector<std::unique_ptr<RDMAMessageBuffer>> lanes;
+    /// Messages of at least this size are striped, and each chunk has at most this size
+    const size_t chunkSize;
+    size_t nextSendLane = 0;
+    size_t nextReceiveLane = 0;
+    /// Header and payload of small messages
+    std::vector<uint8_t> sendStaging;
+    std::vector<uint8_t> receiveStaging;
+    /// Whether the payload of the message announced by receiveHeader() is in receiveStaging
+    bool receivedInline = false;
+
+    /// Receive the next message's header from its lane, returns the length of the message
+    size_t receiveHeader();
+
+    /// Receive the payload of the message whose header was received last
+    void receivePayload(uint8_t *whereTo, size_t length);
+};
+
+#endif //RDMA_HASH_MAP_STRIPEDMESSAGEBUFFER_H
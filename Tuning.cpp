@@ -0,0 +1,82 @@
+#include "Tuning.h"
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+using namespace std;
+
+static const char *const defaultPath = "/etc/rdma_tuning.conf";
+
+const Tuning &Tuning::get() {
+    static const Tuning tuning = [] {
+        const char *path = getenv("RDMA_TUNING");
+        if (path != nullptr) {
+            return load(path);
+        }
+        return ifstream(defaultPath).good() ? load(defaultPath) : Tuning();
+    }();
+    return tuning;
+}
+
+Tuning Tuning::load(const string &path) {
+    ifstream file(path);
+    if (not file) {
+        string reason = "unable to read the tuning file " + path;
+        cerr << reason << endl;
+        throw runtime_error{reason};
+    }
+
+    Tuning tuning;
+    string line;
+    while (getline(file, line)) {
+        line = line.substr(0, line.find('#'));
+        const auto equals = line.find('=');
+        if (equals == string::npos) {
+            continue;
+        }
+        string key;
+        string value;
+        stringstream(line.substr(0, equals)) >> key;
+        stringstream(line.substr(equals + 1)) >> value;
+        if (key == "inline_threshold") {
+            tuning.inlineThreshold = stoul(value);
+        } else if (key == "ring_size") {
+            const auto ringSize = stoul(value);
+            if (ringSize >= 4096 && (ringSize & (ringSize - 1)) == 0) {
+                tuning.ringSize = ringSize;
+            } else {
+                cerr << "ignoring ring_size " << ringSize << " in " << path << ", it has to be a power of 2" << endl;
+            }
+        } else if (key == "signal_interval") {
+            tuning.signalInterval = stoul(value);
+        } else if (key == "credit_return_fraction") {
+            tuning.creditReturnFraction = stod(value);
+        } else if (key == "spin_budget") {
+            tuning.spinBudget = stoul(value);
+        } else {
+            cerr << "unknown key " << key << " in " << path << endl;
+        }
+    }
+    return tuning;
+}
+
+void Tuning::save(const string &path, const string &comment) const {
+    ofstream file(path);
+    stringstream lines(comment);
+    string line;
+    while (getline(lines, line)) {
+        file << "# " << line << endl;
+    }
+    file << "inline_threshold = " << inlineThreshold << endl;
+    file << "ring_size = " << ringSize << endl;
+    file << "signal_interval = " << signalInterval << endl;
+    file << "credit_return_fraction = " << creditReturnFraction << endl;
+    file << "spin_budget = " << spinBudget << endl;
+    if (not file) {
+        string reason = "unable to write the tuning file " + path;
+        cerr << reason << endl;
+        throw runtime_error{reason};
+    }
+}
@@ -0,0 +1,34 @@
+#ifndef RDMA_HASH_MAP_TUNING_H
+#define RDMA_HASH_MAP_TUNING_H
+
+#include <cstddef>
+#include <limits>
+#include <string>
+
+/// Parameters measured on the local hardware by rdmaAutotune instead of being fixed in code. Loaded from the file
+/// RDMA_TUNING names, /etc/rdma_tuning.conf if it exists otherwise. Lines of <key> = <value>, # starts a comment, keys
+/// missing in the file keep their defaults
+struct Tuning {
+    /// Writes of up to this many bytes (the message and 16 bytes of framing) are posted inline, as far as the queue
+    /// pair supports it
+    size_t inlineThreshold = std::numeric_limits<size_t>::max();
+    /// Size of the rings of the preload library's connections, a power of 2
+    size_t ringSize = 128 * 1024;
+    /// Ring buffers signal every that many work requests, 0 for as rarely as their send queue allows
+    size_t signalInterval = 0;
+    /// A multiplexed stream hands consumed bytes back to the sender once they are this fraction of its window
+    double creditReturnFraction = 0.5;
+    /// Idle sweeps of a progress engine thread before it starts yielding the CPU
+    size_t spinBudget = 1024;
+
+    /// The tuning of this process
+    static const Tuning &get();
+
+    /// Read a tuning file, throws if it can't be read
+    static Tuning load(const std::string &path);
+
+    /// Write the tuning to a file, headed by the comment
+    void save(const std::string &path, const std::string &comment) const;
+};
+
+#endif //RDMA_HASH_MAP_TUNING_H
@@ -0,0 +1,30 @@
+#ifndef RDMA_HASH_MAP_WRAPAROUND_H
+#define RDMA_HASH_MAP_WRAPAROUND_H
+
+#include <cstddef>
+
+/// Higher order wraparound function. Calls the given function func() once or twice, depending on if a wraparound is needed or not
+template<typename Func>
+void wraparound(const size_t totalSize, const size_t todoSize, const size_t pos, Func &&func) {
+    const size_t beginPos = pos & (totalSize - 1);
+    if ((totalSize - beginPos) >= todoSize) {
+        func(0, beginPos, beginPos + todoSize);
+    } else {
+        const auto fst = beginPos;
+        const auto fstToRead = totalSize - beginPos;
+        const auto snd = 0;
+        const auto sndToRead = todoSize - fstToRead;
+        func(0, fst, fst + fstToRead);
+        func(fstToRead, snd, snd + sndToRead);
+    }
+}
+
+/// func(size_t prevBytes, T* begin, T* end)
+template<typename T, typename Func>
+void wraparound(T *buffer, const size_t totalSize, const size_t todoSize, const size_t pos, Func &&func) {
+    wraparound(totalSize, todoSize, pos, [&](auto prevBytes, auto beginPos, auto endPos) {
+        func(prevBytes, buffer + beginPos, buffer + endPos);
+    });
+}
+
+#endif //RDMA_HASH_MAP_WRAPAROUND_H
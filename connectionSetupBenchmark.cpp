@@ -0,0 +1,115 @@
+#include <array>
+#include <iostream>
+#include <memory>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include "tcpWrapper.h"
+#include "RDMAMessageBuffer.h"
+
+using namespace std;
+using namespace rdma;
+
+/// Measures how many ring buffer connections per second can be established, with the handshake over TCP or through
+/// the RDMA connection manager. Each of the threads sets up its share of the connections and exchanges one message
+/// over each of them.
+int main(int argc, char **argv) {
+    if (argc < 6 || (argv[1][0] == 'c' && argc < 7)) {
+        cout << "Usage: " << argv[0] << " <client / server> <tcp / cm> <Connections> <Threads> <Port> [IP (if client)]"
+             << endl;
+        return -1;
+    }
+    const auto isClient = argv[1][0] == 'c';
+    const auto connectionManager = string(argv[2]) == "cm";
+    const auto connections = static_cast<size_t>(::atoi(argv[3]));
+    const auto threadCount = max<size_t>(static_cast<size_t>(::atoi(argv[4])), 1);
+    const auto port = static_cast<uint16_t>(::atoi(argv[5]));
+
+    static const size_t BUFFERSIZE = 1024 * 4; // 4K
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (isClient) {
+        inet_pton(AF_INET, argv[6], &addr.sin_addr);
+    } else {
+        addr.sin_addr.s_addr = INADDR_ANY;
+    }
+
+    unique_ptr<ConnectionManager> manager;
+    int listening = -1;
+    if (connectionManager) {
+        if (not ConnectionManager::available()) {
+            cout << "built without librdmacm" << endl;
+            return -1;
+        }
+        // The server's listener takes the port in the connection manager's port space, the client only connects
+        manager = make_unique<ConnectionManager>(isClient ? 0 : port);
+    } else if (not isClient) {
+        listening = tcp_socket();
+        tcp_bind(listening, addr);
+        tcp_listen(listening);
+    }
+
+    // Only set up the network once, it is not part of a connection's setup
+    RDMANetworking::sharedNetwork();
+
+    auto sendData = array<uint8_t, 64>{"0123456789@ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz"};
+    vector<vector<unique_ptr<RDMAMessageBuffer>>> buffers(threadCount);
+    auto setUp = [&](size_t thread) {
+        for (size_t i = thread; i < connections; i += threadCount) {
+            unique_ptr<RDMAMessageBuffer> buffer;
+            if (connectionManager) {
+                ConnectionManager::Rendezvous rendezvous{};
+                rendezvous.active = isClient;
+                rendezvous.address = addr;
+                rendezvous.tag = i;
+                buffer = make_unique<RDMAMessageBuffer>(BUFFERSIZE, *manager, rendezvous);
+            } else if (isClient) {
+                auto sock = tcp_socket();
+                tcp_connect(sock, addr);
+                buffer = make_unique<RDMAMessageBuffer>(BUFFERSIZE, sock);
+                close(sock); // the RDMA connection doesn't need it anymore
+            } else {
+                sockaddr_in inAddr;
+                auto sock = tcp_accept(listening, inAddr);
+                buffer = make_unique<RDMAMessageBuffer>(BUFFERSIZE, sock);
+                close(sock);
+            }
+
+            if (isClient) {
+                buffer->send(sendData.data(), sendData.size());
+                auto answer = buffer->receive();
+                if (answer.size() != sendData.size() || not equal(answer.begin(), answer.end(), sendData.begin())) {
+                    throw runtime_error{"received " + string(answer.begin(), answer.end())};
+                }
+            } else {
+                auto ping = buffer->receive();
+                buffer->send(ping.data(), ping.size());
+            }
+            buffers[thread].push_back(move(buffer));
+        }
+    };
+
+    const auto start = chrono::steady_clock::now();
+    vector<thread> threads;
+    for (size_t thread = 0; thread < threadCount; ++thread) {
+        threads.emplace_back(setUp, thread);
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    const auto end = chrono::steady_clock::now();
+    const auto msTaken = chrono::duration<double, milli>(end - start).count();
+    cout << connections << " connections set up " << (connectionManager ? "through the connection manager" : "over TCP")
+         << " by " << threadCount << " threads in " << msTaken << "ms" << endl;
+    cout << connections / (msTaken / 1000) << " connections/s" << endl;
+
+    if (listening >= 0) {
+        close(listening);
+    }
+    return 0;
+}
@@ -0,0 +1,94 @@
+#include <array>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+#include "tcpWrapper.h"
+#include "Coroutines.h"
+
+using namespace std;
+
+/// Ping pong over many connections from a single thread, every connection is served by its own coroutine
+static const size_t BUFFERSIZE = 1024 * 4; // 4K
+static const array<uint8_t, 64> sendData{"0123456789@ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz"};
+
+static coro::Task ping(coro::AsyncMessageBuffer buffer, size_t rounds) {
+    for (size_t round = 0; round < rounds; ++round) {
+        co_await buffer.send(sendData);
+        auto answer = co_await buffer.receive();
+        if (answer.size() != sendData.size() || not equal(answer.begin(), answer.end(), sendData.begin())) {
+            throw runtime_error{"received " + string(answer.begin(), answer.end())};
+        }
+    }
+}
+
+static coro::Task pong(coro::AsyncMessageBuffer buffer, size_t rounds) {
+    for (size_t round = 0; round < rounds; ++round) {
+        auto answer = co_await buffer.receive();
+        co_await buffer.send(answer);
+    }
+}
+
+int main(int argc, char **argv) {
+    if (argc < 4 || (argv[1][0] == 'c' && argc < 5)) {
+        cout << "Usage: " << argv[0] << " <client / server> <Connections> <Port> [IP (if client)]" << endl;
+        return -1;
+    }
+    const auto isClient = argv[1][0] == 'c';
+    const auto connections = static_cast<size_t>(::atoi(argv[2]));
+    const auto port = ::atoi(argv[3]);
+
+    static const size_t MESSAGES = 1024 * 1024;
+    const size_t rounds = max<size_t>(MESSAGES / connections, 1);
+
+    sockaddr_in addr;
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    int listening = -1;
+    if (isClient) {
+        inet_pton(AF_INET, argv[4], &addr.sin_addr);
+    } else {
+        addr.sin_addr.s_addr = INADDR_ANY;
+        listening = tcp_socket();
+        tcp_bind(listening, addr);
+        listen(listening, SOMAXCONN);
+    }
+
+    vector<unique_ptr<RDMAMessageBuffer>> buffers;
+    for (size_t i = 0; i < connections; ++i) {
+        int sock;
+        if (isClient) {
+            sock = tcp_socket();
+            tcp_connect(sock, addr);
+        } else {
+            sockaddr_in inAddr;
+            sock = tcp_accept(listening, inAddr);
+        }
+        buffers.push_back(make_unique<RDMAMessageBuffer>(BUFFERSIZE, sock));
+        close(sock); // the RDMA connection doesn't need it anymore
+    }
+
+    coro::Scheduler scheduler;
+    const auto start = chrono::steady_clock::now();
+    for (auto &buffer : buffers) {
+        auto async = coro::AsyncMessageBuffer(*buffer, scheduler);
+        scheduler.spawn(isClient ? ping(async, rounds) : pong(async, rounds));
+    }
+    scheduler.run();
+    const auto end = chrono::steady_clock::now();
+
+    if (isClient) {
+        const auto msTaken = chrono::duration<double, milli>(end - start).count();
+        const auto sTaken = msTaken / 1000;
+        cout << rounds * connections << " " << sendData.size() << "B messages exchanged over " << connections
+             << " connections by one thread in " << msTaken << "ms" << endl;
+        cout << rounds * connections / sTaken << " msg/s" << endl;
+    } else {
+        close(listening);
+    }
+    return 0;
+}
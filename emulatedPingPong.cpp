@@ -0,0 +1,77 @@
+#include <array>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include "tcpWrapper.h"
+#include "RDMAMessageBuffer.h"
+
+using namespace std;
+
+// Runs both sides of the ping pong in one process on the software verbs emulator, no HCA needed
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        cout << "Usage: " << argv[0] << " <Port> [latency ns] [Gbit/s]" << endl;
+        return -1;
+    }
+    const auto port = ::atoi(argv[1]);
+    setenv("RDMA_BACKEND", "emulated", 1);
+    if (argc > 2) setenv("RDMA_EMULATED_LATENCY_NS", argv[2], 1);
+    if (argc > 3) setenv("RDMA_EMULATED_GBITS", argv[3], 1);
+
+    static const size_t MESSAGES = 1024 * 16;
+    static const size_t BUFFERSIZE = 1024 * 16; // 16K
+
+    sockaddr_in addr;
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    auto sock = tcp_socket();
+    tcp_bind(sock, addr);
+    listen(sock, SOMAXCONN);
+
+    thread server([&] {
+        sockaddr_in inAddr;
+        auto acced = tcp_accept(sock, inAddr);
+        RDMAMessageBuffer rdma(BUFFERSIZE, acced);
+
+        for (size_t i = 0; i < MESSAGES; ++i) {
+            auto ping = rdma.receive();
+            rdma.send(ping.data(), ping.size());
+        }
+        close(acced);
+    });
+
+    auto client = tcp_socket();
+    tcp_connect(client, addr);
+
+    auto sendData = array<uint8_t, 64>{"0123456789@ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz"};
+    RDMAMessageBuffer rdma(BUFFERSIZE, client);
+
+    const auto start = chrono::steady_clock::now();
+    for (size_t i = 0; i < MESSAGES; ++i) {
+        rdma.send(sendData.data(), sendData.size(), true);
+        auto answer = rdma.receive();
+        if (answer.size() != sendData.size()) {
+            throw runtime_error{"answer has wrong size!"};
+        }
+        for (size_t j = 0; j < sendData.size(); ++j) {
+            if (answer[j] != sendData[j]) {
+                throw runtime_error{"expected '1~9', received " + string(answer.begin(), answer.end())};
+            }
+        }
+    }
+    const auto end = chrono::steady_clock::now();
+    const auto msTaken = chrono::duration<double, milli>(end - start).count();
+    const auto sTaken = msTaken / 1000;
+    cout << MESSAGES << " " << sendData.size() << "B messages exchanged in " << msTaken << "ms" << endl;
+    cout << MESSAGES / sTaken << " msg/s" << endl;
+
+    server.join();
+    close(client);
+    close(sock);
+    return 0;
+}
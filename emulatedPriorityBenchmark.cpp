@@ -0,0 +1,112 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include "tcpWrapper.h"
+#include "PriorityMessageBuffer.h"
+
+using namespace std;
+
+using Priority = PriorityMessageBuffer::Priority;
+
+static const size_t BUFFERSIZE = 1024 * 1024; // 1M
+static const size_t PINGSIZE = 16;
+
+/// Round trips of small pings sent on the given lane while bulk messages stream on the same connection, in us
+static vector<double> measure(int port, Priority pingLane, size_t bulkSize, size_t pings) {
+    sockaddr_in addr;
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    auto sock = tcp_socket();
+    tcp_bind(sock, addr);
+    listen(sock, SOMAXCONN);
+
+    thread server([&] {
+        sockaddr_in inAddr;
+        auto acced = tcp_accept(sock, inAddr);
+        PriorityMessageBuffer rdma(BUFFERSIZE, acced);
+
+        // Pings are answered on the urgent lane, whichever lane they came in on. A single byte ends the measurement
+        vector<uint8_t> received(bulkSize);
+        for (bool done = false; not done;) {
+            const auto lane = rdma.hasData(Priority::Urgent) ? Priority::Urgent : Priority::Bulk;
+            if (not rdma.hasData(lane)) {
+                continue;
+            }
+            const auto length = rdma.receive(received.data(), received.size(), lane);
+            if (length <= PINGSIZE) {
+                rdma.send(received.data(), length, Priority::Urgent);
+            }
+            done = length == 1;
+        }
+        // Destroying the queue pairs drops writes still in flight, so wait until the client has the answer
+        rdma.receive(received.data(), received.size(), Priority::Bulk);
+        close(acced);
+    });
+
+    auto client = tcp_socket();
+    tcp_connect(client, addr);
+    PriorityMessageBuffer rdma(BUFFERSIZE, client);
+    rdma.setMultiProducer();
+
+    atomic<bool> streaming{true};
+    thread bulk([&] {
+        vector<uint8_t> sendData(bulkSize);
+        while (streaming) {
+            rdma.send(sendData.data(), sendData.size(), Priority::Bulk);
+        }
+    });
+
+    vector<double> roundTrips;
+    vector<uint8_t> ping(PINGSIZE);
+    for (size_t i = 0; i < pings; ++i) {
+        const auto start = chrono::steady_clock::now();
+        rdma.send(ping.data(), ping.size(), pingLane);
+        rdma.receive(ping.data(), ping.size(), Priority::Urgent);
+        const auto end = chrono::steady_clock::now();
+        roundTrips.push_back(chrono::duration<double, micro>(end - start).count());
+    }
+    streaming = false;
+    bulk.join();
+
+    uint8_t done = 1;
+    rdma.send(&done, sizeof(done), Priority::Bulk);
+    rdma.receive(&done, sizeof(done), Priority::Urgent);
+    rdma.send(&done, sizeof(done), Priority::Bulk);
+
+    server.join();
+    close(client);
+    close(sock);
+    sort(roundTrips.begin(), roundTrips.end());
+    return roundTrips;
+}
+
+// Measures the round trip of small messages while bulk transfers run on the same connection, once with the small
+// messages on the urgent lane and once behind the bulk messages, on the software verbs emulator. Both sides run in one
+// process
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        cout << "Usage: " << argv[0] << " <Port> [Bulk message size] [Pings]" << endl;
+        return -1;
+    }
+    const auto port = ::atoi(argv[1]);
+    setenv("RDMA_BACKEND", "emulated", 1);
+    const auto bulkSize = argc > 2 ? static_cast<size_t>(::atoi(argv[2])) : 100 * 1024;
+    const auto pings = argc > 3 ? static_cast<size_t>(::atoi(argv[3])) : 1000;
+
+    cout << "lane,p50 us,p99 us" << endl;
+    for (const auto lane : {Priority::Urgent, Priority::Bulk}) {
+        const auto roundTrips = measure(port, lane, bulkSize, pings);
+        cout << (lane == Priority::Urgent ? "urgent" : "bulk") << ',' << roundTrips[roundTrips.size() / 2] << ','
+             << roundTrips[roundTrips.size() * 99 / 100] << endl;
+    }
+    return 0;
+}
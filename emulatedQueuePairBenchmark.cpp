@@ -0,0 +1,80 @@
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include "tcpWrapper.h"
+#include "RDMAMessageBuffer.h"
+
+using namespace std;
+
+// Measures the bandwidth of bulk transfers over a single connection spread across several queue pairs, on the
+// software verbs emulator with a limited rate per queue pair. Both sides run in one process
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        cout << "Usage: " << argv[0] << " <Port> <Queue pairs> [Gbit/s per queue pair] [Messages]" << endl;
+        return -1;
+    }
+    const auto port = ::atoi(argv[1]);
+    setenv("RDMA_BACKEND", "emulated", 1);
+    setenv("RDMA_QPS_PER_CONNECTION", argv[2], 1);
+    setenv("RDMA_EMULATED_QP_GBITS", argc > 3 ? argv[3] : "25", 1);
+    const auto messages = argc > 4 ? static_cast<size_t>(::atoi(argv[4])) : 256;
+
+    static const size_t BUFFERSIZE = 4 * 1024 * 1024; // 4M
+    static const size_t MESSAGESIZE = 1024 * 1024; // 1M
+
+    sockaddr_in addr;
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    auto sock = tcp_socket();
+    tcp_bind(sock, addr);
+    listen(sock, SOMAXCONN);
+
+    thread server([&] {
+        sockaddr_in inAddr;
+        auto acced = tcp_accept(sock, inAddr);
+        RDMAMessageBuffer rdma(BUFFERSIZE, acced);
+
+        vector<uint8_t> received(MESSAGESIZE);
+        for (size_t i = 0; i < messages; ++i) {
+            rdma.receive(received.data(), received.size());
+            if (received[i % MESSAGESIZE] != static_cast<uint8_t>(i)) {
+                throw runtime_error{"message " + to_string(i) + " arrived out of order"};
+            }
+        }
+        const uint8_t done = 1;
+        rdma.send(&done, sizeof(done));
+        // Destroying the queue pairs drops writes still in flight, so wait until the client has the answer
+        rdma.receive();
+        close(acced);
+    });
+
+    auto client = tcp_socket();
+    tcp_connect(client, addr);
+    RDMAMessageBuffer rdma(BUFFERSIZE, client);
+
+    vector<uint8_t> sendData(MESSAGESIZE);
+    const auto start = chrono::steady_clock::now();
+    for (size_t i = 0; i < messages; ++i) {
+        sendData[i % MESSAGESIZE] = static_cast<uint8_t>(i);
+        rdma.send(sendData.data(), sendData.size());
+    }
+    auto done = rdma.receive();
+    const auto end = chrono::steady_clock::now();
+    rdma.send(done.data(), done.size());
+    const auto sTaken = chrono::duration<double>(end - start).count();
+    cout << messages << " " << MESSAGESIZE << "B messages over " << argv[2] << " queue pairs in " << sTaken * 1000
+         << "ms" << endl;
+    cout << messages * MESSAGESIZE * 8 / sTaken / 1e9 << " Gbit/s" << endl;
+
+    server.join();
+    close(client);
+    close(sock);
+    return 0;
+}
@@ -0,0 +1,127 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include "tcpWrapper.h"
+#include "RDMAMessageBuffer.h"
+
+using namespace std;
+
+static const size_t BULKBUFFERSIZE = 4 * 1024 * 1024; // 4M
+static const size_t BULKSIZE = 256 * 1024;
+static const size_t PINGBUFFERSIZE = 64 * 1024;
+static const size_t PINGSIZE = 64;
+
+/// Round trips of small pings on one connection while another connection of the process streams bulk messages, in us
+static vector<double> measure(int port, double bulkGigabits, size_t targetMicroseconds, size_t pings) {
+    sockaddr_in addr;
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    auto sock = tcp_socket();
+    tcp_bind(sock, addr);
+    listen(sock, SOMAXCONN);
+
+    // The bulk connection is accepted first. A single byte ends the measurement
+    thread bulkServer([&] {
+        sockaddr_in inAddr;
+        auto acced = tcp_accept(sock, inAddr);
+        RDMAMessageBuffer rdma(BULKBUFFERSIZE, acced);
+        vector<uint8_t> received(BULKSIZE);
+        while (rdma.receive(received.data(), received.size()) != 1);
+        rdma.send(received.data(), 1);
+        // Destroying the queue pairs drops writes still in flight, so wait until the client has the answer
+        rdma.receive(received.data(), received.size());
+        close(acced);
+    });
+    auto bulkClient = tcp_socket();
+    tcp_connect(bulkClient, addr);
+    RDMAMessageBuffer bulk(BULKBUFFERSIZE, bulkClient);
+    bulk.getSendFlow().setRateLimit(bulkGigabits);
+    bulk.getSendFlow().setTargetLatency(chrono::microseconds(targetMicroseconds));
+
+    thread pingServer([&] {
+        sockaddr_in inAddr;
+        auto acced = tcp_accept(sock, inAddr);
+        RDMAMessageBuffer rdma(PINGBUFFERSIZE, acced);
+        vector<uint8_t> received(PINGSIZE);
+        for (size_t length = 0; length != 1;) {
+            length = rdma.receive(received.data(), received.size());
+            rdma.send(received.data(), length);
+        }
+        rdma.receive(received.data(), received.size());
+        close(acced);
+    });
+    auto pingClient = tcp_socket();
+    tcp_connect(pingClient, addr);
+    RDMAMessageBuffer ping(PINGBUFFERSIZE, pingClient);
+
+    atomic<bool> streaming{true};
+    thread bulkSender([&] {
+        vector<uint8_t> sendData(BULKSIZE);
+        while (streaming) {
+            bulk.send(sendData.data(), sendData.size());
+        }
+        uint8_t done = 1;
+        bulk.send(&done, sizeof(done));
+        bulk.receive(&done, sizeof(done));
+        bulk.send(&done, sizeof(done));
+    });
+
+    vector<double> roundTrips;
+    vector<uint8_t> message(PINGSIZE);
+    for (size_t i = 0; i < pings; ++i) {
+        const auto start = chrono::steady_clock::now();
+        ping.send(message.data(), message.size());
+        ping.receive(message.data(), message.size());
+        const auto end = chrono::steady_clock::now();
+        roundTrips.push_back(chrono::duration<double, micro>(end - start).count());
+    }
+    streaming = false;
+    bulkSender.join();
+
+    uint8_t done = 1;
+    ping.send(&done, sizeof(done));
+    ping.receive(&done, sizeof(done));
+    ping.send(&done, sizeof(done));
+
+    bulkServer.join();
+    pingServer.join();
+    close(bulkClient);
+    close(pingClient);
+    close(sock);
+    sort(roundTrips.begin(), roundTrips.end());
+    return roundTrips;
+}
+
+// Measures the round trip of small messages while another connection of the same process streams bulk messages over
+// the same port, once without scheduling and once with the bulk connection rate limited and its window adapted to a
+// target latency, on the software verbs emulator. Both sides run in one process
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        cout << "Usage: " << argv[0] << " <Port> [Bulk Gbit/s] [Target latency us] [Pings]" << endl;
+        return -1;
+    }
+    const auto port = ::atoi(argv[1]);
+    setenv("RDMA_BACKEND", "emulated", 1);
+    setenv("RDMA_EMULATED_GBITS", "1", 0);
+    const auto bulkGigabits = argc > 2 ? ::atof(argv[2]) : 0.5;
+    const auto targetMicroseconds = argc > 3 ? static_cast<size_t>(::atoi(argv[3])) : 200;
+    const auto pings = argc > 4 ? static_cast<size_t>(::atoi(argv[4])) : 200;
+
+    cout << "bulk flow,p50 us,p99 us" << endl;
+    for (const bool scheduled : {false, true}) {
+        const auto roundTrips = measure(port, scheduled ? bulkGigabits : 0, scheduled ? targetMicroseconds : 0,
+                                        pings);
+        cout << (scheduled ? "scheduled" : "unscheduled") << ',' << roundTrips[roundTrips.size() / 2] << ','
+             << roundTrips[roundTrips.size() * 99 / 100] << endl;
+    }
+    return 0;
+}
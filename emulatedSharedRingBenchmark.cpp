@@ -0,0 +1,129 @@
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include "tcpWrapper.h"
+#include "SharedInboundRing.h"
+
+using namespace std;
+
+static const size_t RING_SIZE = 64 * 1024; // small, so the writers wrap around many times
+static const size_t HEADER = 2 * sizeof(uint64_t);
+
+/// The payload of a writer's seq-th message: its sequence number, its connection id and a pattern of varying length
+static size_t payloadSize(uint64_t seq) {
+    return HEADER + (seq * 997) % (RING_SIZE / 8);
+}
+
+static uint8_t patternAt(uint64_t seq, size_t pos) {
+    return static_cast<uint8_t>(seq + pos);
+}
+
+// Several clients write into one shared ring concurrently on the software verbs emulator, the server checks that every
+// message arrives complete, in order per client and with the id of the client that sent it
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        cout << "Usage: " << argv[0] << " <Port> [Writers] [Messages per writer]" << endl;
+        return -1;
+    }
+    const auto port = ::atoi(argv[1]);
+    const size_t writers = argc > 2 ? stoul(argv[2]) : 4;
+    const size_t messages = argc > 3 ? stoul(argv[3]) : 1024;
+    setenv("RDMA_BACKEND", "emulated", 1);
+
+    sockaddr_in addr;
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    auto sock = tcp_socket();
+    tcp_bind(sock, addr);
+    listen(sock, SOMAXCONN);
+
+    size_t bytes = 0;
+    chrono::steady_clock::time_point start;
+    thread server([&] {
+        SharedInboundRing ring(RING_SIZE);
+        vector<int> accepted;
+        for (size_t i = 0; i < writers; ++i) {
+            sockaddr_in inAddr;
+            accepted.push_back(tcp_accept(sock, inAddr));
+            ring.accept(accepted.back());
+        }
+
+        start = chrono::steady_clock::now();
+        vector<uint64_t> expected(writers, 0);
+        for (size_t i = 0; i < writers * messages; ++i) {
+            const auto message = ring.receive();
+            uint64_t seq, id;
+            memcpy(&seq, message.data.data(), sizeof(seq));
+            memcpy(&id, message.data.data() + sizeof(seq), sizeof(id));
+            if (id != message.connection || id >= writers) {
+                throw runtime_error{"message of writer " + to_string(id) + " tagged with " +
+                                    to_string(message.connection)};
+            }
+            if (seq != expected[id]++) {
+                throw runtime_error{"writer " + to_string(id) + " sent " + to_string(seq) + " out of order"};
+            }
+            if (message.data.size() != payloadSize(seq)) {
+                throw runtime_error{"message has wrong size!"};
+            }
+            for (size_t pos = HEADER; pos < message.data.size(); ++pos) {
+                if (message.data[pos] != patternAt(seq, pos)) {
+                    throw runtime_error{"message " + to_string(seq) + " of writer " + to_string(id) + " corrupted"};
+                }
+            }
+            bytes += message.data.size();
+        }
+
+        // Tell the clients everything arrived, destroying their queue pairs earlier drops writes in flight
+        for (auto acced : accepted) {
+            char done = 0;
+            tcp_write(acced, &done, sizeof(done));
+        }
+        for (auto acced : accepted) {
+            close(acced);
+        }
+    });
+
+    vector<thread> clients;
+    for (size_t i = 0; i < writers; ++i) {
+        clients.emplace_back([&] {
+            auto client = tcp_socket();
+            tcp_connect(client, addr);
+            SharedInboundRingSender sender(client);
+
+            vector<uint8_t> payload;
+            const uint64_t id = sender.getConnectionId();
+            for (uint64_t seq = 0; seq < messages; ++seq) {
+                payload.resize(payloadSize(seq));
+                memcpy(payload.data(), &seq, sizeof(seq));
+                memcpy(payload.data() + sizeof(seq), &id, sizeof(id));
+                for (size_t pos = HEADER; pos < payload.size(); ++pos) {
+                    payload[pos] = patternAt(seq, pos);
+                }
+                sender.send(payload.data(), payload.size());
+            }
+
+            char done;
+            tcp_read(client, &done, sizeof(done));
+            close(client);
+        });
+    }
+
+    for (auto &client : clients) {
+        client.join();
+    }
+    server.join();
+    const auto sTaken = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << writers << " writers sent " << writers * messages << " messages (" << bytes / RING_SIZE
+         << " ring wraparounds) in " << sTaken * 1000 << "ms" << endl;
+    cout << writers * messages / sTaken << " msg/s, " << bytes / sTaken / 1024 / 1024 << " MB/s" << endl;
+    close(sock);
+    return 0;
+}
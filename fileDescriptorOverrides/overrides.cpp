@@ -1,28 +1,223 @@
 #include <iostream>
+#include <limits>
 #include <map>
 #include <arpa/inet.h>
+#include <cerrno>
 #include <cstdarg>
 #include <fcntl.h>
+#include <malloc.h>
+#include <mutex>
 #include <set>
+#include <sstream>
+#include <unordered_set>
+#include <sys/mman.h>
 
 #include "rdma_tests/RDMAMessageBuffer.h"
+#include "rdma_tests/RDMASendReceiveTransport.h"
+#include "rdma_tests/DatagramTransport.h"
+#include "rdma_tests/SharedMemoryTransport.h"
+#include "rdma_tests/StripedMessageBuffer.h"
+#include "rdma_tests/PriorityMessageBuffer.h"
+#include "rdma_tests/StreamMultiplexer.h"
+#include "rdma_tests/DoorbellMap.h"
+#include "rdma_tests/ProgressEngine.h"
+#include "rdma_tests/tcpWrapper.h"
+#include "rdma_tests/Tuning.h"
+#include "rdma_tests/rdma/RegistrationCache.hpp"
 #include "realFunctions.h"
 #include "overrides.h"
 
 namespace {
 // unordered_map does not like to be 0 initialized, so we can't use it here
-    std::map<int, std::unique_ptr<RDMAMessageBuffer>> bridge;
+    std::map<int, std::unique_ptr<MessageTransport>> bridge;
+    // The connections of bridge watched by the progress engine
+    std::map<int, std::shared_ptr<ProgressEngine::Connection>> progressed;
     std::set<int> rdmableSockets;
+    // The rdmableSockets we got from accept(), they take the passive side when connecting through the connection manager
+    std::set<int> acceptedSockets;
     bool dontCloseRDMA = true; // as long as we can't get rid of the RDMA deallocation errors, don't ever close RDMA connections
     size_t forkGeneration = 0;
 
-    const size_t BUFFER_SIZE = 128 * 1024;
+    const size_t BUFFER_SIZE = Tuning::get().ringSize;
+    const size_t ZERO_COPY_THRESHOLD = 32 * 1024; // larger messages are sent from the application's memory directly
 
     auto getRdmaEnv() {
         static const auto rdmaReachable = getenv("USE_RDMA");
         return rdmaReachable;
     }
 
+    // Registrations of application memory get stale when the memory is unmapped or its pages are dropped. We see the
+    // application's munmap(), mremap(), madvise() and malloc_trim() calls, but not glibc's internal ones when it hands
+    // freed memory back to the kernel: trimming the main heap, unmapping large chunks and shrinking the heaps of
+    // further arenas with MADV_DONTNEED. So keep everything in the main heap, and that one mapped. That serializes
+    // malloc() on a single arena and never returns freed memory, so only RDMA_ZERO_COPY=1 sends from application memory
+    const bool keepHeapMapped = getRdmaEnv() != nullptr && getenv("RDMA_ZERO_COPY") != nullptr &&
+                                mallopt(M_MMAP_MAX, 0) && mallopt(M_TRIM_THRESHOLD, -1) && mallopt(M_ARENA_MAX, 1);
+
+    // Both sides tell each other which transport they prefer and use the later one in this list, so selecting a
+    // transport on one side is enough
+    enum class Transport : uint8_t {
+        Ring,
+        Prioritized,
+        Striped,
+        Multiplexed,
+        SendReceive,
+        Datagram,
+        SharedMemory
+    };
+
+    // Both ends of the socket are on this host: the peer is a loopback address or one of our own addresses
+    bool isSameHost(int fd) {
+        sockaddr_in local{}, peer{};
+        socklen_t localLength = sizeof(local), peerLength = sizeof(peer);
+        if (getsockname(fd, reinterpret_cast<sockaddr *>(&local), &localLength) != 0 ||
+            getpeername(fd, reinterpret_cast<sockaddr *>(&peer), &peerLength) != 0 ||
+            local.sin_family != AF_INET || peer.sin_family != AF_INET) {
+            return false;
+        }
+        const bool loopback = (ntohl(peer.sin_addr.s_addr) >> 24) == 127;
+        return loopback || local.sin_addr.s_addr == peer.sin_addr.s_addr;
+    }
+
+    // Connections within this host use shared memory, if allowed. Otherwise RDMA_TRANSPORT=priority|stripe|multiplex|
+    // sendrecv|ud selects the transport of all connections, RDMA_UD_PEERS=<ip>,<ip>,... unreliable datagrams for the
+    // connections to the given peers only
+    Transport preferredTransport(int fd, bool allowSharedMemory) {
+        // RDMA_SHM=0 sends connections on the same host through the HCA anyway
+        static const auto sharedMemory = getenv("RDMA_SHM");
+        if (allowSharedMemory && (sharedMemory == nullptr || std::string(sharedMemory) != "0") && isSameHost(fd)) {
+            return Transport::SharedMemory;
+        }
+
+        static const auto datagramPeers = getenv("RDMA_UD_PEERS");
+        if (datagramPeers != nullptr) {
+            sockaddr_in peer{};
+            socklen_t length = sizeof(peer);
+            char address[INET_ADDRSTRLEN] = {};
+            if (getpeername(fd, reinterpret_cast<sockaddr *>(&peer), &length) == 0 && peer.sin_family == AF_INET &&
+                inet_ntop(AF_INET, &peer.sin_addr, address, sizeof(address)) != nullptr) {
+                std::stringstream peers(datagramPeers);
+                std::string candidate;
+                while (std::getline(peers, candidate, ',')) {
+                    if (candidate == address) {
+                        return Transport::Datagram;
+                    }
+                }
+            }
+        }
+
+        static const auto transport = getenv("RDMA_TRANSPORT");
+        if (transport != nullptr && std::string(transport) == "ud") {
+            return Transport::Datagram;
+        }
+        if (transport != nullptr && std::string(transport) == "sendrecv") {
+            return Transport::SendReceive;
+        }
+        if (transport != nullptr && std::string(transport) == "multiplex") {
+            return Transport::Multiplexed;
+        }
+        if (transport != nullptr && std::string(transport) == "stripe") {
+            return Transport::Striped;
+        }
+        if (transport != nullptr && std::string(transport) == "priority") {
+            return Transport::Prioritized;
+        }
+        return Transport::Ring;
+    }
+
+    // What each side tells the other one before connecting
+    struct Preference {
+        Transport transport;
+        // Whether the ring is set up through the RDMA connection manager, only if both sides want it
+        bool connectionManager;
+        // The ring size of our tuning, each side writes into the other one's rings, so both use the larger one
+        uint64_t ringSize;
+    };
+
+    std::unique_ptr<MessageTransport> makeBridge(int fd) {
+        tcp_setBlocking(fd); // just set the socket to block for our setup.
+        // RDMA_CM=1 connects rings through the RDMA connection manager instead of exchanging their keys over the socket
+        static const bool connectionManager = getenv("RDMA_CM") != nullptr && rdma::ConnectionManager::available();
+        const bool accepted = acceptedSockets.erase(fd) != 0;
+        if (connectionManager && accepted) {
+            rdma::ConnectionManager::shared(); // listen before the remote side can send its request
+        }
+        Preference preference{preferredTransport(fd, true), connectionManager, BUFFER_SIZE};
+        Preference remotePreference{};
+        tcp_write(fd, &preference, sizeof(preference));
+        tcp_read(fd, &remotePreference, sizeof(remotePreference));
+        const size_t ringSize = std::max<size_t>(preference.ringSize, remotePreference.ringSize);
+        if (std::max(preference.transport, remotePreference.transport) == Transport::SharedMemory) {
+            try {
+                return std::make_unique<SharedMemoryTransport>(ringSize, fd);
+            } catch (const SharedMemoryTransport::Unavailable &) {
+                // Both sides failed together (e.g. a shared network namespace, but separate PID namespaces), agree on
+                // the transport they would use between hosts
+                preference.transport = preferredTransport(fd, false);
+                tcp_write(fd, &preference, sizeof(preference));
+                tcp_read(fd, &remotePreference, sizeof(remotePreference));
+            }
+        }
+        switch (std::max(preference.transport, remotePreference.transport)) {
+            case Transport::Datagram:
+                return std::make_unique<DatagramTransport>(fd);
+            case Transport::SendReceive:
+                return std::make_unique<RDMASendReceiveTransport>(fd);
+            case Transport::Multiplexed:
+                return StreamMultiplexer::openStream(fd);
+            case Transport::Striped:
+                return std::make_unique<StripedMessageBuffer>(ringSize, fd);
+            case Transport::Prioritized:
+                return std::make_unique<PriorityMessageBuffer>(ringSize, fd);
+            case Transport::SharedMemory: // not after falling back
+            case Transport::Ring:
+                break;
+        }
+        std::unique_ptr<RDMAMessageBuffer> buffer;
+        if (preference.connectionManager && remotePreference.connectionManager) {
+            const auto rendezvous = rdma::ConnectionManager::Rendezvous::fromSocket(
+                    fd, accepted, rdma::ConnectionManager::sharedPort());
+            buffer = std::make_unique<RDMAMessageBuffer>(ringSize, rdma::ConnectionManager::shared(), rendezvous);
+        } else {
+            buffer = std::make_unique<RDMAMessageBuffer>(ringSize, fd);
+        }
+        if (keepHeapMapped) {
+            buffer->setZeroCopyThreshold(ZERO_COPY_THRESHOLD);
+        }
+        // RDMA_SHARED_SEND=1 for applications writing to the same socket from several threads
+        static const bool sharedSend = getenv("RDMA_SHARED_SEND") != nullptr;
+        if (sharedSend) {
+            buffer->setMultiProducer();
+        }
+        return buffer;
+    }
+
+    void openBridge(int fd) {
+        bridge[fd] = makeBridge(fd);
+        if (ProgressEngine::enabled() && bridge[fd]->supportsConcurrentHasData()) {
+            progressed[fd] = ProgressEngine::shared().add(fd, *bridge[fd]);
+        }
+    }
+
+    // The bridge of the socket, if it has an urgent lane
+    PriorityMessageBuffer *urgentLanes(int fd) {
+        auto found = bridge.find(fd);
+        return found != bridge.end() ? dynamic_cast<PriorityMessageBuffer *>(found->second.get()) : nullptr;
+    }
+
+    void invalidateRegistrations(void *address, size_t length) {
+        // Deregistering may unmap memory itself
+        static thread_local bool invalidating = false;
+        if (invalidating || not RDMANetworking::hasSharedNetwork()) {
+            return;
+        }
+        invalidating = true;
+        for (auto network : RDMANetworking::rails()) {
+            network->getRegistrationCache().invalidate(address, length);
+        }
+        invalidating = false;
+    }
+
     auto getForkGenIntercept() {
         static const auto forkGenChars = getenv("RDMA_FORKGEN");
         static const auto forkGen = forkGenChars ? std::stoul(std::string(forkGenChars)) : 0;
@@ -112,6 +307,7 @@ int accept(int server_socket, sockaddr *address, socklen_t *length) {
     }
 
     rdmableSockets.insert(client_socket);
+    acceptedSockets.insert(client_socket);
     return client_socket;
 }
 
@@ -133,6 +329,7 @@ int connect(int fd, const sockaddr *address, socklen_t length) {
     }
 
     rdmableSockets.insert(fd);
+    acceptedSockets.erase(fd); // in case an accepted socket with this number was closed without being used
     return SUCCESS;
 }
 
@@ -145,7 +342,7 @@ ssize_t write(int fd, const void *source, size_t requested_bytes) {
         // When dealing with the accept then fork pattern, delay the actual RDMA connection to the child process
         rdmableSockets.find(fd) != rdmableSockets.end()) {
         rdmableSockets.erase(rdmableSockets.find(fd));
-        bridge[fd] = std::make_unique<RDMAMessageBuffer>(BUFFER_SIZE, fd);
+        openBridge(fd);
         return write(fd, source, requested_bytes);
     }
     return real::write(fd, source, requested_bytes);
@@ -160,7 +357,7 @@ ssize_t read(int fd, void *destination, size_t requested_bytes) {
         // When dealing with the accept then fork pattern, delay the actual RDMA connection to the child process
         rdmableSockets.find(fd) != rdmableSockets.end()) {
         rdmableSockets.erase(rdmableSockets.find(fd));
-        bridge[fd] = std::make_unique<RDMAMessageBuffer>(BUFFER_SIZE, fd);
+        openBridge(fd);
         return read(fd, destination, requested_bytes);
     }
     return real::read(fd, destination, requested_bytes);
@@ -168,6 +365,11 @@ ssize_t read(int fd, void *destination, size_t requested_bytes) {
 
 int close(int fd) {
     if (not dontCloseRDMA) {
+        auto watched = progressed.find(fd);
+        if (watched != progressed.end()) {
+            ProgressEngine::shared().remove(watched->second);
+            progressed.erase(watched);
+        }
         bridge.erase(fd);
     }
 
@@ -175,6 +377,12 @@ int close(int fd) {
 }
 
 ssize_t send(int fd, const void *buffer, size_t length, int flags) {
+    // Out-of-band data goes through the urgent lane, past the messages still waiting in the bulk lane
+    auto prioritized = urgentLanes(fd);
+    if (prioritized != nullptr && (flags & ~MSG_NOSIGNAL) == MSG_OOB) {
+        prioritized->send(reinterpret_cast<const uint8_t *>(buffer), length, PriorityMessageBuffer::Priority::Urgent);
+        return length;
+    }
 // For now: We forward the call to write for a certain set of
 // flags, which we chose to ignore. By putting them here explicitly,
 // we make sure that we only ignore flags, which are not important.
@@ -192,6 +400,15 @@ ssize_t send(int fd, const void *buffer, size_t length, int flags) {
 }
 
 ssize_t recv(int fd, void *buffer, size_t length, int flags) {
+    auto prioritized = urgentLanes(fd);
+    if (prioritized != nullptr && flags == MSG_OOB) {
+        // Like TCP, reading out-of-band data that isn't there fails instead of waiting for it
+        if (not prioritized->hasData(PriorityMessageBuffer::Priority::Urgent)) {
+            errno = EINVAL;
+            return -1;
+        }
+        return prioritized->receive(buffer, length, PriorityMessageBuffer::Priority::Urgent);
+    }
 #ifdef __APPLE__
     if (flags == 0) {
 #else
@@ -263,6 +480,37 @@ pid_t fork(void) {
     return res;
 }
 
+int munmap(void *address, size_t length) __THROW {
+    invalidateRegistrations(address, length);
+    return real::munmap(address, length);
+}
+
+void *mremap(void *old_address, size_t old_size, size_t new_size, int flags, ...) __THROW {
+    void *new_address = nullptr;
+    if (flags & MREMAP_FIXED) {
+        va_list argument;
+        va_start(argument, flags);
+        new_address = va_arg(argument, void *);
+        va_end(argument);
+    }
+    invalidateRegistrations(old_address, old_size);
+    return real::mremap(old_address, old_size, new_size, flags, new_address);
+}
+
+int madvise(void *address, size_t length, int advice) __THROW {
+    // The pinned pages stay registered, while the next access maps fresh ones
+    if (advice == MADV_DONTNEED || advice == MADV_FREE || advice == MADV_REMOVE) {
+        invalidateRegistrations(address, length);
+    }
+    return real::madvise(address, length, advice);
+}
+
+int malloc_trim(size_t pad) __THROW {
+    // Releases free pages anywhere in the heap
+    invalidateRegistrations(nullptr, std::numeric_limits<size_t>::max());
+    return real::malloc_trim(pad);
+}
+
 int poll(struct pollfd *fds, nfds_t nfds, int timeout) {
     const auto start = std::chrono::steady_clock::now();
     if (nfds == 0) return 0;
@@ -280,11 +528,55 @@ int poll(struct pollfd *fds, nfds_t nfds, int timeout) {
     if (rdma_fds.size() == 0) {
         event_count = real::poll(fds, nfds, timeout);
     } else if (normal_fds.size() == 0) {
+        // Connections whose doorbell rang, until they ran out of data. Shared, as any thread may collect a ring
+        static std::mutex ringingGuard;
+        static std::unordered_set<int64_t> ringing;
+        // Connections the progress engine reported as ready to this thread, until they ran out of data
+        static thread_local std::unordered_set<int> ready;
+        auto &doorbells = DoorbellMap::shared();
+        auto readiness = progressed.empty() ? nullptr : &ProgressEngine::queueForThread();
         do {
-            // Do a full loop over all FDs
+            {
+                std::lock_guard<std::mutex> lock(ringingGuard);
+                doorbells.collect([](uint32_t slot) { ringing.insert(slot); });
+            }
+            const bool lostReadiness = readiness != nullptr && readiness->drain([](int fd) { ready.insert(fd); });
             for (auto &i : rdma_fds) {
                 auto &msgBuf = bridge[fds[i].fd];
-                if (msgBuf->hasData()) {
+                const auto doorbell = msgBuf->getDoorbell();
+                const auto watched = progressed.find(fds[i].fd);
+                bool hasData = false;
+                if (watched != progressed.end()) {
+                    auto &connection = *watched->second;
+                    // Publish the queue before checking ready, so either we or the poller sees the other's store
+                    const bool newWaiter = connection.waiter.load() != readiness;
+                    if (newWaiter) {
+                        connection.waiter.store(readiness);
+                    }
+                    if ((newWaiter || lostReadiness) && connection.ready.load()) {
+                        ready.insert(fds[i].fd);
+                    }
+                    if (ready.count(fds[i].fd) != 0) {
+                        hasData = msgBuf->hasData();
+                        if (not hasData) {
+                            // The poller watches it again from now on
+                            ready.erase(fds[i].fd);
+                            connection.ready.store(false);
+                        }
+                    }
+                } else if (doorbell < 0) {
+                    hasData = msgBuf->hasData();
+                } else {
+                    // Held across hasData(), so a ring another thread collects meanwhile isn't erased with this one
+                    std::lock_guard<std::mutex> lock(ringingGuard);
+                    if (ringing.count(doorbell) != 0) {
+                        hasData = msgBuf->hasData();
+                        if (not hasData) {
+                            ringing.erase(doorbell);
+                        }
+                    }
+                }
+                if (hasData) {
                     auto inFlag = fds[i].events & POLLIN;
                     if (inFlag != 0) ++event_count;
                     fds[i].revents |= inFlag;
@@ -47,6 +47,10 @@ int setsockopt(int fd, int level, int option_name, const void *option_value, soc
 int fcntl(int fd, int command, ...);
 
 int select(int nfds, fd_set *readfds, fd_set *writefds, fd_set *errorfds, struct timeval *timeout);
+
+int munmap(void *address, size_t length) __THROW;
+
+void *mremap(void *old_address, size_t old_size, size_t new_size, int flags, ...) __THROW;
 }
 
 #pragma GCC visibility pop
@@ -96,3 +96,24 @@ int ::real::fcntl_get_flags(int fd, int command) {
     using real_fcntl_t = int (*)(int, int, ...);
     return reinterpret_cast<real_fcntl_t>(dlsym(RTLD_NEXT, "fcntl"))(fd, command);
 }
+
+int ::real::munmap(void *address, size_t length) {
+    using real_munmap_t = int (*)(void *, size_t);
+    return reinterpret_cast<real_munmap_t>(dlsym(RTLD_NEXT, "munmap"))(address, length);
+}
+
+void *::real::mremap(void *oldAddress, size_t oldSize, size_t newSize, int flags, void *newAddress) {
+    using real_mremap_t = void *(*)(void *, size_t, size_t, int, ...);
+    return reinterpret_cast<real_mremap_t>(dlsym(RTLD_NEXT, "mremap"))(oldAddress, oldSize, newSize, flags,
+                                                                        newAddress);
+}
+
+int ::real::madvise(void *address, size_t length, int advice) {
+    using real_madvise_t = int (*)(void *, size_t, int);
+    return reinterpret_cast<real_madvise_t>(dlsym(RTLD_NEXT, "madvise"))(address, length, advice);
+}
+
+int ::real::malloc_trim(size_t pad) {
+    using real_malloc_trim_t = int (*)(size_t);
+    return reinterpret_cast<real_malloc_trim_t>(dlsym(RTLD_NEXT, "malloc_trim"))(pad);
+}
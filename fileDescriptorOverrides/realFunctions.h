@@ -44,6 +44,14 @@ namespace real {
     int select(int nfds, fd_set *readfds, fd_set *writefds, fd_set *errorfds, struct timeval *timeout);
 
     pid_t fork();
+
+    int munmap(void *address, size_t length);
+
+    void *mremap(void *oldAddress, size_t oldSize, size_t newSize, int flags, void *newAddress);
+
+    int madvise(void *address, size_t length, int advice);
+
+    int malloc_trim(size_t pad);
 }
 
 #endif //REALFUNCTIONS_H
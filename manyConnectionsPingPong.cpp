@@ -0,0 +1,103 @@
+#include <array>
+#include <iostream>
+#include <memory>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+#include "tcpWrapper.h"
+#include "RDMAMessageBuffer.h"
+#include "DatagramTransport.h"
+
+using namespace std;
+
+/// Ping pong over many connections at once, to compare reliable connections (one queue pair per connection) with
+/// unreliable datagrams (one queue pair per thread). Every connection needs a file descriptor during its setup, so
+/// raise the limit (ulimit -n) for large connection counts.
+static unique_ptr<MessageTransport> makeTransport(bool datagrams, int sock) {
+    static const size_t BUFFERSIZE = 1024 * 4; // 4K
+    if (datagrams) {
+        return make_unique<DatagramTransport>(sock);
+    }
+    return make_unique<RDMAMessageBuffer>(BUFFERSIZE, sock);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 5 || (argv[1][0] == 'c' && argc < 6)) {
+        cout << "Usage: " << argv[0] << " <client / server> <rc / ud> <Connections> <Port> [IP (if client)]" << endl;
+        return -1;
+    }
+    const auto isClient = argv[1][0] == 'c';
+    const auto datagrams = string(argv[2]) == "ud";
+    const auto connections = static_cast<size_t>(::atoi(argv[3]));
+    const auto port = ::atoi(argv[4]);
+
+    static const size_t MESSAGES = 1024 * 1024;
+    const size_t rounds = max<size_t>(MESSAGES / connections, 1);
+
+    vector<unique_ptr<MessageTransport>> transports;
+    if (isClient) {
+        sockaddr_in addr;
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        inet_pton(AF_INET, argv[5], &addr.sin_addr);
+
+        const auto setupStart = chrono::steady_clock::now();
+        for (size_t i = 0; i < connections; ++i) {
+            auto sock = tcp_socket();
+            tcp_connect(sock, addr);
+            transports.push_back(makeTransport(datagrams, sock));
+            close(sock); // the RDMA connection doesn't need it anymore
+        }
+        const auto setupEnd = chrono::steady_clock::now();
+        cout << connections << " connections set up in "
+             << chrono::duration<double, milli>(setupEnd - setupStart).count() << "ms" << endl;
+
+        auto sendData = array<uint8_t, 64>{"0123456789@ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz"};
+        const auto start = chrono::steady_clock::now();
+        for (size_t round = 0; round < rounds; ++round) {
+            for (auto &transport : transports) {
+                transport->send(sendData.data(), sendData.size());
+            }
+            for (auto &transport : transports) {
+                auto answer = transport->receive();
+                if (answer.size() != sendData.size() || not equal(answer.begin(), answer.end(), sendData.begin())) {
+                    throw runtime_error{"received " + string(answer.begin(), answer.end())};
+                }
+            }
+        }
+        const auto end = chrono::steady_clock::now();
+        const auto msTaken = chrono::duration<double, milli>(end - start).count();
+        const auto sTaken = msTaken / 1000;
+        cout << rounds * connections << " " << sendData.size() << "B messages exchanged over " << connections << " "
+             << (datagrams ? "UD" : "RC") << " connections in " << msTaken << "ms" << endl;
+        cout << rounds * connections / sTaken << " msg/s" << endl;
+    } else {
+        sockaddr_in addr;
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = INADDR_ANY;
+
+        auto sock = tcp_socket();
+        tcp_bind(sock, addr);
+        listen(sock, SOMAXCONN);
+        sockaddr_in inAddr;
+
+        for (size_t i = 0; i < connections; ++i) {
+            auto acced = tcp_accept(sock, inAddr);
+            transports.push_back(makeTransport(datagrams, acced));
+            close(acced);
+        }
+
+        for (size_t round = 0; round < rounds; ++round) {
+            for (auto &transport : transports) {
+                auto ping = transport->receive();
+                transport->send(ping.data(), ping.size());
+            }
+        }
+
+        close(sock);
+    }
+    return 0;
+}
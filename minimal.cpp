@@ -23,12 +23,11 @@ int main(int argc, char **argv) {
 
     cout << "network.getLID() = " << network.getLID() << endl;
     cout << "queuePairs[i]->getQPN() = " << queuePair.getQPN() << endl;
+    cout << "queuePairs[i]->getAddress().psn = " << queuePair.getAddress().psn << endl;
 
-    cout << "enter qpn:" << endl;
-    uint16_t qpn;
-    cin >> qpn;
-
-    Address address{network.getLID(), qpn};
+    cout << "enter qpn and psn:" << endl;
+    Address address = queuePair.getAddress(); // The remote side runs on the same host
+    cin >> address.qpn >> address.psn;
     queuePair.connect(address);
 
     if (isClient) {
@@ -0,0 +1,32 @@
+#include "AddressHandle.hpp"
+#include "Backend.hpp"
+#include "Network.hpp"
+//---------------------------------------------------------------------------
+#include <infiniband/verbs.h>
+#include <cstring>
+#include <iostream>
+//---------------------------------------------------------------------------
+using namespace std;
+//---------------------------------------------------------------------------
+namespace rdma {
+//---------------------------------------------------------------------------
+    AddressHandle::AddressHandle(Network &network, const Address &address) {
+        struct ibv_ah_attr attributes{};
+        network.setRoute(attributes, address);
+        handle = Backend::get().createAh(network.protectionDomain, &attributes);
+        if (handle == nullptr) {
+            string reason = "creating the address handle failed with error " + to_string(errno) + ": " + strerror(errno);
+            cerr << reason << endl;
+            throw NetworkException(reason);
+        }
+    }
+
+//---------------------------------------------------------------------------
+    AddressHandle::~AddressHandle() {
+        if (Backend::get().destroyAh(handle) != 0) {
+            cerr << "destroying the address handle failed with error " << errno << ": " << strerror(errno) << endl;
+        }
+    }
+//---------------------------------------------------------------------------
+} // End of namespace rdma
+//---------------------------------------------------------------------------
@@ -0,0 +1,33 @@
+#pragma once
+//---------------------------------------------------------------------------
+#include <cstdint>
+//---------------------------------------------------------------------------
+struct ibv_ah;
+//---------------------------------------------------------------------------
+namespace rdma {
+//---------------------------------------------------------------------------
+    class Network;
+
+    struct Address;
+
+//---------------------------------------------------------------------------
+/// The route to a remote port, needed to send datagrams to the queue pairs there
+class AddressHandle {
+    ibv_ah *handle;
+
+public:
+    /// Constructor
+    AddressHandle(Network &network, const Address &address);
+
+    /// Destructor
+    ~AddressHandle();
+
+    ibv_ah *getHandle() const { return handle; }
+
+    AddressHandle(AddressHandle const &) = delete;
+
+    AddressHandle &operator=(AddressHandle const &) = delete;
+};
+//---------------------------------------------------------------------------
+} // End of namespace rdma
+//---------------------------------------------------------------------------
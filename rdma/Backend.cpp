@@ -0,0 +1,41 @@
+#include "Backend.hpp"
+#include "EmulatedBackend.hpp"
+#include "VerbsBackend.hpp"
+//---------------------------------------------------------------------------
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+//---------------------------------------------------------------------------
+using namespace std;
+//---------------------------------------------------------------------------
+namespace rdma {
+//---------------------------------------------------------------------------
+static unique_ptr<Backend> createBackend()
+{
+   const char *name = getenv("RDMA_BACKEND");
+   if (name == nullptr || strcmp(name, "verbs") == 0) {
+      return unique_ptr<Backend>(new VerbsBackend());
+   }
+   if (strcmp(name, "emulated") == 0) {
+      const char *latency = getenv("RDMA_EMULATED_LATENCY_NS");
+      const char *gigabits = getenv("RDMA_EMULATED_GBITS");
+      const char *ports = getenv("RDMA_EMULATED_PORTS");
+      const char *queuePairGigabits = getenv("RDMA_EMULATED_QP_GBITS");
+      return unique_ptr<Backend>(new EmulatedBackend(chrono::nanoseconds(latency ? atol(latency) : 1000),
+                                                     gigabits ? atof(gigabits) : 100,
+                                                     static_cast<uint8_t>(ports ? atoi(ports) : 1),
+                                                     queuePairGigabits ? atof(queuePairGigabits) : 0));
+   }
+   cerr << "unknown RDMA_BACKEND " << name << ", using verbs" << endl;
+   return unique_ptr<Backend>(new VerbsBackend());
+}
+//---------------------------------------------------------------------------
+Backend &Backend::get()
+{
+   static unique_ptr<Backend> backend = createBackend();
+   return *backend;
+}
+//---------------------------------------------------------------------------
+} // End of namespace rdma
+//---------------------------------------------------------------------------
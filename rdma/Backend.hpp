@@ -0,0 +1,97 @@
+#pragma once
+//---------------------------------------------------------------------------
+#include <cstddef>
+#include <cstdint>
+//---------------------------------------------------------------------------
+struct ibv_ah;
+struct ibv_ah_attr;
+struct ibv_comp_channel;
+struct ibv_context;
+struct ibv_cq;
+struct ibv_device;
+struct ibv_device_attr;
+struct ibv_mr;
+struct ibv_pd;
+struct ibv_port_attr;
+struct ibv_qp;
+struct ibv_qp_attr;
+struct ibv_qp_init_attr;
+struct ibv_recv_wr;
+struct ibv_send_wr;
+struct ibv_srq;
+struct ibv_srq_init_attr;
+struct ibv_wc;
+union ibv_gid;
+//---------------------------------------------------------------------------
+namespace rdma {
+//---------------------------------------------------------------------------
+/// The verbs the wrapper classes use, so they can run on something else than libibverbs. Same signatures and return
+/// values as the ibv_* functions of the same name
+    class Backend {
+    public:
+        virtual ~Backend() = default;
+
+        /// The backend of this process: libibverbs, or the EmulatedBackend with RDMA_BACKEND=emulated
+        static Backend &get();
+
+        virtual ibv_device **getDeviceList(int *count) = 0;
+
+        virtual void freeDeviceList(ibv_device **devices) = 0;
+
+        virtual ibv_context *openDevice(ibv_device *device) = 0;
+
+        virtual int closeDevice(ibv_context *context) = 0;
+
+        virtual int queryDevice(ibv_context *context, ibv_device_attr *attributes) = 0;
+
+        virtual int queryPort(ibv_context *context, uint8_t port, ibv_port_attr *attributes) = 0;
+
+        virtual int queryGid(ibv_context *context, uint8_t port, int index, ibv_gid *gid) = 0;
+
+        virtual ibv_pd *allocPd(ibv_context *context) = 0;
+
+        virtual int deallocPd(ibv_pd *protectionDomain) = 0;
+
+        virtual ibv_mr *regMr(ibv_pd *protectionDomain, void *address, size_t length, int access) = 0;
+
+        virtual int deregMr(ibv_mr *memoryRegion) = 0;
+
+        virtual ibv_comp_channel *createCompChannel(ibv_context *context) = 0;
+
+        virtual int destroyCompChannel(ibv_comp_channel *channel) = 0;
+
+        virtual ibv_cq *createCq(ibv_context *context, int entries, ibv_comp_channel *channel) = 0;
+
+        virtual int destroyCq(ibv_cq *completionQueue) = 0;
+
+        virtual int reqNotifyCq(ibv_cq *completionQueue, int solicitedOnly) = 0;
+
+        virtual int getCqEvent(ibv_comp_channel *channel, ibv_cq **completionQueue, void **context) = 0;
+
+        virtual void ackCqEvents(ibv_cq *completionQueue, unsigned count) = 0;
+
+        virtual int pollCq(ibv_cq *completionQueue, int entries, ibv_wc *completions) = 0;
+
+        virtual ibv_srq *createSrq(ibv_pd *protectionDomain, ibv_srq_init_attr *attributes) = 0;
+
+        virtual int destroySrq(ibv_srq *receiveQueue) = 0;
+
+        virtual int postSrqRecv(ibv_srq *receiveQueue, ibv_recv_wr *workRequests, ibv_recv_wr **badWorkRequest) = 0;
+
+        virtual ibv_qp *createQp(ibv_pd *protectionDomain, ibv_qp_init_attr *attributes) = 0;
+
+        virtual int destroyQp(ibv_qp *queuePair) = 0;
+
+        virtual int modifyQp(ibv_qp *queuePair, ibv_qp_attr *attributes, int mask) = 0;
+
+        virtual int queryQp(ibv_qp *queuePair, ibv_qp_attr *attributes, int mask, ibv_qp_init_attr *initAttributes) = 0;
+
+        virtual int postSend(ibv_qp *queuePair, ibv_send_wr *workRequests, ibv_send_wr **badWorkRequest) = 0;
+
+        virtual ibv_ah *createAh(ibv_pd *protectionDomain, ibv_ah_attr *attributes) = 0;
+
+        virtual int destroyAh(ibv_ah *addressHandle) = 0;
+    };
+//---------------------------------------------------------------------------
+} // End of namespace rdma
+//---------------------------------------------------------------------------
@@ -19,13 +19,16 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 // ---------------------------------------------------------------------------
 #include "CompletionQueuePair.hpp"
+#include "Backend.hpp"
 #include "WorkRequest.hpp"
 #include "Network.hpp"
 //---------------------------------------------------------------------------
 #include <infiniband/verbs.h>
 #include <cstring>
+#include <algorithm>
 #include <iostream>
 #include <iomanip>
+#include <limits>
 //---------------------------------------------------------------------------
 using namespace std;
 //---------------------------------------------------------------------------
@@ -68,24 +71,29 @@ string stringForCompletionCode(int opcode)
 //---------------------------------------------------------------------------
 }
 //---------------------------------------------------------------------------
-CompletionQueuePair::CompletionQueuePair(Network &network)
+CompletionQueuePair::CompletionQueuePair(Network &network, int size)
 {
+   if (size < Network::CQ_SIZE) {
+      size = Network::CQ_SIZE;
+   }
+
    // Create event channel
-   channel = ::ibv_create_comp_channel(network.context);
+   channel = Backend::get().createCompChannel(network.context);
    if (channel == nullptr) {
       string reason = "creating the completion channel failed with error " + to_string(errno) + ": " + strerror(errno);
       cerr << reason << endl;
       throw NetworkException(reason);
    }
 
-   // Create completion queues
-   sendQueue = ::ibv_create_cq(network.context, Network::CQ_SIZE, nullptr, channel, 0);
+   // Create completion queues, with their buffers close to the device
+   Network::LocalAllocationScope localAllocation(network);
+   sendQueue = Backend::get().createCq(network.context, size, channel);
    if (sendQueue == nullptr) {
       string reason = "creating the send completion queue failed with error " + to_string(errno) + ": " + strerror(errno);
       cerr << reason << endl;
       throw NetworkException(reason);
    }
-   receiveQueue = ::ibv_create_cq(network.context, Network::CQ_SIZE, nullptr, channel, 0);
+   receiveQueue = Backend::get().createCq(network.context, size, channel);
    if (receiveQueue == nullptr) {
       string reason = "creating the receive completion queue failed with error " + to_string(errno) + ": " + strerror(errno);
       cerr << reason << endl;
@@ -93,13 +101,13 @@ CompletionQueuePair::CompletionQueuePair(Network &network)
    }
 
    // Request notifications
-   int status = ::ibv_req_notify_cq(sendQueue, 0);
+   int status = Backend::get().reqNotifyCq(sendQueue, 0);
    if (status != 0) {
       string reason = "requesting a completion queue event failed with error " + to_string(errno) + ": " + strerror(errno);
       cerr << reason << endl;
       throw NetworkException(reason);
    }
-   status = ::ibv_req_notify_cq(receiveQueue, 0);
+   status = Backend::get().reqNotifyCq(receiveQueue, 0);
    if (status != 0) {
       string reason = "requesting a completion queue event failed with error " + to_string(errno) + ": " + strerror(errno);
       cerr << reason << endl;
@@ -112,13 +120,13 @@ CompletionQueuePair::~CompletionQueuePair()
    int status;
 
    // Destroy the completion queues
-   status = ::ibv_destroy_cq(sendQueue);
+   status = Backend::get().destroyCq(sendQueue);
    if (status != 0) {
       string reason = "destroying the send completion queue failed with error " + to_string(errno) + ": " + strerror(errno);
       cerr << reason << endl;
       throw NetworkException(reason);
    }
-   status = ::ibv_destroy_cq(receiveQueue);
+   status = Backend::get().destroyCq(receiveQueue);
    if (status != 0) {
       string reason = "destroying the receive completion queue failed with error " + to_string(errno) + ": " + strerror(errno);
       cerr << reason << endl;
@@ -126,7 +134,7 @@ CompletionQueuePair::~CompletionQueuePair()
    }
 
    // Destroy the completion channel
-   status = ::ibv_destroy_comp_channel(channel);
+   status = Backend::get().destroyCompChannel(channel);
    if (status != 0) {
       string reason = "destroying the completion channel failed with error " + to_string(errno) + ": " + strerror(errno);
       cerr << reason << endl;
@@ -134,29 +142,68 @@ CompletionQueuePair::~CompletionQueuePair()
    }
 }
 //---------------------------------------------------------------------------
+CompletionRing &CompletionQueuePair::cacheFor(ibv_cq *completionQueue)
+/// The cache of the given completion queue
+{
+   return completionQueue == sendQueue ? sendCompletions : receiveCompletions;
+}
+//---------------------------------------------------------------------------
+void CompletionQueuePair::checkStatus(const CompletionRing::Completion &completion)
+/// Throw if the work request failed
+{
+   if (completion.status != IBV_WC_SUCCESS) {
+      string reason = "unexpected completion status " + to_string(completion.status) + ": " + ibv_wc_status_str(static_cast<ibv_wc_status>(completion.status));
+      cerr << reason << endl;
+      throw NetworkException(reason);
+   }
+}
+//---------------------------------------------------------------------------
+bool CompletionQueuePair::pollBatch(ibv_cq *completionQueue)
+/// Move up to POLL_BATCH work completions into the cache
+{
+   auto &cache = cacheFor(completionQueue);
+   lock_guard<mutex> lock(polling);
+   const int batchSize = min(static_cast<size_t>(POLL_BATCH), cache.freeSlots());
+
+   ibv_wc completions[POLL_BATCH];
+   int count = Backend::get().pollCq(completionQueue, batchSize, completions);
+   if (count < 0) {
+      string reason = "failed to poll completions";
+      cerr << reason << endl;
+      throw NetworkException(reason);
+   }
+
+   // Failed completions are cached as well and reported when taken, so the rest of the batch isn't lost
+   for (int i = 0; i != count; ++i) {
+      cache.push(CompletionRing::Completion{completions[i].wr_id, completions[i].opcode, completions[i].status});
+   }
+   return count > 0;
+}
+//---------------------------------------------------------------------------
+bool CompletionQueuePair::nextCompletion(ibv_cq *completionQueue, CompletionRing::Completion &completion)
+/// Get the next completion, only polls the completion queue when the cache is empty
+{
+   auto &cache = cacheFor(completionQueue);
+   if (cache.pop(completion) || (pollBatch(completionQueue) && cache.pop(completion))) {
+      checkStatus(completion);
+      return true;
+   }
+   return false;
+}
+//---------------------------------------------------------------------------
 uint64_t CompletionQueuePair::pollCompletionQueue(ibv_cq *completionQueue, int type)
 /// Poll a completion queue
 {
-   int status;
-
-   // Poll for a work completion
-   ibv_wc completion;
-   status = ::ibv_poll_cq(completionQueue, 1, &completion);
-   if (status == 0) {
+   CompletionRing::Completion completion;
+   if (!nextCompletion(completionQueue, completion)) {
       return numeric_limits<uint64_t>::max();
    }
 
-   // Check status and opcode
-   if (completion.status == IBV_WC_SUCCESS) {
-      if (completion.opcode == type) {
-         return completion.wr_id;
-      } else {
-         string reason = "unexpected completion opcode (" + stringForCompletionCode(completion.opcode) + ")";
-         cerr << reason << endl;
-         throw NetworkException(reason);
-      }
+   // Check opcode
+   if (completion.opcode == type) {
+      return completion.wrId;
    } else {
-      string reason = "unexpected completion status " + to_string(completion.status) + ": " + ibv_wc_status_str(completion.status);
+      string reason = "unexpected completion opcode (" + stringForCompletionCode(completion.opcode) + ")";
       cerr << reason << endl;
       throw NetworkException(reason);
    }
@@ -171,33 +218,36 @@ pair<bool, uint64_t> CompletionQueuePair::waitForCompletion(bool restricted, boo
    // We have to empty the completion queue and cache additional completions
    // as events are only generated when new work completions are enqueued.
 
-   pair<bool, uint64_t> workCompletion;
-   bool found = false;
-
-   for (unsigned c = 0; c != cachedCompletions.size(); ++c) {
-      if (!restricted || cachedCompletions[c].first == onlySend) {
-         workCompletion = cachedCompletions[c];
-         cachedCompletions.erase(cachedCompletions.begin() + c);
-         found = true;
-         break;
+   auto takeCached = [&](pair<bool, uint64_t> &workCompletion) {
+      CompletionRing::Completion completion;
+      if ((!restricted || onlySend) && sendCompletions.pop(completion)) {
+         checkStatus(completion);
+         workCompletion = make_pair(true, completion.wrId);
+         return true;
       }
-   }
+      if ((!restricted || !onlySend) && receiveCompletions.pop(completion)) {
+         checkStatus(completion);
+         workCompletion = make_pair(false, completion.wrId);
+         return true;
+      }
+      return false;
+   };
 
-   while (!found) {
+   pair<bool, uint64_t> workCompletion;
+   while (!takeCached(workCompletion)) {
       // Wait for completion queue event
       ibv_cq *event;
       void *ctx;
-      status = ::ibv_get_cq_event(channel, &event, &ctx);
+      status = Backend::get().getCqEvent(channel, &event, &ctx);
       if (status != 0) {
          string reason = "receiving the completion queue event failed with error " + to_string(errno) + ": " + strerror(errno);
          cerr << reason << endl;
          throw NetworkException(reason);
       }
-      ::ibv_ack_cq_events(event, 1);
-      bool isSendCompletion = (event == sendQueue);
+      Backend::get().ackCqEvents(event, 1);
 
       // Request a completion queue event
-      status = ::ibv_req_notify_cq(event, 0);
+      status = Backend::get().reqNotifyCq(event, 0);
       if (status != 0) {
          string reason = "requesting a completion queue event failed with error " + to_string(errno) + ": " + strerror(errno);
          cerr << reason << endl;
@@ -205,33 +255,7 @@ pair<bool, uint64_t> CompletionQueuePair::waitForCompletion(bool restricted, boo
       }
 
       // Poll all work completions
-      ibv_wc completion;
-      do {
-         status = ::ibv_poll_cq(event, 1, &completion);
-
-         if (status<0) {
-            string reason = "failed to poll completions";
-            cerr << reason << endl;
-            throw NetworkException(reason);
-         }
-         if (status == 0) {
-            continue;
-         }
-
-         if (completion.status != IBV_WC_SUCCESS) {
-            string reason = "unexpected completion status " + to_string(completion.status) + ": " + ibv_wc_status_str(completion.status);
-            cerr << reason << endl;
-            throw NetworkException(reason);
-         }
-
-         // Add completion
-         if (!found && (!restricted || isSendCompletion == onlySend)) {
-            workCompletion = make_pair(isSendCompletion, completion.wr_id);
-            found = true;
-         } else {
-            cachedCompletions.push_back(make_pair(isSendCompletion, completion.wr_id));
-         }
-      } while (status);
+      while (pollBatch(event));
    }
 
    // Return the oldest completion
@@ -241,29 +265,18 @@ pair<bool, uint64_t> CompletionQueuePair::waitForCompletion(bool restricted, boo
 uint64_t CompletionQueuePair::pollSendCompletionQueue()
 /// Poll the send completion queue
 {
-    int status;
-
-    // Poll for a work completion
-   ibv_wc completion{};
-    status = ::ibv_poll_cq(sendQueue, 1, &completion);
-    if (status == 0) {
-        return numeric_limits<uint64_t>::max();
-    }
-
-    // Check status and opcode
-    if (completion.status == IBV_WC_SUCCESS) {
-        return completion.wr_id;
-    } else {
-        string reason = "unexpected completion status " + to_string(completion.status) + ": " +
-                        ibv_wc_status_str(completion.status);
-        cerr << reason << endl;
-        throw NetworkException(reason);
-    }
+   CompletionRing::Completion completion;
+   if (!nextCompletion(sendQueue, completion)) {
+      return numeric_limits<uint64_t>::max();
+   }
+   return completion.wrId;
+}
+//---------------------------------------------------------------------------
+uint64_t CompletionQueuePair::pollSendCompletionQueue(int type)
+/// Poll the send completion queue with a user defined type
+{
+   return pollCompletionQueue(sendQueue, type);
 }
-
-    uint64_t CompletionQueuePair::pollSendCompletionQueue(int type) {
-        return pollCompletionQueue(sendQueue, type);
-    }
 //---------------------------------------------------------------------------
 uint64_t CompletionQueuePair::pollRecvCompletionQueue()
 /// Poll the receive completion queue
@@ -274,29 +287,11 @@ uint64_t CompletionQueuePair::pollRecvCompletionQueue()
 uint64_t CompletionQueuePair::pollCompletionQueueBlocking(ibv_cq *completionQueue, int type)
 /// Poll a completion queue blocking
 {
-   int status;
-
-   // Poll for a work completion
-   ibv_wc completion;
-   status = ::ibv_poll_cq(completionQueue, 1, &completion);
-   while (status == 0) {
-      status = ::ibv_poll_cq(completionQueue, 1, &completion);
-   }
-
-   // Check status and opcode
-   if (completion.status == IBV_WC_SUCCESS) {
-      if (completion.opcode == type) {
-         return completion.wr_id;
-      } else {
-         string reason = "unexpected completion opcode (" + stringForCompletionCode(completion.opcode) + ")";
-         cerr << reason << endl;
-         throw NetworkException(reason);
-      }
-   } else {
-      string reason = "unexpected completion status " + to_string(completion.status) + ": " + ibv_wc_status_str(completion.status);
-      cerr << reason << endl;
-      throw NetworkException(reason);
-   }
+   uint64_t wrId;
+   do {
+      wrId = pollCompletionQueue(completionQueue, type);
+   } while (wrId == numeric_limits<uint64_t>::max());
+   return wrId;
 }
 //---------------------------------------------------------------------------
 uint64_t CompletionQueuePair::pollSendCompletionQueueBlocking()
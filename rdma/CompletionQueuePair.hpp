@@ -20,6 +20,8 @@
 //---------------------------------------------------------------------------
 #pragma once
 //---------------------------------------------------------------------------
+#include "CompletionRing.hpp"
+//---------------------------------------------------------------------------
 #include <vector>
 #include <cstdint>
 #include <mutex>
@@ -37,6 +39,8 @@ namespace rdma {
     class CompletionQueuePair {
         friend class QueuePair;
 
+        friend class SharedCompletionQueue;
+
         CompletionQueuePair(CompletionQueuePair const &) = delete;
 
         CompletionQueuePair &operator=(CompletionQueuePair const &) = delete;
@@ -48,18 +52,35 @@ namespace rdma {
         /// The completion channel
         ibv_comp_channel *channel;
 
-        /// The cached work completions
-        std::vector<std::pair<bool, uint64_t>> cachedCompletions;
+        /// Number of work completions fetched with a single ibv_poll_cq
+        static const int POLL_BATCH = 32;
+
+        /// The cached work completions of the send and receive queue
+        CompletionRing sendCompletions;
+        CompletionRing receiveCompletions;
         /// Protect wait for events method from concurrent access
         std::mutex guard;
+        /// Serialises moving completions into the caches, so a batch never exceeds the space left in its cache
+        std::mutex polling;
+
+        CompletionRing &cacheFor(ibv_cq *completionQueue);
+
+        /// Move up to POLL_BATCH work completions into the cache, returns whether there were any
+        bool pollBatch(ibv_cq *completionQueue);
+
+        /// Get the next (cached or polled) completion of the queue, false if there is none
+        bool nextCompletion(ibv_cq *completionQueue, CompletionRing::Completion &completion);
 
         uint64_t pollCompletionQueue(ibv_cq *completionQueue, int type);
 
+        /// Throw if the completion's work request failed
+        static void checkStatus(const CompletionRing::Completion &completion);
+
         std::pair<bool, uint64_t> waitForCompletion(bool restrict, bool onlySend);
 
     public:
-        /// Ctor
-        CompletionQueuePair(Network &network);
+        /// Ctor, both queues get at least size entries
+        CompletionQueuePair(Network &network, int size = 0);
 
         ~CompletionQueuePair();
 
@@ -0,0 +1,100 @@
+#pragma once
+//---------------------------------------------------------------------------
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+//---------------------------------------------------------------------------
+namespace rdma {
+//---------------------------------------------------------------------------
+/// Fixed size cache of polled but not yet consumed work completions.
+/// Lock-free for any number of producers and consumers: each slot carries a sequence number telling whether it is
+/// ready to be filled or to be taken in the current round, producer and consumer index live on separate cache lines.
+class CompletionRing {
+public:
+    struct Completion {
+        uint64_t wrId;
+        /// The ibv_wc_opcode of the completion
+        int opcode;
+        /// The ibv_wc_status of the completion, failed ones are reported to whoever takes them
+        int status;
+    };
+
+    static const std::size_t CAPACITY = 1024;
+
+private:
+    static_assert((CAPACITY & (CAPACITY - 1)) == 0, "CAPACITY must be a power of 2");
+
+    struct Slot {
+        /// position while free, position + 1 once filled, position + CAPACITY once taken again
+        std::atomic<std::size_t> sequence;
+        Completion completion;
+    };
+
+    /// Next entry to consume
+    alignas(64) std::atomic<std::size_t> head{0};
+    /// Next entry to produce
+    alignas(64) std::atomic<std::size_t> tail{0};
+    alignas(64) std::array<Slot, CAPACITY> slots;
+
+public:
+    CompletionRing() {
+        for (std::size_t i = 0; i != CAPACITY; ++i) {
+            slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    /// Number of entries that can be pushed without failing, as long as no one else pushes concurrently
+    std::size_t freeSlots() const {
+        return CAPACITY - (tail.load(std::memory_order_relaxed) - head.load(std::memory_order_acquire));
+    }
+
+    bool empty() const {
+        return head.load(std::memory_order_relaxed) == tail.load(std::memory_order_acquire);
+    }
+
+    /// Append a completion, false if the ring is full
+    bool push(const Completion &completion) {
+        auto position = tail.load(std::memory_order_relaxed);
+        for (;;) {
+            auto &slot = slots[position & (CAPACITY - 1)];
+            const auto difference = static_cast<std::ptrdiff_t>(slot.sequence.load(std::memory_order_acquire) -
+                                                                position);
+            if (difference < 0) {
+                return false;
+            }
+            if (difference == 0 && tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                slot.completion = completion;
+                slot.sequence.store(position + 1, std::memory_order_release);
+                return true;
+            }
+            if (difference > 0) {
+                position = tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /// Take the oldest completion, false if the ring is empty
+    bool pop(Completion &completion) {
+        auto position = head.load(std::memory_order_relaxed);
+        for (;;) {
+            auto &slot = slots[position & (CAPACITY - 1)];
+            const auto difference = static_cast<std::ptrdiff_t>(slot.sequence.load(std::memory_order_acquire) -
+                                                                (position + 1));
+            if (difference < 0) {
+                return false;
+            }
+            if (difference == 0 && head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                completion = slot.completion;
+                slot.sequence.store(position + CAPACITY, std::memory_order_release);
+                return true;
+            }
+            if (difference > 0) {
+                position = head.load(std::memory_order_relaxed);
+            }
+        }
+    }
+};
+//---------------------------------------------------------------------------
+} // End of namespace rdma
+//---------------------------------------------------------------------------
@@ -0,0 +1,379 @@
+#include "ConnectionManager.hpp"
+#include "Network.hpp"
+#include "QueuePair.hpp"
+//---------------------------------------------------------------------------
+#include <sys/socket.h>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#ifdef HAVE_RDMACM
+#include <rdma/rdma_cma.h>
+#include <poll.h>
+#include <fcntl.h>
+#endif
+//---------------------------------------------------------------------------
+using namespace std;
+//---------------------------------------------------------------------------
+namespace rdma {
+//---------------------------------------------------------------------------
+const size_t ConnectionManager::MAX_INFO_SIZE;
+//---------------------------------------------------------------------------
+ConnectionManager::Rendezvous ConnectionManager::Rendezvous::fromSocket(int sock, bool accepted, uint16_t port)
+/// For the two ends of an established TCP socket, the accepting end is the passive one
+{
+   sockaddr_in local{}, peer{};
+   socklen_t localLength = sizeof(local), peerLength = sizeof(peer);
+   if (getsockname(sock, reinterpret_cast<sockaddr *>(&local), &localLength) != 0 ||
+       getpeername(sock, reinterpret_cast<sockaddr *>(&peer), &peerLength) != 0 ||
+       local.sin_family != AF_INET || peer.sin_family != AF_INET) {
+      string reason = "the connection manager needs an IPv4 TCP socket to find the remote side";
+      cerr << reason << endl;
+      throw NetworkException(reason);
+   }
+
+   Rendezvous rendezvous{};
+   rendezvous.active = !accepted;
+   const auto &activeSide = accepted ? peer : local;
+   rendezvous.tag = (uint64_t(ntohl(activeSide.sin_addr.s_addr)) << 16) | ntohs(activeSide.sin_port);
+   rendezvous.address = accepted ? local : peer;
+   rendezvous.address.sin_port = htons(port);
+   return rendezvous;
+}
+//---------------------------------------------------------------------------
+uint16_t ConnectionManager::sharedPort()
+{
+   static const uint16_t port = getenv("RDMA_CM_PORT") ? atoi(getenv("RDMA_CM_PORT")) : 7471;
+   return port;
+}
+//---------------------------------------------------------------------------
+ConnectionManager &ConnectionManager::shared()
+{
+   // Intentionally never destroyed, just like the network
+   static auto manager = new ConnectionManager(sharedPort());
+   return *manager;
+}
+//---------------------------------------------------------------------------
+#ifdef HAVE_RDMACM
+//---------------------------------------------------------------------------
+namespace {
+//---------------------------------------------------------------------------
+/// How long address and route resolution may take
+const int RESOLVE_TIMEOUT_MS = 2000;
+/// How long the passive side waits for the request, the active side resolves the address and the route first
+const int REQUEST_TIMEOUT_MS = 3 * RESOLVE_TIMEOUT_MS;
+//---------------------------------------------------------------------------
+[[noreturn]] void fail(const string &what)
+{
+   string reason = what + " failed with error " + to_string(errno) + ": " + strerror(errno);
+   cerr << reason << endl;
+   throw NetworkException(reason);
+}
+//---------------------------------------------------------------------------
+vector<uint8_t> expect(rdma_event_channel *channel, rdma_cm_event_type type)
+/// Wait for the next event of the channel, which has to be of the given type. Returns its private data
+{
+   rdma_cm_event *event;
+   if (rdma_get_cm_event(channel, &event) != 0) {
+      fail("waiting for the connection manager's event");
+   }
+   const auto received = event->event;
+   const auto status = event->status;
+   const auto data = reinterpret_cast<const uint8_t *>(event->param.conn.private_data);
+   vector<uint8_t> privateData(data, data + (data ? event->param.conn.private_data_len : 0));
+   rdma_ack_cm_event(event);
+   if (received != type) {
+      string reason = string("expected the connection manager's event ") + rdma_event_str(type) + ", got " +
+                      rdma_event_str(received) + " (status " + to_string(status) + ")";
+      cerr << reason << endl;
+      throw NetworkException(reason);
+   }
+   return privateData;
+}
+//---------------------------------------------------------------------------
+void transition(rdma_cm_id *id, QueuePair &queuePair, ibv_qp_state state)
+/// Move the queue pair to the state, with the attributes the connection manager resolved
+{
+   ibv_qp_attr attributes{};
+   int mask = 0;
+   attributes.qp_state = state;
+   if (rdma_init_qp_attr(id, &attributes, &mask) != 0) {
+      fail("computing the queue pair attributes for state " + to_string(state));
+   }
+   if (state == IBV_QPS_INIT) {
+      // Same as QueuePair::connect(), the rings are written, read and fetch-and-added remotely
+      attributes.qp_access_flags |= IBV_ACCESS_REMOTE_WRITE | IBV_ACCESS_REMOTE_READ | IBV_ACCESS_REMOTE_ATOMIC;
+   }
+   queuePair.modify(attributes, mask);
+}
+//---------------------------------------------------------------------------
+rdma_conn_param connectionParameters(QueuePair &queuePair, const vector<uint8_t> &privateData)
+{
+   rdma_conn_param parameters{};
+   parameters.private_data = privateData.data();
+   parameters.private_data_len = static_cast<uint8_t>(privateData.size());
+   parameters.responder_resources = queuePair.getProfile().readsAndAtomics; // The number of outstanding RDMA reads & atomic operations (destination)
+   parameters.initiator_depth = queuePair.getProfile().readsAndAtomics;     // The number of outstanding RDMA reads & atomic operations (initiator)
+   parameters.retry_count = 7;           // How often to retry sending
+   parameters.rnr_retry_count = 7;       // How often to retry sending when RNR NACK was received (7 = infinite)
+   parameters.srq = 1;                   // Receives go to the shared receive queue
+   parameters.qp_num = queuePair.getQPN();
+   return parameters;
+}
+//---------------------------------------------------------------------------
+}
+//---------------------------------------------------------------------------
+bool ConnectionManager::available()
+{
+   return true;
+}
+//---------------------------------------------------------------------------
+ConnectionManager::ConnectionManager(uint16_t port)
+{
+   if (port == 0) {
+      return;
+   }
+   listenerChannel = rdma_create_event_channel();
+   if (listenerChannel == nullptr) {
+      fail("creating the connection manager's event channel");
+   }
+   // Non-blocking, so the listener thread notices when to stop
+   fcntl(listenerChannel->fd, F_SETFL, fcntl(listenerChannel->fd, F_GETFL) | O_NONBLOCK);
+   if (rdma_create_id(listenerChannel, &listener, nullptr, RDMA_PS_TCP) != 0) {
+      fail("creating the listening connection manager id");
+   }
+   sockaddr_in address{};
+   address.sin_family = AF_INET;
+   address.sin_port = htons(port);
+   address.sin_addr.s_addr = INADDR_ANY;
+   if (rdma_bind_addr(listener, reinterpret_cast<sockaddr *>(&address)) != 0) {
+      fail("binding the connection manager to port " + to_string(port));
+   }
+   if (rdma_listen(listener, SOMAXCONN) != 0) {
+      fail("listening for connection requests");
+   }
+   listenerThread = thread([this] { listen(); });
+}
+//---------------------------------------------------------------------------
+ConnectionManager::~ConnectionManager()
+{
+   {
+      lock_guard<mutex> lock(guard);
+      running = false;
+   }
+   requestArrived.notify_all();
+   if (listenerThread.joinable()) {
+      listenerThread.join();
+   }
+   for (auto &request : requests) {
+      rdma_reject(request.second.id, nullptr, 0);
+      rdma_destroy_id(request.second.id);
+   }
+   if (listener != nullptr) {
+      rdma_destroy_id(listener);
+   }
+   if (listenerChannel != nullptr) {
+      rdma_destroy_event_channel(listenerChannel);
+   }
+}
+//---------------------------------------------------------------------------
+void ConnectionManager::listen()
+/// Process the listener's events
+{
+   pollfd pfd{listenerChannel->fd, POLLIN, 0};
+   for (;;) {
+      {
+         lock_guard<mutex> lock(guard);
+         if (not running) {
+            return;
+         }
+      }
+      if (::poll(&pfd, 1, 100) <= 0) {
+         continue;
+      }
+      rdma_cm_event *event;
+      if (rdma_get_cm_event(listenerChannel, &event) != 0) {
+         continue;
+      }
+      if (event->event != RDMA_CM_EVENT_CONNECT_REQUEST) {
+         // The accepted ids are migrated to their own channel, nothing else is expected here
+         rdma_ack_cm_event(event);
+         continue;
+      }
+
+      auto id = event->id;
+      const auto data = reinterpret_cast<const uint8_t *>(event->param.conn.private_data);
+      const size_t length = data ? event->param.conn.private_data_len : 0;
+      uint64_t tag = 0;
+      const bool valid = length >= sizeof(tag);
+      vector<uint8_t> info;
+      if (valid) {
+         memcpy(&tag, data, sizeof(tag));
+         info.assign(data + sizeof(tag), data + length);
+      }
+      rdma_ack_cm_event(event);
+      if (not valid) {
+         rdma_reject(id, nullptr, 0);
+         rdma_destroy_id(id);
+         continue;
+      }
+
+      {
+         lock_guard<mutex> lock(guard);
+         auto &request = requests[tag];
+         if (request.id != nullptr) {
+            // A stale request with the same tag, the remote side gave up on it
+            rdma_reject(request.id, nullptr, 0);
+            rdma_destroy_id(request.id);
+         }
+         request = Request{id, move(info)};
+      }
+      requestArrived.notify_all();
+   }
+}
+//---------------------------------------------------------------------------
+unique_ptr<ConnectionManager::Connection>
+ConnectionManager::connect(QueuePair &queuePair, const Rendezvous &rendezvous, const void *localInfo,
+                           void *remoteInfo, size_t size)
+/// Connect the freshly created queue pair of the active or passive side
+{
+   if (size > MAX_INFO_SIZE) {
+      string reason = "at most " + to_string(MAX_INFO_SIZE) + " bytes of info fit into a connection request";
+      cerr << reason << endl;
+      throw NetworkException(reason);
+   }
+
+   // Each connection gets its own channel, so connecting threads don't see each other's events
+   auto channel = rdma_create_event_channel();
+   if (channel == nullptr) {
+      fail("creating an event channel");
+   }
+   rdma_cm_id *id = nullptr;
+   unique_ptr<Connection> connection;
+   vector<uint8_t> privateData;
+
+   if (rendezvous.active) {
+      if (rdma_create_id(channel, &id, nullptr, RDMA_PS_TCP) != 0) {
+         rdma_destroy_event_channel(channel);
+         fail("creating a connection manager id");
+      }
+      connection.reset(new Connection(id, channel));
+      auto address = rendezvous.address;
+      if (rdma_resolve_addr(id, nullptr, reinterpret_cast<sockaddr *>(&address), RESOLVE_TIMEOUT_MS) != 0) {
+         fail("resolving the remote address");
+      }
+      expect(channel, RDMA_CM_EVENT_ADDR_RESOLVED);
+      if (rdma_resolve_route(id, RESOLVE_TIMEOUT_MS) != 0) {
+         fail("resolving the route");
+      }
+      expect(channel, RDMA_CM_EVENT_ROUTE_RESOLVED);
+
+      transition(id, queuePair, IBV_QPS_INIT);
+      privateData.resize(sizeof(rendezvous.tag) + size);
+      memcpy(privateData.data(), &rendezvous.tag, sizeof(rendezvous.tag));
+      memcpy(privateData.data() + sizeof(rendezvous.tag), localInfo, size);
+      auto parameters = connectionParameters(queuePair, privateData);
+      if (rdma_connect(id, &parameters) != 0) {
+         fail("sending the connection request");
+      }
+      // We own the queue pair, so the connection manager leaves connecting it to us
+      const auto reply = expect(channel, RDMA_CM_EVENT_CONNECT_RESPONSE);
+      transition(id, queuePair, IBV_QPS_RTR);
+      transition(id, queuePair, IBV_QPS_RTS);
+      if (rdma_establish(id) != 0) {
+         fail("establishing the connection");
+      }
+      memcpy(remoteInfo, reply.data(), min(size, reply.size()));
+   } else {
+      Request request;
+      {
+         unique_lock<mutex> lock(guard);
+         const bool arrived = requestArrived.wait_for(lock, chrono::milliseconds(REQUEST_TIMEOUT_MS), [&] {
+            return not running || requests.count(rendezvous.tag) != 0;
+         });
+         if (not running) {
+            rdma_destroy_event_channel(channel);
+            throw NetworkException("the connection manager was shut down");
+         }
+         if (not arrived) {
+            // The active side failed before sending its request
+            rdma_destroy_event_channel(channel);
+            string reason = "no connection request arrived within " + to_string(REQUEST_TIMEOUT_MS) + "ms";
+            cerr << reason << endl;
+            throw NetworkException(reason);
+         }
+         auto found = requests.find(rendezvous.tag);
+         request = move(found->second);
+         requests.erase(found);
+      }
+      id = request.id;
+      if (rdma_migrate_id(id, channel) != 0) {
+         rdma_destroy_id(id);
+         rdma_destroy_event_channel(channel);
+         fail("moving the connection request to its own channel");
+      }
+      connection.reset(new Connection(id, channel));
+
+      transition(id, queuePair, IBV_QPS_INIT);
+      transition(id, queuePair, IBV_QPS_RTR);
+      transition(id, queuePair, IBV_QPS_RTS);
+      privateData.assign(reinterpret_cast<const uint8_t *>(localInfo),
+                         reinterpret_cast<const uint8_t *>(localInfo) + size);
+      auto parameters = connectionParameters(queuePair, privateData);
+      if (rdma_accept(id, &parameters) != 0) {
+         fail("accepting the connection request");
+      }
+      expect(channel, RDMA_CM_EVENT_ESTABLISHED);
+      memcpy(remoteInfo, request.info.data(), min(size, request.info.size()));
+   }
+   return connection;
+}
+//---------------------------------------------------------------------------
+ConnectionManager::Connection::~Connection()
+{
+   rdma_disconnect(id);
+   rdma_destroy_id(id);
+   rdma_destroy_event_channel(channel);
+}
+//---------------------------------------------------------------------------
+#else
+//---------------------------------------------------------------------------
+namespace {
+//---------------------------------------------------------------------------
+[[noreturn]] void unavailable()
+{
+   string reason = "built without librdmacm, the connection manager is not available";
+   cerr << reason << endl;
+   throw NetworkException(reason);
+}
+//---------------------------------------------------------------------------
+}
+//---------------------------------------------------------------------------
+bool ConnectionManager::available()
+{
+   return false;
+}
+//---------------------------------------------------------------------------
+ConnectionManager::ConnectionManager(uint16_t)
+{
+   unavailable();
+}
+//---------------------------------------------------------------------------
+ConnectionManager::~ConnectionManager() = default;
+//---------------------------------------------------------------------------
+void ConnectionManager::listen()
+{
+}
+//---------------------------------------------------------------------------
+unique_ptr<ConnectionManager::Connection>
+ConnectionManager::connect(QueuePair &, const Rendezvous &, const void *, void *, size_t)
+{
+   unavailable();
+}
+//---------------------------------------------------------------------------
+ConnectionManager::Connection::~Connection() = default;
+//---------------------------------------------------------------------------
+#endif
+//---------------------------------------------------------------------------
+} // End of namespace rdma
+//---------------------------------------------------------------------------
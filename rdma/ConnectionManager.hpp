@@ -0,0 +1,105 @@
+#pragma once
+//---------------------------------------------------------------------------
+#include <netinet/in.h>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+//---------------------------------------------------------------------------
+struct rdma_cm_id;
+struct rdma_event_channel;
+//---------------------------------------------------------------------------
+namespace rdma {
+//---------------------------------------------------------------------------
+    class QueuePair;
+
+//---------------------------------------------------------------------------
+/// Connects queue pairs through the RDMA connection manager (librdmacm) instead of a TCP handshake. It resolves the
+/// remote address and path itself (GID, MTU and PSNs with RoCE), and carries a few bytes of the caller's info, e.g. the
+/// keys of a ring, in the private data of the request and reply. The queue pairs stay ours, the connection manager
+/// only computes their attributes. Requests are accepted by a listener thread and matched to accept calls by a tag,
+/// so many connections are established at the same time
+    class ConnectionManager {
+    public:
+        /// The private data of a reliable connection request has 56 bytes, 8 of them are the tag
+        static const size_t MAX_INFO_SIZE = 48;
+
+        /// Which connection to establish: the active side connects to address, the passive side waits for the request
+        /// with the same tag
+        struct Rendezvous {
+            bool active;
+            sockaddr_in address;
+            uint64_t tag;
+
+            /// For the two ends of an established TCP socket, the accepting end is the passive one. The tag is the
+            /// active side's IP and port, address the passive side's IP with the given port
+            static Rendezvous fromSocket(int sock, bool accepted, uint16_t port);
+        };
+
+        /// An established connection, disconnected when destroyed
+        class Connection {
+            friend class ConnectionManager;
+
+            rdma_cm_id *id;
+            rdma_event_channel *channel;
+
+            Connection(rdma_cm_id *id, rdma_event_channel *channel) : id(id), channel(channel) {}
+
+        public:
+            ~Connection();
+
+            Connection(Connection const &) = delete;
+
+            Connection &operator=(Connection const &) = delete;
+        };
+
+    private:
+        /// A connection request the listener received, which was not accepted yet
+        struct Request {
+            rdma_cm_id *id;
+            std::vector<uint8_t> info;
+        };
+
+        rdma_event_channel *listenerChannel = nullptr;
+        rdma_cm_id *listener = nullptr;
+
+        std::mutex guard;
+        std::condition_variable requestArrived;
+        /// By tag
+        std::map<uint64_t, Request> requests;
+        bool running = true;
+        std::thread listenerThread;
+
+        /// Process the listener's events
+        void listen();
+
+    public:
+        /// Listen for connection requests on the given port, only connect with port 0
+        explicit ConnectionManager(uint16_t port);
+
+        ~ConnectionManager();
+
+        ConnectionManager(ConnectionManager const &) = delete;
+
+        ConnectionManager &operator=(ConnectionManager const &) = delete;
+
+        /// Whether the library was built with librdmacm, all other functions throw otherwise
+        static bool available();
+
+        /// The port of the shared connection manager: RDMA_CM_PORT, default 7471
+        static uint16_t sharedPort();
+
+        /// The connection manager of this process, listening on sharedPort()
+        static ConnectionManager &shared();
+
+        /// Connect the freshly created queue pair of the active or passive side, exchanging size bytes of info with
+        /// the remote side on the way
+        std::unique_ptr<Connection> connect(QueuePair &queuePair, const Rendezvous &rendezvous, const void *localInfo,
+                                            void *remoteInfo, size_t size);
+    };
+//---------------------------------------------------------------------------
+} // End of namespace rdma
+//---------------------------------------------------------------------------
@@ -0,0 +1,722 @@
+#include "EmulatedBackend.hpp"
+//---------------------------------------------------------------------------
+#include <infiniband/verbs.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <vector>
+//---------------------------------------------------------------------------
+using namespace std;
+//---------------------------------------------------------------------------
+namespace rdma {
+//---------------------------------------------------------------------------
+struct EmulatedBackend::Registration {
+   uintptr_t address;
+   size_t length;
+   int access;
+};
+//---------------------------------------------------------------------------
+struct EmulatedBackend::Channel {
+   mutex guard;
+   condition_variable signal;
+   /// Completion queues which got a completion while armed
+   deque<ibv_cq *> events;
+};
+//---------------------------------------------------------------------------
+struct EmulatedBackend::CompletionQueue {
+   struct Entry {
+      ibv_wc completion;
+      /// Of send completions: polling it frees the send queue up to the request's sequence number
+      shared_ptr<atomic<uint64_t>> sendQueueFreed;
+      uint64_t sequence;
+   };
+
+   ibv_cq *verbs;
+   Channel *channel;
+   mutex guard;
+   deque<Entry> completions;
+   /// Whether the next completion generates an event
+   bool armed = false;
+
+   void push(const ibv_wc &completion, shared_ptr<atomic<uint64_t>> sendQueueFreed = nullptr, uint64_t sequence = 0)
+   {
+      {
+         lock_guard<mutex> lock(guard);
+         completions.push_back(Entry{completion, move(sendQueueFreed), sequence});
+         if (!armed || channel == nullptr) {
+            return;
+         }
+         armed = false;
+      }
+      lock_guard<mutex> lock(channel->guard);
+      channel->events.push_back(verbs);
+      channel->signal.notify_one();
+   }
+};
+//---------------------------------------------------------------------------
+struct EmulatedBackend::ReceiveQueue {
+   struct Receive {
+      uint64_t id;
+      vector<ibv_sge> scatterElements;
+   };
+   deque<Receive> receives;
+};
+//---------------------------------------------------------------------------
+struct EmulatedBackend::Operation {
+   ibv_send_wr workRequest;
+   vector<ibv_sge> scatterElements;
+   /// The payload of inline requests, taken when posting
+   vector<uint8_t> inlineData;
+   chrono::steady_clock::time_point due;
+   /// Position in the send queue
+   uint64_t sequence;
+};
+//---------------------------------------------------------------------------
+struct EmulatedBackend::QueuePair {
+   ibv_qp *verbs;
+   ibv_qp_init_attr initAttributes;
+   ibv_qp_attr attributes;
+   CompletionQueue *sendQueue;
+   CompletionQueue *receiveQueue;
+   EmulatedBackend::ReceiveQueue *sharedReceiveQueue;
+   /// Posted, but not carried out yet
+   deque<Operation> operations;
+   /// Requests posted so far, and up to which one the send queue was freed by polling a completion. Like with the NIC,
+   /// unsignaled requests occupy the send queue until a later request's completion is polled
+   uint64_t posted = 0;
+   shared_ptr<atomic<uint64_t>> sendQueueFreed = make_shared<atomic<uint64_t>>(0);
+   /// When the NIC is done processing everything posted so far, if queue pairs are slower than the link
+   chrono::steady_clock::time_point processed;
+};
+//---------------------------------------------------------------------------
+namespace {
+//---------------------------------------------------------------------------
+/// A verbs object with the emulator's state behind it. Standard layout, so a pointer to verbs is one to the whole
+template<typename Verbs, typename State>
+struct Emulated {
+   Verbs verbs;
+   State *state;
+};
+//---------------------------------------------------------------------------
+template<typename State, typename Verbs>
+Verbs *wrap(State *state)
+{
+   auto emulated = new Emulated<Verbs, State>();
+   emulated->state = state;
+   return &emulated->verbs;
+}
+//---------------------------------------------------------------------------
+template<typename State, typename Verbs>
+State &stateOf(Verbs *verbs)
+{
+   return *reinterpret_cast<Emulated<Verbs, State> *>(verbs)->state;
+}
+//---------------------------------------------------------------------------
+template<typename State, typename Verbs>
+void unwrap(Verbs *verbs)
+{
+   auto emulated = reinterpret_cast<Emulated<Verbs, State> *>(verbs);
+   delete emulated->state;
+   delete emulated;
+}
+//---------------------------------------------------------------------------
+/// Space for the global routing header in front of every received datagram
+const size_t GRH_SIZE = 40;
+//---------------------------------------------------------------------------
+void orderedCopy(uint8_t *to, const uint8_t *from, size_t length)
+/// Copy in ascending address order like the NIC does, the ring protocols rely on the footer arriving last
+{
+   for (size_t offset = 0; offset < length; offset += sizeof(uint64_t)) {
+      memcpy(to + offset, from + offset, min(sizeof(uint64_t), length - offset));
+      atomic_thread_fence(memory_order_release);
+   }
+}
+//---------------------------------------------------------------------------
+ibv_wc_opcode completionOpcode(ibv_wr_opcode opcode)
+{
+   switch (opcode) {
+      case IBV_WR_RDMA_WRITE:
+      case IBV_WR_RDMA_WRITE_WITH_IMM:
+         return IBV_WC_RDMA_WRITE;
+      case IBV_WR_RDMA_READ:
+         return IBV_WC_RDMA_READ;
+      case IBV_WR_ATOMIC_FETCH_AND_ADD:
+         return IBV_WC_FETCH_ADD;
+      case IBV_WR_ATOMIC_CMP_AND_SWP:
+         return IBV_WC_COMP_SWAP;
+      default:
+         return IBV_WC_SEND;
+   }
+}
+//---------------------------------------------------------------------------
+ibv_device emulatedDevice = [] {
+   ibv_device device{};
+   strcpy(device.name, "emulated");
+   strcpy(device.dev_name, "emulated");
+   return device;
+}();
+//---------------------------------------------------------------------------
+}
+//---------------------------------------------------------------------------
+const chrono::microseconds EmulatedBackend::RNR_DELAY(10);
+//---------------------------------------------------------------------------
+EmulatedBackend::EmulatedBackend(chrono::nanoseconds latency, double gigabitsPerSecond, uint8_t ports,
+                                 double queuePairGigabitsPerSecond)
+        : latency(latency)
+          , bytesPerNanosecond(gigabitsPerSecond / 8)
+          , queuePairBytesPerNanosecond(queuePairGigabitsPerSecond / 8)
+          , ports(max<uint8_t>(ports, 1))
+{
+   worker = thread([this] { run(); });
+}
+//---------------------------------------------------------------------------
+EmulatedBackend::~EmulatedBackend()
+{
+   {
+      lock_guard<mutex> lock(guard);
+      running = false;
+   }
+   operationsPosted.notify_all();
+   worker.join();
+}
+//---------------------------------------------------------------------------
+ibv_device **EmulatedBackend::getDeviceList(int *count)
+{
+   *count = 1;
+   return new ibv_device *[2]{&emulatedDevice, nullptr};
+}
+//---------------------------------------------------------------------------
+void EmulatedBackend::freeDeviceList(ibv_device **devices)
+{
+   delete[] devices;
+}
+//---------------------------------------------------------------------------
+ibv_context *EmulatedBackend::openDevice(ibv_device *device)
+{
+   auto context = new ibv_context();
+   context->device = device;
+   return context;
+}
+//---------------------------------------------------------------------------
+int EmulatedBackend::closeDevice(ibv_context *context)
+{
+   delete context;
+   return 0;
+}
+//---------------------------------------------------------------------------
+int EmulatedBackend::queryDevice(ibv_context *, ibv_device_attr *attributes)
+{
+   memset(attributes, 0, sizeof(*attributes));
+   strcpy(attributes->fw_ver, "emulated");
+   attributes->max_qp = 1 << 20;
+   attributes->max_qp_wr = 1 << 16;
+   attributes->max_sge = 32;
+   attributes->max_cq = 1 << 20;
+   attributes->max_cqe = 1 << 22;
+   attributes->max_mr = 1 << 20;
+   attributes->max_pd = 1 << 10;
+   attributes->max_qp_rd_atom = 128;
+   attributes->max_qp_init_rd_atom = 128;
+   attributes->max_srq = 1 << 10;
+   attributes->max_srq_wr = 1 << 16;
+   attributes->max_srq_sge = 32;
+   attributes->atomic_cap = IBV_ATOMIC_GLOB;
+   attributes->phys_port_cnt = ports;
+   return 0;
+}
+//---------------------------------------------------------------------------
+int EmulatedBackend::queryPort(ibv_context *, uint8_t port, ibv_port_attr *attributes)
+{
+   if (port == 0 || port > ports) {
+      return EINVAL;
+   }
+   memset(attributes, 0, sizeof(*attributes));
+   attributes->state = IBV_PORT_ACTIVE;
+   attributes->max_mtu = IBV_MTU_4096;
+   attributes->active_mtu = IBV_MTU_4096;
+   attributes->lid = port;
+   attributes->gid_tbl_len = 1;
+   return 0;
+}
+//---------------------------------------------------------------------------
+int EmulatedBackend::queryGid(ibv_context *, uint8_t, int index, ibv_gid *gid)
+{
+   if (index != 0) {
+      return EINVAL;
+   }
+   // A link local address, the queue pair number alone identifies the destination within the process
+   memset(gid, 0, sizeof(*gid));
+   gid->raw[0] = 0xfe;
+   gid->raw[1] = 0x80;
+   gid->raw[15] = 1;
+   return 0;
+}
+//---------------------------------------------------------------------------
+ibv_pd *EmulatedBackend::allocPd(ibv_context *context)
+{
+   auto protectionDomain = new ibv_pd();
+   protectionDomain->context = context;
+   return protectionDomain;
+}
+//---------------------------------------------------------------------------
+int EmulatedBackend::deallocPd(ibv_pd *protectionDomain)
+{
+   delete protectionDomain;
+   return 0;
+}
+//---------------------------------------------------------------------------
+ibv_mr *EmulatedBackend::regMr(ibv_pd *protectionDomain, void *address, size_t length, int access)
+{
+   auto registration = new Registration{reinterpret_cast<uintptr_t>(address), length, access};
+   auto memoryRegion = wrap<Registration, ibv_mr>(registration);
+   memoryRegion->context = protectionDomain->context;
+   memoryRegion->pd = protectionDomain;
+   memoryRegion->addr = address;
+   memoryRegion->length = length;
+
+   lock_guard<mutex> lock(guard);
+   memoryRegion->lkey = memoryRegion->rkey = nextKey++;
+   registrations[memoryRegion->rkey] = registration;
+   return memoryRegion;
+}
+//---------------------------------------------------------------------------
+int EmulatedBackend::deregMr(ibv_mr *memoryRegion)
+{
+   {
+      lock_guard<mutex> lock(guard);
+      registrations.erase(memoryRegion->rkey);
+   }
+   unwrap<Registration>(memoryRegion);
+   return 0;
+}
+//---------------------------------------------------------------------------
+ibv_comp_channel *EmulatedBackend::createCompChannel(ibv_context *context)
+{
+   auto channel = wrap<Channel, ibv_comp_channel>(new Channel());
+   channel->context = context;
+   channel->fd = -1;
+   return channel;
+}
+//---------------------------------------------------------------------------
+int EmulatedBackend::destroyCompChannel(ibv_comp_channel *channel)
+{
+   unwrap<Channel>(channel);
+   return 0;
+}
+//---------------------------------------------------------------------------
+ibv_cq *EmulatedBackend::createCq(ibv_context *context, int entries, ibv_comp_channel *channel)
+{
+   auto state = new CompletionQueue();
+   auto completionQueue = wrap<CompletionQueue, ibv_cq>(state);
+   completionQueue->context = context;
+   completionQueue->channel = channel;
+   completionQueue->cqe = entries;
+   state->verbs = completionQueue;
+   state->channel = channel ? &stateOf<Channel>(channel) : nullptr;
+   return completionQueue;
+}
+//---------------------------------------------------------------------------
+int EmulatedBackend::destroyCq(ibv_cq *completionQueue)
+{
+   unwrap<CompletionQueue>(completionQueue);
+   return 0;
+}
+//---------------------------------------------------------------------------
+int EmulatedBackend::reqNotifyCq(ibv_cq *completionQueue, int)
+{
+   auto &state = stateOf<CompletionQueue>(completionQueue);
+   lock_guard<mutex> lock(state.guard);
+   state.armed = true;
+   return 0;
+}
+//---------------------------------------------------------------------------
+int EmulatedBackend::getCqEvent(ibv_comp_channel *channel, ibv_cq **completionQueue, void **context)
+{
+   auto &state = stateOf<Channel>(channel);
+   unique_lock<mutex> lock(state.guard);
+   state.signal.wait(lock, [&] { return !state.events.empty(); });
+   *completionQueue = state.events.front();
+   *context = (*completionQueue)->cq_context;
+   state.events.pop_front();
+   return 0;
+}
+//---------------------------------------------------------------------------
+void EmulatedBackend::ackCqEvents(ibv_cq *, unsigned)
+{
+}
+//---------------------------------------------------------------------------
+int EmulatedBackend::pollCq(ibv_cq *completionQueue, int entries, ibv_wc *completions)
+{
+   auto &state = stateOf<CompletionQueue>(completionQueue);
+   lock_guard<mutex> lock(state.guard);
+   int count = 0;
+   for (; count != entries && !state.completions.empty(); ++count) {
+      auto &entry = state.completions.front();
+      completions[count] = entry.completion;
+      if (entry.sendQueueFreed) {
+         entry.sendQueueFreed->store(entry.sequence);
+      }
+      state.completions.pop_front();
+   }
+   return count;
+}
+//---------------------------------------------------------------------------
+ibv_srq *EmulatedBackend::createSrq(ibv_pd *protectionDomain, ibv_srq_init_attr *)
+{
+   auto receiveQueue = wrap<ReceiveQueue, ibv_srq>(new ReceiveQueue());
+   receiveQueue->context = protectionDomain->context;
+   receiveQueue->pd = protectionDomain;
+   return receiveQueue;
+}
+//---------------------------------------------------------------------------
+int EmulatedBackend::destroySrq(ibv_srq *receiveQueue)
+{
+   lock_guard<mutex> lock(guard);
+   unwrap<ReceiveQueue>(receiveQueue);
+   return 0;
+}
+//---------------------------------------------------------------------------
+int EmulatedBackend::postSrqRecv(ibv_srq *receiveQueue, ibv_recv_wr *workRequests, ibv_recv_wr **)
+{
+   auto &state = stateOf<ReceiveQueue>(receiveQueue);
+   lock_guard<mutex> lock(guard);
+   for (auto workRequest = workRequests; workRequest != nullptr; workRequest = workRequest->next) {
+      state.receives.push_back({workRequest->wr_id, vector<ibv_sge>(workRequest->sg_list,
+                                                                    workRequest->sg_list + workRequest->num_sge)});
+   }
+   return 0;
+}
+//---------------------------------------------------------------------------
+ibv_qp *EmulatedBackend::createQp(ibv_pd *protectionDomain, ibv_qp_init_attr *attributes)
+{
+   auto state = new QueuePair();
+   auto queuePair = wrap<QueuePair, ibv_qp>(state);
+   queuePair->context = protectionDomain->context;
+   queuePair->pd = protectionDomain;
+   queuePair->send_cq = attributes->send_cq;
+   queuePair->recv_cq = attributes->recv_cq;
+   queuePair->srq = attributes->srq;
+   queuePair->qp_type = attributes->qp_type;
+   queuePair->state = IBV_QPS_RESET;
+   queuePair->qp_context = attributes->qp_context;
+
+   state->verbs = queuePair;
+   state->initAttributes = *attributes;
+   memset(&state->attributes, 0, sizeof(state->attributes));
+   state->attributes.cap = attributes->cap;
+   state->sendQueue = &stateOf<CompletionQueue>(attributes->send_cq);
+   state->receiveQueue = &stateOf<CompletionQueue>(attributes->recv_cq);
+   state->sharedReceiveQueue = attributes->srq ? &stateOf<ReceiveQueue>(attributes->srq) : nullptr;
+
+   lock_guard<mutex> lock(guard);
+   queuePair->qp_num = nextQueuePairNumber++;
+   queuePairs[queuePair->qp_num] = state;
+   return queuePair;
+}
+//---------------------------------------------------------------------------
+int EmulatedBackend::destroyQp(ibv_qp *queuePair)
+{
+   lock_guard<mutex> lock(guard);
+   queuePairs.erase(queuePair->qp_num);
+   unwrap<QueuePair>(queuePair);
+   return 0;
+}
+//---------------------------------------------------------------------------
+int EmulatedBackend::modifyQp(ibv_qp *queuePair, ibv_qp_attr *attributes, int mask)
+{
+   auto &state = stateOf<QueuePair>(queuePair);
+   lock_guard<mutex> lock(guard);
+   auto &current = state.attributes;
+   if (mask & IBV_QP_STATE) {
+      current.qp_state = attributes->qp_state;
+      queuePair->state = attributes->qp_state;
+   }
+   if (mask & IBV_QP_ACCESS_FLAGS) current.qp_access_flags = attributes->qp_access_flags;
+   if (mask & IBV_QP_PKEY_INDEX) current.pkey_index = attributes->pkey_index;
+   if (mask & IBV_QP_PORT) current.port_num = attributes->port_num;
+   if (mask & IBV_QP_QKEY) current.qkey = attributes->qkey;
+   if (mask & IBV_QP_AV) current.ah_attr = attributes->ah_attr;
+   if (mask & IBV_QP_PATH_MTU) current.path_mtu = attributes->path_mtu;
+   if (mask & IBV_QP_DEST_QPN) current.dest_qp_num = attributes->dest_qp_num;
+   if (mask & IBV_QP_RQ_PSN) current.rq_psn = attributes->rq_psn;
+   if (mask & IBV_QP_SQ_PSN) current.sq_psn = attributes->sq_psn;
+   if (mask & IBV_QP_MAX_DEST_RD_ATOMIC) current.max_dest_rd_atomic = attributes->max_dest_rd_atomic;
+   if (mask & IBV_QP_MAX_QP_RD_ATOMIC) current.max_rd_atomic = attributes->max_rd_atomic;
+   if (mask & IBV_QP_MIN_RNR_TIMER) current.min_rnr_timer = attributes->min_rnr_timer;
+   if (mask & IBV_QP_TIMEOUT) current.timeout = attributes->timeout;
+   if (mask & IBV_QP_RETRY_CNT) current.retry_cnt = attributes->retry_cnt;
+   if (mask & IBV_QP_RNR_RETRY) current.rnr_retry = attributes->rnr_retry;
+   return 0;
+}
+//---------------------------------------------------------------------------
+int EmulatedBackend::queryQp(ibv_qp *queuePair, ibv_qp_attr *attributes, int, ibv_qp_init_attr *initAttributes)
+{
+   auto &state = stateOf<QueuePair>(queuePair);
+   lock_guard<mutex> lock(guard);
+   *attributes = state.attributes;
+   attributes->cur_qp_state = state.attributes.qp_state;
+   *initAttributes = state.initAttributes;
+   return 0;
+}
+//---------------------------------------------------------------------------
+int EmulatedBackend::postSend(ibv_qp *queuePair, ibv_send_wr *workRequests, ibv_send_wr **badWorkRequest)
+{
+   auto &state = stateOf<QueuePair>(queuePair);
+   const auto now = chrono::steady_clock::now();
+   lock_guard<mutex> lock(guard);
+   if (state.attributes.qp_state != IBV_QPS_RTS) {
+      *badWorkRequest = workRequests;
+      return EINVAL;
+   }
+   for (auto workRequest = workRequests; workRequest != nullptr; workRequest = workRequest->next) {
+      if (state.posted - state.sendQueueFreed->load() >= state.initAttributes.cap.max_send_wr) {
+         *badWorkRequest = workRequest;
+         return ENOMEM;
+      }
+      Operation operation;
+      operation.sequence = ++state.posted;
+      operation.workRequest = *workRequest;
+      operation.workRequest.next = nullptr;
+      operation.scatterElements.assign(workRequest->sg_list, workRequest->sg_list + workRequest->num_sge);
+      operation.workRequest.sg_list = nullptr;
+
+      size_t length = 0;
+      for (auto &element : operation.scatterElements) {
+         length += element.length;
+      }
+      if (workRequest->send_flags & IBV_SEND_INLINE) {
+         for (auto &element : operation.scatterElements) {
+            auto data = reinterpret_cast<const uint8_t *>(element.addr);
+            operation.inlineData.insert(operation.inlineData.end(), data, data + element.length);
+         }
+      }
+
+      // Transfers are serialized on the link of the port, then take the latency to arrive
+      const auto transferTime = chrono::nanoseconds(static_cast<int64_t>(length / bytesPerNanosecond));
+      auto &link = linkFree[state.attributes.port_num];
+      link = max(link, now) + transferTime;
+      operation.due = link + latency;
+      // Each queue pair is processed one request after another, possibly slower than the link
+      if (queuePairBytesPerNanosecond > 0) {
+         const auto processingTime = chrono::nanoseconds(static_cast<int64_t>(length / queuePairBytesPerNanosecond));
+         state.processed = max(state.processed, now) + processingTime;
+         operation.due = max(link, state.processed) + latency;
+      }
+      state.operations.push_back(move(operation));
+   }
+   operationsPosted.notify_one();
+   return 0;
+}
+//---------------------------------------------------------------------------
+ibv_ah *EmulatedBackend::createAh(ibv_pd *protectionDomain, ibv_ah_attr *)
+{
+   auto addressHandle = new ibv_ah();
+   addressHandle->context = protectionDomain->context;
+   addressHandle->pd = protectionDomain;
+   return addressHandle;
+}
+//---------------------------------------------------------------------------
+int EmulatedBackend::destroyAh(ibv_ah *addressHandle)
+{
+   delete addressHandle;
+   return 0;
+}
+//---------------------------------------------------------------------------
+uint8_t *EmulatedBackend::resolve(uint32_t key, uint64_t address, size_t length, int access)
+/// The registered memory [address, address + length) with the given key and access, nullptr if not accessible
+{
+   auto found = registrations.find(key);
+   if (found == registrations.end()) {
+      return nullptr;
+   }
+   auto &registration = *found->second;
+   if ((registration.access & access) != access || address < registration.address ||
+       address + length > registration.address + registration.length) {
+      return nullptr;
+   }
+   return reinterpret_cast<uint8_t *>(address);
+}
+//---------------------------------------------------------------------------
+void EmulatedBackend::run()
+/// Carry out the operations in the order of their due time, but each queue pair's in the order they were posted
+{
+   unique_lock<mutex> lock(guard);
+   while (running) {
+      QueuePair *next = nullptr;
+      for (auto &queuePair : queuePairs) {
+         auto &operations = queuePair.second->operations;
+         if (!operations.empty() && (next == nullptr || operations.front().due < next->operations.front().due)) {
+            next = queuePair.second;
+         }
+      }
+      if (next == nullptr) {
+         operationsPosted.wait(lock);
+         continue;
+      }
+
+      const auto due = next->operations.front().due;
+      const auto now = chrono::steady_clock::now();
+      if (due > now) {
+         // Timed waits are too coarse for microsecond latencies, so yield until short deadlines instead
+         if (due - now > chrono::microseconds(200)) {
+            operationsPosted.wait_until(lock, due);
+         } else {
+            lock.unlock();
+            while (chrono::steady_clock::now() < due) {
+               this_thread::yield();
+            }
+            lock.lock();
+         }
+         continue;
+      }
+
+      if (execute(*next, next->operations.front())) {
+         next->operations.pop_front();
+      } else {
+         next->operations.front().due = now + RNR_DELAY;
+      }
+   }
+}
+//---------------------------------------------------------------------------
+bool EmulatedBackend::execute(QueuePair &queuePair, Operation &operation)
+/// Carry out an operation, false if it has to be retried (no receive buffer)
+{
+   const auto &workRequest = operation.workRequest;
+   ibv_wc completion{};
+   completion.wr_id = workRequest.wr_id;
+   completion.status = IBV_WC_SUCCESS;
+   completion.opcode = completionOpcode(workRequest.opcode);
+   completion.qp_num = queuePair.verbs->qp_num;
+
+   // Gather the local data (already taken for inline requests)
+   vector<uint8_t> data = operation.inlineData;
+   const bool gather = data.empty() && workRequest.opcode != IBV_WR_RDMA_READ &&
+                       workRequest.opcode != IBV_WR_ATOMIC_FETCH_AND_ADD &&
+                       workRequest.opcode != IBV_WR_ATOMIC_CMP_AND_SWP;
+   size_t length = 0;
+   for (auto &element : operation.scatterElements) {
+      if (!(workRequest.send_flags & IBV_SEND_INLINE) &&
+          resolve(element.lkey, element.addr, element.length, 0) == nullptr) {
+         completion.status = IBV_WC_LOC_PROT_ERR;
+      } else if (gather) {
+         auto local = reinterpret_cast<const uint8_t *>(element.addr);
+         data.insert(data.end(), local, local + element.length);
+      }
+      length += element.length;
+   }
+   completion.byte_len = static_cast<uint32_t>(length);
+
+   auto scatterLocal = [&](const uint8_t *from) {
+      for (auto &element : operation.scatterElements) {
+         orderedCopy(reinterpret_cast<uint8_t *>(element.addr), from, element.length);
+         from += element.length;
+      }
+   };
+
+   if (completion.status == IBV_WC_SUCCESS) {
+      switch (workRequest.opcode) {
+         case IBV_WR_RDMA_WRITE:
+         case IBV_WR_RDMA_WRITE_WITH_IMM: {
+            auto remote = resolve(workRequest.wr.rdma.rkey, workRequest.wr.rdma.remote_addr, length,
+                                  IBV_ACCESS_REMOTE_WRITE);
+            if (remote == nullptr) {
+               completion.status = IBV_WC_REM_ACCESS_ERR;
+               break;
+            }
+            orderedCopy(remote, data.data(), length);
+            break;
+         }
+         case IBV_WR_RDMA_READ: {
+            auto remote = resolve(workRequest.wr.rdma.rkey, workRequest.wr.rdma.remote_addr, length,
+                                  IBV_ACCESS_REMOTE_READ);
+            if (remote == nullptr) {
+               completion.status = IBV_WC_REM_ACCESS_ERR;
+               break;
+            }
+            vector<uint8_t> fetched(remote, remote + length);
+            scatterLocal(fetched.data());
+            break;
+         }
+         case IBV_WR_ATOMIC_FETCH_AND_ADD:
+         case IBV_WR_ATOMIC_CMP_AND_SWP: {
+            auto remote = resolve(workRequest.wr.atomic.rkey, workRequest.wr.atomic.remote_addr, sizeof(uint64_t),
+                                  IBV_ACCESS_REMOTE_ATOMIC);
+            if (remote == nullptr || length != sizeof(uint64_t)) {
+               completion.status = IBV_WC_REM_ACCESS_ERR;
+               break;
+            }
+            auto word = reinterpret_cast<uint64_t *>(remote);
+            uint64_t previous;
+            if (workRequest.opcode == IBV_WR_ATOMIC_FETCH_AND_ADD) {
+               previous = __atomic_fetch_add(word, workRequest.wr.atomic.compare_add, __ATOMIC_SEQ_CST);
+            } else {
+               previous = workRequest.wr.atomic.compare_add;
+               __atomic_compare_exchange_n(word, &previous, workRequest.wr.atomic.swap, false, __ATOMIC_SEQ_CST,
+                                           __ATOMIC_SEQ_CST);
+            }
+            scatterLocal(reinterpret_cast<const uint8_t *>(&previous));
+            break;
+         }
+         case IBV_WR_SEND:
+         case IBV_WR_SEND_WITH_IMM: {
+            const bool datagram = queuePair.verbs->qp_type == IBV_QPT_UD;
+            const auto target = queuePairs.find(datagram ? workRequest.wr.ud.remote_qpn
+                                                         : queuePair.attributes.dest_qp_num);
+            if (target == queuePairs.end() || target->second->sharedReceiveQueue == nullptr) {
+               // Datagrams to nowhere are silently lost
+               if (!datagram) {
+                  completion.status = IBV_WC_RETRY_EXC_ERR;
+               }
+               break;
+            }
+            auto &receives = target->second->sharedReceiveQueue->receives;
+            if (receives.empty()) {
+               return false;
+            }
+            auto receive = move(receives.front());
+            receives.pop_front();
+
+            // Datagrams are received behind the global routing header
+            vector<uint8_t> message(datagram ? GRH_SIZE : 0);
+            message.insert(message.end(), data.begin(), data.end());
+            ibv_wc arrival{};
+            arrival.wr_id = receive.id;
+            arrival.status = IBV_WC_SUCCESS;
+            arrival.opcode = IBV_WC_RECV;
+            arrival.qp_num = target->second->verbs->qp_num;
+            arrival.src_qp = queuePair.verbs->qp_num;
+            arrival.byte_len = static_cast<uint32_t>(message.size());
+            if (workRequest.opcode == IBV_WR_SEND_WITH_IMM) {
+               arrival.wc_flags = IBV_WC_WITH_IMM;
+               arrival.imm_data = workRequest.imm_data;
+            }
+            size_t offset = 0;
+            for (auto &element : receive.scatterElements) {
+               const size_t part = min<size_t>(element.length, message.size() - offset);
+               orderedCopy(reinterpret_cast<uint8_t *>(element.addr), message.data() + offset, part);
+               offset += part;
+            }
+            if (offset != message.size()) {
+               arrival.status = IBV_WC_LOC_LEN_ERR;
+            }
+            target->second->receiveQueue->push(arrival);
+            break;
+         }
+         default:
+            completion.status = IBV_WC_REM_INV_REQ_ERR;
+      }
+   }
+
+   // Failed requests always complete
+   if ((workRequest.send_flags & IBV_SEND_SIGNALED) || queuePair.initAttributes.sq_sig_all ||
+       completion.status != IBV_WC_SUCCESS) {
+      queuePair.sendQueue->push(completion, queuePair.sendQueueFreed, operation.sequence);
+   }
+   return true;
+}
+//---------------------------------------------------------------------------
+} // End of namespace rdma
+//---------------------------------------------------------------------------
@@ -0,0 +1,125 @@
+#pragma once
+//---------------------------------------------------------------------------
+#include "Backend.hpp"
+//---------------------------------------------------------------------------
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+//---------------------------------------------------------------------------
+namespace rdma {
+//---------------------------------------------------------------------------
+/// Performs work requests in software, so the protocols can be run and profiled without an HCA. A worker thread
+/// carries out WRITEs, READs, SENDs and atomics between the registered memory of this process, after a fixed latency
+/// and serialized by the bandwidth of the emulated link of their port. Queue pairs can only be connected within the
+/// process. Set up with RDMA_BACKEND=emulated, RDMA_EMULATED_LATENCY_NS (default 1000), RDMA_EMULATED_GBITS (default
+/// 100, per port), RDMA_EMULATED_PORTS (default 1) and RDMA_EMULATED_QP_GBITS (default 0 for unlimited), the rate at
+/// which a single queue pair is processed
+    class EmulatedBackend : public Backend {
+    public:
+        EmulatedBackend(std::chrono::nanoseconds latency, double gigabitsPerSecond, uint8_t ports = 1,
+                        double queuePairGigabitsPerSecond = 0);
+
+        ~EmulatedBackend() override;
+
+        ibv_device **getDeviceList(int *count) override;
+
+        void freeDeviceList(ibv_device **devices) override;
+
+        ibv_context *openDevice(ibv_device *device) override;
+
+        int closeDevice(ibv_context *context) override;
+
+        int queryDevice(ibv_context *context, ibv_device_attr *attributes) override;
+
+        int queryPort(ibv_context *context, uint8_t port, ibv_port_attr *attributes) override;
+
+        int queryGid(ibv_context *context, uint8_t port, int index, ibv_gid *gid) override;
+
+        ibv_pd *allocPd(ibv_context *context) override;
+
+        int deallocPd(ibv_pd *protectionDomain) override;
+
+        ibv_mr *regMr(ibv_pd *protectionDomain, void *address, size_t length, int access) override;
+
+        int deregMr(ibv_mr *memoryRegion) override;
+
+        ibv_comp_channel *createCompChannel(ibv_context *context) override;
+
+        int destroyCompChannel(ibv_comp_channel *channel) override;
+
+        ibv_cq *createCq(ibv_context *context, int entries, ibv_comp_channel *channel) override;
+
+        int destroyCq(ibv_cq *completionQueue) override;
+
+        int reqNotifyCq(ibv_cq *completionQueue, int solicitedOnly) override;
+
+        int getCqEvent(ibv_comp_channel *channel, ibv_cq **completionQueue, void **context) override;
+
+        void ackCqEvents(ibv_cq *completionQueue, unsigned count) override;
+
+        int pollCq(ibv_cq *completionQueue, int entries, ibv_wc *completions) override;
+
+        ibv_srq *createSrq(ibv_pd *protectionDomain, ibv_srq_init_attr *attributes) override;
+
+        int destroySrq(ibv_srq *receiveQueue) override;
+
+        int postSrqRecv(ibv_srq *receiveQueue, ibv_recv_wr *workRequests, ibv_recv_wr **badWorkRequest) override;
+
+        ibv_qp *createQp(ibv_pd *protectionDomain, ibv_qp_init_attr *attributes) override;
+
+        int destroyQp(ibv_qp *queuePair) override;
+
+        int modifyQp(ibv_qp *queuePair, ibv_qp_attr *attributes, int mask) override;
+
+        int queryQp(ibv_qp *queuePair, ibv_qp_attr *attributes, int mask, ibv_qp_init_attr *initAttributes) override;
+
+        int postSend(ibv_qp *queuePair, ibv_send_wr *workRequests, ibv_send_wr **badWorkRequest) override;
+
+        ibv_ah *createAh(ibv_pd *protectionDomain, ibv_ah_attr *attributes) override;
+
+        int destroyAh(ibv_ah *addressHandle) override;
+
+        struct Registration;
+        struct CompletionQueue;
+        struct Channel;
+        struct ReceiveQueue;
+        struct QueuePair;
+        struct Operation;
+
+    private:
+        /// Wait this long before retrying a SEND that found no receive buffer
+        static const std::chrono::microseconds RNR_DELAY;
+
+        const std::chrono::nanoseconds latency;
+        const double bytesPerNanosecond;
+        /// Of a single queue pair, 0 if only the link limits it
+        const double queuePairBytesPerNanosecond;
+        const uint8_t ports;
+
+        /// Protects everything but the completion queues
+        std::mutex guard;
+        std::condition_variable operationsPosted;
+        std::unordered_map<uint32_t, Registration *> registrations;
+        /// By queue pair number, ties of due times go to the lower number
+        std::map<uint32_t, QueuePair *> queuePairs;
+        uint32_t nextKey = 1;
+        uint32_t nextQueuePairNumber = 1;
+        /// By port, when its emulated link has transferred everything posted so far
+        std::map<uint8_t, std::chrono::steady_clock::time_point> linkFree;
+        bool running = true;
+        std::thread worker;
+
+        void run();
+
+        /// Carry out an operation, false if it has to be retried (no receive buffer)
+        bool execute(QueuePair &queuePair, Operation &operation);
+
+        /// The registered memory [address, address + length) with the given key and access, nullptr if not accessible
+        uint8_t *resolve(uint32_t key, uint64_t address, size_t length, int access);
+    };
+//---------------------------------------------------------------------------
+} // End of namespace rdma
+//---------------------------------------------------------------------------
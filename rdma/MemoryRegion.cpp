@@ -19,6 +19,7 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 //---------------------------------------------------------------------------
 #include "MemoryRegion.hpp"
+#include "Backend.hpp"
 #include "Network.hpp"
 //---------------------------------------------------------------------------
 #include <infiniband/verbs.h>
@@ -57,7 +58,7 @@ namespace rdma {
 //---------------------------------------------------------------------------
     MemoryRegion::MemoryRegion(void *address, size_t size, ibv_pd *protectionDomain, Permission permissions) : address(
             address), size(size) {
-        key = ::ibv_reg_mr(protectionDomain, address, size, convertPermissions(permissions));
+        key = Backend::get().regMr(protectionDomain, address, size, convertPermissions(permissions));
         if (key == nullptr) {
             string reason = "registering memory failed with error " + to_string(errno) + ": " + strerror(errno);
             cerr << reason << endl;
@@ -67,7 +68,7 @@ namespace rdma {
 
 //---------------------------------------------------------------------------
     MemoryRegion::~MemoryRegion() {
-        if (::ibv_dereg_mr(key) != 0) {
+        if (Backend::get().deregMr(key) != 0) {
             string reason = "deregistering memory failed with error " + to_string(errno) + ": " + strerror(errno);
             cerr << reason << endl;
             throw NetworkException(reason);
@@ -75,7 +76,7 @@ namespace rdma {
     }
 
     MemoryRegion::Slice MemoryRegion::slice(size_t offset, size_t size) {
-        return MemoryRegion::Slice(reinterpret_cast<uint8_t *>(address) + offset, size, key->lkey);
+        return MemoryRegion::Slice(reinterpret_cast<uint8_t *>(address) + offset, size, key->lkey, key->rkey);
     }
 
 //---------------------------------------------------------------------------
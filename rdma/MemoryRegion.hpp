@@ -50,7 +50,9 @@ public:
         void *address;
         size_t size;
         uint32_t lkey;
-        Slice(void *address, size_t size, uint32_t lkey) : address(address), size(size), lkey(lkey) {}
+        uint32_t rkey;
+        Slice(void *address, size_t size, uint32_t lkey, uint32_t rkey = 0) : address(address), size(size), lkey(lkey),
+                                                                             rkey(rkey) {}
     };
 
    ibv_mr *key;
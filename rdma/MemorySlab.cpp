@@ -0,0 +1,202 @@
+#include "MemorySlab.hpp"
+#include "Network.hpp"
+//---------------------------------------------------------------------------
+#include <linux/mempolicy.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+//---------------------------------------------------------------------------
+using namespace std;
+//---------------------------------------------------------------------------
+namespace rdma {
+//---------------------------------------------------------------------------
+    static size_t roundUp(size_t value, size_t alignment) {
+        return (value + alignment - 1) & ~(alignment - 1);
+    }
+
+//---------------------------------------------------------------------------
+    MemorySlab::Allocation::~Allocation() {
+        if (slab != nullptr) {
+            slab->free(slice);
+        }
+    }
+
+//---------------------------------------------------------------------------
+    static size_t bytesPerPage(MemorySlab::PageSize pageSize) {
+        switch (pageSize) {
+            case MemorySlab::PageSize::Huge1GB:
+                return 1024 * 1024 * 1024;
+            case MemorySlab::PageSize::Huge2MB:
+                return 2 * 1024 * 1024;
+            default:
+                return 4096;
+        }
+    }
+
+//---------------------------------------------------------------------------
+    MemorySlab::PageSize MemorySlab::parsePageSize(const char *description) {
+        if (description == nullptr) {
+            return PageSize::Regular;
+        }
+        const string size(description);
+        if (size == "1G" || size == "1g") {
+            return PageSize::Huge1GB;
+        }
+        if (size == "2M" || size == "2m") {
+            return PageSize::Huge2MB;
+        }
+        return PageSize::Regular;
+    }
+
+//---------------------------------------------------------------------------
+    MemorySlab::Mapping::Mapping(Mapping &&other) noexcept : address(other.address), size(other.size),
+                                                    pageSize(other.pageSize) {
+        other.address = nullptr;
+    }
+
+//---------------------------------------------------------------------------
+    MemorySlab::Mapping::~Mapping() {
+        if (address != nullptr) {
+            ::munmap(address, size);
+        }
+    }
+
+//---------------------------------------------------------------------------
+    MemorySlab::Mapping MemorySlab::map(size_t size, PageSize pageSize, int numaNode) {
+        int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+        if (pageSize == PageSize::Huge2MB) {
+            flags |= MAP_HUGETLB | (21 << MAP_HUGE_SHIFT);
+        } else if (pageSize == PageSize::Huge1GB) {
+            flags |= MAP_HUGETLB | (30 << MAP_HUGE_SHIFT);
+        }
+
+        Mapping mapping;
+        mapping.size = roundUp(size, bytesPerPage(pageSize));
+        mapping.pageSize = pageSize;
+        auto address = ::mmap(nullptr, mapping.size, PROT_READ | PROT_WRITE, flags, -1, 0);
+        if (address == MAP_FAILED) {
+            if (pageSize == PageSize::Regular) {
+                string reason = "mapping memory failed with error " + to_string(errno) + ": " + strerror(errno);
+                cerr << reason << endl;
+                throw NetworkException(reason);
+            }
+            // Not enough huge pages reserved, try the next smaller page size
+            return map(size, pageSize == PageSize::Huge1GB ? PageSize::Huge2MB : PageSize::Regular, numaNode);
+        }
+        mapping.address = reinterpret_cast<uint8_t *>(address);
+
+        // The policy has to be in place before the first touch, the raw syscall avoids depending on libnuma
+        if (numaNode >= 0 && numaNode < static_cast<int>(sizeof(unsigned long) * 8)) {
+            const unsigned long nodeMask = 1ul << numaNode;
+            ::syscall(SYS_mbind, mapping.address, mapping.size, MPOL_PREFERRED, &nodeMask, sizeof(nodeMask) * 8, 0);
+        }
+
+        // Prefault the whole chunk, so the first messages don't pay for page faults
+        for (size_t offset = 0; offset < mapping.size; offset += bytesPerPage(pageSize)) {
+            mapping.address[offset] = 0;
+        }
+
+        // Registration pins the pages anyway, locking them only fails when RLIMIT_MEMLOCK is too small for that, too
+        ::mlock(mapping.address, mapping.size);
+        return mapping;
+    }
+
+//---------------------------------------------------------------------------
+    MemorySlab::MemorySlab(ibv_pd *protectionDomain, size_t chunkSize) : protectionDomain(protectionDomain),
+                                                                         chunkSize(chunkSize) {
+    }
+
+//---------------------------------------------------------------------------
+    MemorySlab::~MemorySlab() = default;
+
+//---------------------------------------------------------------------------
+    MemorySlab::Chunk &MemorySlab::allocateChunk(size_t minimumSize, MemoryRegion::Permission permissions) {
+        Chunk chunk{map(max(chunkSize, minimumSize), pageSize, numaNode), nullptr, permissions, 0};
+        chunk.region = make_unique<MemoryRegion>(chunk.memory.address, chunk.memory.size, protectionDomain,
+                                                 permissions);
+        chunks.push_back(move(chunk));
+        return chunks.back();
+    }
+
+//---------------------------------------------------------------------------
+    void MemorySlab::setPageSize(PageSize pageSize) {
+        lock_guard<mutex> lock(guard);
+        this->pageSize = pageSize;
+    }
+
+//---------------------------------------------------------------------------
+    void MemorySlab::setNumaNode(int numaNode) {
+        lock_guard<mutex> lock(guard);
+        this->numaNode = numaNode;
+    }
+
+//---------------------------------------------------------------------------
+    MemoryRegion::Slice MemorySlab::allocate(size_t size, MemoryRegion::Permission permissions, size_t alignment) {
+        alignment = max(alignment, size_t(64)); // never share a cache line between two slices
+        size = roundUp(size, alignment);
+
+        lock_guard<mutex> lock(guard);
+
+        // Reuse a returned slice of the same size and permissions
+        auto freeList = freeSlices.find(make_pair(permissions, size));
+        if (freeList != freeSlices.end()) {
+            auto &candidates = freeList->second;
+            auto fitting = find_if(candidates.begin(), candidates.end(), [&](const MemoryRegion::Slice &slice) {
+                return (reinterpret_cast<uintptr_t>(slice.address) & (alignment - 1)) == 0;
+            });
+            if (fitting != candidates.end()) {
+                auto slice = *fitting;
+                candidates.erase(fitting);
+                memset(slice.address, 0, slice.size);
+                return slice;
+            }
+        }
+
+        // Carve from the first chunk with these permissions and enough space left
+        auto alignedOffset = [&](const Chunk &chunk) {
+            const auto base = reinterpret_cast<uintptr_t>(chunk.memory.address);
+            return roundUp(base + chunk.used, alignment) - base;
+        };
+        auto fitting = find_if(chunks.begin(), chunks.end(), [&](const Chunk &chunk) {
+            return chunk.permissions == permissions && alignedOffset(chunk) + size <= chunk.region->size;
+        });
+        Chunk &chunk = fitting != chunks.end() ? *fitting : allocateChunk(size + alignment, permissions);
+        const auto offset = alignedOffset(chunk);
+        chunk.used = offset + size;
+        return chunk.region->slice(offset, size);
+    }
+
+//---------------------------------------------------------------------------
+    void MemorySlab::free(const MemoryRegion::Slice &slice) {
+        lock_guard<mutex> lock(guard);
+        const auto address = reinterpret_cast<uint8_t *>(slice.address);
+        auto owner = find_if(chunks.begin(), chunks.end(), [&](const Chunk &chunk) {
+            return address >= chunk.memory.address && address < chunk.memory.address + chunk.memory.size;
+        });
+        if (owner == chunks.end()) {
+            string reason = "freeing a slice that was not allocated from this slab";
+            cerr << reason << endl;
+            throw NetworkException(reason);
+        }
+        auto &freeList = freeSlices[make_pair(owner->permissions, slice.size)];
+        if (any_of(freeList.begin(), freeList.end(), [&](const MemoryRegion::Slice &free) {
+            return free.address == slice.address;
+        })) {
+            string reason = "freeing a slice twice";
+            cerr << reason << endl;
+            throw NetworkException(reason);
+        }
+        freeList.push_back(slice);
+    }
+
+//---------------------------------------------------------------------------
+    size_t MemorySlab::getRegionCount() {
+        lock_guard<mutex> lock(guard);
+        return chunks.size();
+    }
+//---------------------------------------------------------------------------
+} // End of namespace rdma
+//---------------------------------------------------------------------------
@@ -0,0 +1,126 @@
+#pragma once
+//---------------------------------------------------------------------------
+#include "MemoryRegion.hpp"
+//---------------------------------------------------------------------------
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+//---------------------------------------------------------------------------
+struct ibv_pd;
+//---------------------------------------------------------------------------
+namespace rdma {
+//---------------------------------------------------------------------------
+/// Hands out slices of a few large, pre-registered memory regions.
+/// Registering memory is a costly control path operation and every region needs its own translation entries on the
+/// NIC, so connections carve their rings and control blocks out of the slab instead of registering them separately.
+/// Each chunk is registered with a single set of permissions and only hands out slices asking for exactly these, so
+/// a remote key of one connection's ring never grants access to memory of another kind, e.g. send buffers. It does
+/// grant access to the other slices of its chunk: all receive rings and doorbells share a key, connections are not
+/// isolated from each other.
+class MemorySlab {
+public:
+    /// Owning handle of a slice, returns it to the slab on destruction
+    class Allocation {
+        MemorySlab *slab;
+    public:
+        MemoryRegion::Slice slice;
+
+        Allocation(MemorySlab &slab, const MemoryRegion::Slice &slice) : slab(&slab), slice(slice) {}
+
+        Allocation(Allocation &&other) : slab(other.slab), slice(other.slice) { other.slab = nullptr; }
+
+        Allocation(Allocation const &) = delete;
+
+        Allocation &operator=(Allocation const &) = delete;
+
+        ~Allocation();
+
+        template<typename T>
+        T *as() const { return reinterpret_cast<T *>(slice.address); }
+    };
+
+    /// Default size of a chunk, requests larger than this get a chunk of their own
+    static const size_t DEFAULT_CHUNK_SIZE = 64 * 1024 * 1024;
+
+    /// Pages backing the chunks. Huge pages need far fewer TLB entries on the CPU and translation entries on the NIC,
+    /// but have to be reserved by the administrator (vm.nr_hugepages / hugepagesz=1G)
+    enum class PageSize : uint8_t {
+        Regular,
+        Huge2MB,
+        Huge1GB
+    };
+
+    /// Parse "2M" / "1G" (anything else is Regular)
+    static PageSize parsePageSize(const char *description);
+
+private:
+    /// Anonymous memory mapping, prefaulted (on the preferred NUMA node) and locked
+    struct Mapping {
+        uint8_t *address = nullptr;
+        size_t size = 0;
+        PageSize pageSize = PageSize::Regular;
+
+        Mapping() = default;
+
+        Mapping(Mapping &&other) noexcept;
+
+        Mapping(Mapping const &) = delete;
+
+        Mapping &operator=(Mapping const &) = delete;
+
+        ~Mapping();
+    };
+
+    struct Chunk {
+        Mapping memory;
+        std::unique_ptr<MemoryRegion> region;
+        MemoryRegion::Permission permissions;
+        size_t used;
+    };
+
+    ibv_pd *protectionDomain;
+    const size_t chunkSize;
+    /// The preferred page size, chunks fall back to smaller pages when no huge pages are available
+    PageSize pageSize = PageSize::Regular;
+    /// The NUMA node chunks are placed on (-1 for the default policy)
+    int numaNode = -1;
+    std::vector<Chunk> chunks;
+    /// Slices given back to the slab, by permissions and size
+    std::map<std::pair<MemoryRegion::Permission, size_t>, std::vector<MemoryRegion::Slice>> freeSlices;
+    /// Protect the slab from concurrent access
+    std::mutex guard;
+
+    Chunk &allocateChunk(size_t minimumSize, MemoryRegion::Permission permissions);
+
+    static Mapping map(size_t size, PageSize pageSize, int numaNode);
+
+public:
+    /// Constructor
+    MemorySlab(ibv_pd *protectionDomain, size_t chunkSize = DEFAULT_CHUNK_SIZE);
+
+    /// Destructor
+    ~MemorySlab();
+
+    /// Set the preferred page size for chunks allocated from now on
+    void setPageSize(PageSize pageSize);
+
+    /// Place chunks allocated from now on on the given NUMA node
+    void setNumaNode(int numaNode);
+
+    /// Get a zeroed slice of (at least) size bytes with the given permissions, aligned to alignment (a power of 2)
+    MemoryRegion::Slice allocate(size_t size, MemoryRegion::Permission permissions, size_t alignment = 64);
+
+    /// Return a slice obtained from allocate()
+    void free(const MemoryRegion::Slice &slice);
+
+    /// Number of registered memory regions backing the slab
+    size_t getRegionCount();
+
+    MemorySlab(MemorySlab const &) = delete;
+
+    MemorySlab &operator=(MemorySlab const &) = delete;
+};
+//---------------------------------------------------------------------------
+} // End of namespace rdma
+//---------------------------------------------------------------------------
@@ -20,20 +20,81 @@
 //---------------------------------------------------------------------------
 #include "Network.hpp"
 //---------------------------------------------------------------------------
+#include "Backend.hpp"
 #include "WorkRequest.hpp"
 #include "QueuePair.hpp"
 #include "ReceiveQueue.hpp"
 #include "CompletionQueuePair.hpp"
+#include "MemorySlab.hpp"
+#include "RegistrationCache.hpp"
 //---------------------------------------------------------------------------
+#include <algorithm>
+#include <cstdlib>
 #include <cstring>
 #include <infiniband/verbs.h>
+#include <linux/mempolicy.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <fstream>
 #include <iostream>
 #include <iomanip>
+#include <sstream>
 //---------------------------------------------------------------------------
 using namespace std;
 //---------------------------------------------------------------------------
 namespace rdma {
 //---------------------------------------------------------------------------
+namespace {
+//---------------------------------------------------------------------------
+string readDeviceAttribute(ibv_device *device, const string &attribute)
+/// Read a file of the device's sysfs directory (empty if not available)
+{
+   ifstream file(string(device->ibdev_path) + "/device/" + attribute);
+   string value;
+   getline(file, value);
+   return value;
+}
+//---------------------------------------------------------------------------
+string readGidType(ibv_device *device, uint8_t port, int index)
+/// The type of a GID table entry, e.g. "IB/RoCE v1" or "RoCE v2" (empty if not available)
+{
+   ifstream file(string(device->ibdev_path) + "/ports/" + to_string(port) + "/gid_attrs/types/" + to_string(index));
+   string value;
+   getline(file, value);
+   return value;
+}
+//---------------------------------------------------------------------------
+bool isIPv4Mapped(const ibv_gid &gid)
+/// Whether the GID is an IPv4 address (::ffff:a.b.c.d), as RoCE v2 uses for the interface's IPv4 addresses
+{
+   static const uint8_t prefix[12] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff};
+   return memcmp(gid.raw, prefix, sizeof(prefix)) == 0;
+}
+//---------------------------------------------------------------------------
+cpu_set_t parseCpuList(const string &cpuList)
+/// Parse the sysfs cpulist format, e.g. "0-7,16-23"
+{
+   cpu_set_t cpus;
+   CPU_ZERO(&cpus);
+   stringstream ranges(cpuList);
+   string range;
+   while (getline(ranges, range, ',')) {
+      if (range.empty()) {
+         continue;
+      }
+      const auto dash = range.find('-');
+      const auto first = stoul(range.substr(0, dash));
+      const auto last = dash == string::npos ? first : stoul(range.substr(dash + 1));
+      for (auto cpu = first; cpu <= last && cpu < CPU_SETSIZE; ++cpu) {
+         CPU_SET(cpu, &cpus);
+      }
+   }
+   return cpus;
+}
+//---------------------------------------------------------------------------
+}
+//---------------------------------------------------------------------------
 ostream &operator<<(ostream &os, const RemoteMemoryRegion &remoteMemoryRegion)
 {
     return os << "address=" << reinterpret_cast<void *>(remoteMemoryRegion.address) << " key="
@@ -42,40 +103,163 @@ ostream &operator<<(ostream &os, const RemoteMemoryRegion &remoteMemoryRegion)
 //---------------------------------------------------------------------------
 ostream &operator<<(ostream &os, const Address &address)
 {
-   return os << "lid=" << address.lid << ", qpn=" << address.qpn;
+   os << "lid=" << address.lid << ", qpn=" << address.qpn << ", psn=" << address.psn << ", mtu=" << address.mtu;
+   if (any_of(begin(address.gid), end(address.gid), [](uint8_t byte) { return byte != 0; })) {
+      os << ", gid=" << hex << setfill('0');
+      for (size_t i = 0; i != sizeof(address.gid); i += 2) {
+         os << (i ? ":" : "") << setw(2) << unsigned(address.gid[i]) << setw(2) << unsigned(address.gid[i + 1]);
+      }
+      os << dec << setfill(' ');
+   }
+   return os;
+}
+//---------------------------------------------------------------------------
+ostream &operator<<(ostream &os, const Rail &rail)
+{
+   return os << rail.device << ":" << unsigned(rail.port);
+}
+//---------------------------------------------------------------------------
+vector<Rail> Network::listRails()
+/// The active ports of all devices
+{
+   int deviceCount;
+   auto devices = Backend::get().getDeviceList(&deviceCount);
+   if (!devices) {
+      string reason = "unable to get the list of available devices";
+      cerr << reason << endl;
+      throw NetworkException(reason);
+   }
+
+   vector<Rail> rails;
+   for (int i = 0; i < deviceCount; ++i) {
+      auto context = Backend::get().openDevice(devices[i]);
+      if (!context) {
+         continue;
+      }
+      const auto numaNodeAttribute = readDeviceAttribute(devices[i], "numa_node");
+      const int numaNode = numaNodeAttribute.empty() ? -1 : stoi(numaNodeAttribute);
+      struct ibv_device_attr deviceAttributes;
+      if (Backend::get().queryDevice(context, &deviceAttributes) == 0) {
+         for (uint8_t port = 1; port <= deviceAttributes.phys_port_cnt; ++port) {
+            struct ibv_port_attr portAttributes;
+            if (Backend::get().queryPort(context, port, &portAttributes) == 0 && portAttributes.state == IBV_PORT_ACTIVE) {
+               rails.push_back(Rail{devices[i]->name, port, numaNode});
+            }
+         }
+      }
+      Backend::get().closeDevice(context);
+   }
+   Backend::get().freeDeviceList(devices);
+   return rails;
+}
+//---------------------------------------------------------------------------
+Rail Network::findRail(const string &name)
+/// Find the rail <device>[:<port>]
+{
+   const auto colon = name.find(':');
+   const auto device = name.substr(0, colon);
+   const int port = colon == string::npos ? 0 : atoi(name.c_str() + colon + 1);
+   for (auto &rail : listRails()) {
+      if (rail.device == device && (port == 0 || rail.port == port)) {
+         return rail;
+      }
+   }
+   string reason = "no active port " + name;
+   cerr << reason << endl;
+   throw NetworkException(reason);
+}
+//---------------------------------------------------------------------------
+Rail Network::selectRail()
+/// The rail named by RDMA_DEVICE, otherwise the first one close to the calling thread
+{
+   if (const char *name = getenv("RDMA_DEVICE")) {
+      return findRail(name);
+   }
+   const auto rails = listRails();
+   if (rails.empty()) {
+      string reason = "no active Infiniband ports available";
+      cerr << reason << endl;
+      throw NetworkException(reason);
+   }
+   const auto node = getCurrentNumaNode();
+   for (auto &rail : rails) {
+      if (rail.numaNode == node) {
+         return rail;
+      }
+   }
+   return rails.front();
+}
+//---------------------------------------------------------------------------
+int Network::getCurrentNumaNode()
+/// The NUMA node of the CPU the calling thread runs on
+{
+   unsigned cpu = 0;
+   unsigned node = 0;
+   if (::syscall(SYS_getcpu, &cpu, &node, nullptr) != 0) {
+      return -1;
+   }
+   return static_cast<int>(node);
 }
 //---------------------------------------------------------------------------
 Network::Network()
-        : ibport(1)
+        : Network(selectRail())
+/// Constructor
+{
+}
+//---------------------------------------------------------------------------
+Network::Network(const Rail &rail)
+        : rail(rail)
+          , ibport(rail.port)
 /// Constructor
 {
    // Get the device list
    int deviceCount;
-   devices = ::ibv_get_device_list(&deviceCount);
+   devices = Backend::get().getDeviceList(&deviceCount);
    if (!devices) {
       string reason = "unable to get the list of available devices";
       cerr << reason << endl;
       throw NetworkException(reason);
-   } else if (deviceCount == 0) {
-      string reason = "no Infiniband devices available";
-      cerr << reason << endl;
-      throw NetworkException(reason);
-   } else if (deviceCount>1) {
-      string reason = "more than 1 Infiniband devices available .. not handled right now";
+   }
+   device = nullptr;
+   for (int i = 0; i < deviceCount; ++i) {
+      if (rail.device == devices[i]->name) {
+         device = devices[i];
+      }
+   }
+   if (device == nullptr) {
+      Backend::get().freeDeviceList(devices);
+      string reason = "no Infiniband device " + rail.device + " available";
       cerr << reason << endl;
       throw NetworkException(reason);
    }
 
+   // Find out where the device is attached, so we can place memory and threads close to it
+   numaNode = rail.numaNode;
+   localCpus = readDeviceAttribute(device, "local_cpulist");
+
    // Get the verbs context
-   context = ::ibv_open_device(devices[0]);
+   context = Backend::get().openDevice(device);
    if (!context) {
       string reason = "unable to open the device";
       cerr << reason << endl;
       throw NetworkException(reason);
    }
 
+   selectGid();
+
+   struct ibv_device_attr deviceAttributes;
+   if (Backend::get().queryDevice(context, &deviceAttributes) != 0) {
+      string reason = "querying the device failed with error " + to_string(errno) + ": " + strerror(errno);
+      cerr << reason << endl;
+      throw NetworkException(reason);
+   }
+   limits.maxWorkRequests = static_cast<uint32_t>(deviceAttributes.max_qp_wr);
+   limits.maxReceiveQueueSize = static_cast<uint32_t>(deviceAttributes.max_srq_wr);
+   limits.maxInitiatorReads = static_cast<uint8_t>(min(deviceAttributes.max_qp_init_rd_atom, 255));
+   limits.maxResponderReads = static_cast<uint8_t>(min(deviceAttributes.max_qp_rd_atom, 255));
+
    // Create the protection domain
-   protectionDomain = ::ibv_alloc_pd(context);
+   protectionDomain = Backend::get().allocPd(context);
    if (protectionDomain == nullptr) {
       string reason = "allocating the protection domain failed with error " + to_string(errno) + ": " + strerror(errno);
       cerr << reason << endl;
@@ -84,6 +268,9 @@ Network::Network()
 
    sharedReceiveQueue = make_unique<ReceiveQueue>(*this);
    sharedCompletionQueuePair = make_unique<CompletionQueuePair>(*this);
+   memorySlab = make_unique<MemorySlab>(protectionDomain);
+   memorySlab->setNumaNode(numaNode);
+   registrationCache = make_unique<RegistrationCache>(protectionDomain);
 }
 //---------------------------------------------------------------------------
 Network::~Network()
@@ -93,9 +280,13 @@ Network::~Network()
     delete rq;
     auto cqp = sharedCompletionQueuePair.release();
     delete cqp;
+    auto slab = memorySlab.release();
+    delete slab;
+    auto cache = registrationCache.release();
+    delete cache;
 
     // Deallocate the protection domain
-    auto status = ::ibv_dealloc_pd(protectionDomain);
+    auto status = Backend::get().deallocPd(protectionDomain);
     if (status != 0) {
         string reason =
                 "deallocating the protection domain failed with error " + to_string(errno) + ": " + strerror(errno);
@@ -104,7 +295,7 @@ Network::~Network()
     }
 
     // Close context
-    status = ::ibv_close_device(context);
+    status = Backend::get().closeDevice(context);
     if (status != 0) {
         string reason = "closing the verbs context failed with error " + to_string(errno) + ": " + strerror(errno);
         cerr << reason << endl;
@@ -112,14 +303,14 @@ Network::~Network()
     }
 
     // Free devices
-    ::ibv_free_device_list(devices);
+    Backend::get().freeDeviceList(devices);
 }
 //---------------------------------------------------------------------------
 uint16_t Network::getLID()
 /// Get the LID
 {
    struct ibv_port_attr attributes;
-   int status = ::ibv_query_port(context, ibport, &attributes);
+   int status = Backend::get().queryPort(context, ibport, &attributes);
    if (status != 0) {
       string reason = "querying port " + to_string(ibport) + " failed with error " + to_string(errno) + ": " + strerror(errno);
       cerr << reason << endl;
@@ -128,6 +319,164 @@ uint16_t Network::getLID()
    return attributes.lid;
 }
 //---------------------------------------------------------------------------
+size_t Network::getMtu()
+/// Get the active MTU
+{
+   struct ibv_port_attr attributes;
+   int status = Backend::get().queryPort(context, ibport, &attributes);
+   if (status != 0) {
+      string reason = "querying port " + to_string(ibport) + " failed with error " + to_string(errno) + ": " + strerror(errno);
+      cerr << reason << endl;
+      throw NetworkException(reason);
+   }
+   return size_t(128) << attributes.active_mtu; // IBV_MTU_256 is 1
+}
+//---------------------------------------------------------------------------
+void Network::selectGid()
+/// Use a GID with RoCE (prefer RoCE v2 and IPv4) or if RDMA_GID_INDEX is set
+{
+   struct ibv_port_attr attributes;
+   int status = Backend::get().queryPort(context, ibport, &attributes);
+   if (status != 0) {
+      string reason = "querying port " + to_string(ibport) + " failed with error " + to_string(errno) + ": " + strerror(errno);
+      cerr << reason << endl;
+      throw NetworkException(reason);
+   }
+
+   ibv_gid candidate;
+   if (const char *index = getenv("RDMA_GID_INDEX")) {
+      gidIndex = atoi(index);
+   } else if (attributes.link_layer == IBV_LINK_LAYER_ETHERNET) {
+      // RoCE v2 is routable (UDP/IP), the IPv4 entries work across subnets without IPv6 routes
+      int bestScore = -1;
+      for (int i = 0; i < attributes.gid_tbl_len; ++i) {
+         if (Backend::get().queryGid(context, ibport, i, &candidate) != 0 || candidate.global.interface_id == 0) {
+            continue;
+         }
+         const int score = (readGidType(device, ibport, i) == "RoCE v2" ? 2 : 0) + (isIPv4Mapped(candidate) ? 1 : 0);
+         if (score > bestScore) {
+            bestScore = score;
+            gidIndex = i;
+         }
+      }
+      if (gidIndex < 0) {
+         string reason = "port " + to_string(ibport) + " has no usable GID, is an IP address assigned to its interface?";
+         cerr << reason << endl;
+         throw NetworkException(reason);
+      }
+   } else {
+      return;
+   }
+
+   if (Backend::get().queryGid(context, ibport, gidIndex, &candidate) != 0) {
+      string reason = "querying GID " + to_string(gidIndex) + " failed with error " + to_string(errno) + ": " + strerror(errno);
+      cerr << reason << endl;
+      throw NetworkException(reason);
+   }
+   memcpy(gid, candidate.raw, sizeof(gid));
+}
+//---------------------------------------------------------------------------
+void Network::setRoute(ibv_ah_attr &attributes, const Address &address) const
+/// Route to the address by its GID with global routing, by its LID otherwise
+{
+   // The DSCP / traffic class, which selects the lossless (PFC) or ECN enabled class of Ethernet fabrics
+   static const uint8_t trafficClass = getenv("RDMA_TRAFFIC_CLASS") ? atoi(getenv("RDMA_TRAFFIC_CLASS")) : 0;
+
+   attributes.dlid = address.lid;          // The LID of the remote host (ignored by RoCE)
+   attributes.sl = 0;                      // The service level (which determines the virtual lane)
+   attributes.src_path_bits = 0;           // Use the port base LID
+   attributes.port_num = ibport;           // The local physical port
+   attributes.is_global = usesGlobalRouting(); // Whether there is a global routing header
+   if (attributes.is_global) {
+      memcpy(attributes.grh.dgid.raw, address.gid, sizeof(address.gid)); // The GID of the remote port
+      attributes.grh.sgid_index = gidIndex;       // Our entry of the GID table, determines RoCE v1 / v2 and IPv4 / IPv6
+      attributes.grh.hop_limit = 64;              // Routed (RoCE v2) packets may cross subnets
+      attributes.grh.traffic_class = trafficClass;
+      attributes.grh.flow_label = 0;
+   }
+}
+//---------------------------------------------------------------------------
+int Network::getMaxCompletionQueueSize()
+/// Get the maximal number of entries of a completion queue
+{
+   struct ibv_device_attr attributes;
+   int status = Backend::get().queryDevice(context, &attributes);
+   if (status != 0) {
+      string reason = "querying the device failed with error " + to_string(errno) + ": " + strerror(errno);
+      cerr << reason << endl;
+      throw NetworkException(reason);
+   }
+   return attributes.max_cqe;
+}
+//---------------------------------------------------------------------------
+Network::LocalAllocationScope::LocalAllocationScope(const Network &network)
+        : active(network.numaNode >= 0 && network.numaNode < static_cast<int>(sizeof(unsigned long) * 8))
+{
+   // Leave the policy alone if we can't put the current one back later
+   if (active) {
+      active = ::syscall(SYS_get_mempolicy, &previousMode, previousNodes, sizeof(previousNodes) * 8, nullptr, 0) == 0;
+   }
+   if (active) {
+      const unsigned long nodeMask = 1ul << network.numaNode;
+      active = ::syscall(SYS_set_mempolicy, MPOL_PREFERRED, &nodeMask, sizeof(nodeMask) * 8) == 0;
+   }
+}
+//---------------------------------------------------------------------------
+Network::LocalAllocationScope::~LocalAllocationScope()
+{
+   if (active) {
+      ::syscall(SYS_set_mempolicy, previousMode, previousNodes, sizeof(previousNodes) * 8);
+   }
+}
+//---------------------------------------------------------------------------
+void Network::pinThreadToLocalNode()
+/// Restrict the calling thread to the CPUs close to the device
+{
+   if (localCpus.empty()) {
+      return;
+   }
+   auto cpus = parseCpuList(localCpus);
+   if (::sched_setaffinity(0, sizeof(cpus), &cpus) != 0) {
+      string reason = "pinning the thread to cpus " + localCpus + " failed with error " + to_string(errno) + ": " + strerror(errno);
+      cerr << reason << endl;
+      throw NetworkException(reason);
+   }
+   pinnedThreads = true;
+}
+//---------------------------------------------------------------------------
+void Network::pinThreadToLocalCpu(unsigned index)
+/// Restrict the calling thread to the index-th CPU close to the device (counting modulo their number)
+{
+   cpu_set_t candidates;
+   if (localCpus.empty()) {
+      if (::sched_getaffinity(0, sizeof(candidates), &candidates) != 0) {
+         return;
+      }
+   } else {
+      candidates = parseCpuList(localCpus);
+   }
+   const auto count = CPU_COUNT(&candidates);
+   if (count == 0) {
+      return;
+   }
+   auto remaining = index % count;
+   int cpu = 0;
+   for (; cpu < CPU_SETSIZE; ++cpu) {
+      if (CPU_ISSET(cpu, &candidates) && remaining-- == 0) {
+         break;
+      }
+   }
+   cpu_set_t cpus;
+   CPU_ZERO(&cpus);
+   CPU_SET(cpu, &cpus);
+   if (::sched_setaffinity(0, sizeof(cpus), &cpus) != 0) {
+      string reason = "pinning the thread to cpu " + to_string(cpu) + " failed with error " + to_string(errno) + ": " + strerror(errno);
+      cerr << reason << endl;
+      throw NetworkException(reason);
+   }
+   pinnedThreads = true;
+}
+//---------------------------------------------------------------------------
 void Network::printCapabilities()
 /// Print the capabilities of the RDMA host channel adapter
 {
@@ -272,6 +621,13 @@ void Network::printCapabilities()
    std::cout << std::setw(44) << "  Max number of IPv6 QPs: " << device_attr.max_raw_ipv6_qp << std::endl;
    std::cout << std::setw(44) << "  Max number of Ethertype QPs: " << device_attr.max_raw_ethy_qp << std::endl;
 
+   std::cout << "[Placement]" << std::endl;
+   std::cout << std::setw(44) << "  Device used: " << ibv_get_device_name(this->context->device) << std::endl;
+   std::cout << std::setw(44) << "  NUMA node of the device: " << (numaNode >= 0 ? to_string(numaNode) : "unknown") << std::endl;
+   std::cout << std::setw(44) << "  CPUs local to the device: " << (localCpus.empty() ? "unknown" : localCpus) << std::endl;
+   std::cout << std::setw(44) << "  Rings, control blocks and queues on node: " << (numaNode >= 0 ? to_string(numaNode) : "default policy") << std::endl;
+   std::cout << std::setw(44) << "  Polling threads pinned: " << (pinnedThreads ? "yes" : "no") << std::endl;
+
    // Close the device
    status = ibv_close_device(context);
    if (status) {
@@ -20,12 +20,15 @@
 //---------------------------------------------------------------------------
 #pragma once
 //---------------------------------------------------------------------------
+#include <atomic>
 #include <mutex>
 #include <stdexcept>
+#include <string>
 #include <vector>
 #include <memory>
 
 //---------------------------------------------------------------------------
+struct ibv_ah_attr;
 struct ibv_comp_channel;
 struct ibv_context;
 struct ibv_cq;
@@ -45,6 +48,10 @@ namespace rdma {
 
     class ReceiveQueue;
 
+    class MemorySlab;
+
+    class RegistrationCache;
+
 //---------------------------------------------------------------------------
 /// A network exception
     class NetworkException : public std::runtime_error {
@@ -68,31 +75,65 @@ namespace rdma {
     std::ostream &operator<<(std::ostream &os, const RemoteMemoryRegion &remoteMemoryRegion);
 
 //---------------------------------------------------------------------------
-/// The LID and QPN uniquely address a queue pair
+/// The LID (InfiniBand) or GID (RoCE) and QPN uniquely address a queue pair
     struct Address {
         uint32_t qpn;
         uint16_t lid;
+        /// The port's GID, only used with global routing
+        uint8_t gid[16];
+        /// The first packet sequence number the queue pair sends
+        uint32_t psn;
+        /// The port's active MTU in bytes, a connection's packets have to fit the smaller one of both sides
+        uint32_t mtu;
     };
 
     std::ostream &operator<<(std::ostream &os, const Address &address);
 
+//---------------------------------------------------------------------------
+/// A port of a device, each is a separate path into the fabric
+    struct Rail {
+        std::string device;
+        uint8_t port;
+        /// The NUMA node the device is attached to (-1 if unknown)
+        int numaNode;
+    };
+
+    /// Prints <device>:<port>
+    std::ostream &operator<<(std::ostream &os, const Rail &rail);
+
 //---------------------------------------------------------------------------
 /// Abstracts a global rdma context
     class Network {
+    public:
+        /// Limits of the device, queue pairs and receive queues ask for no more than these
+        struct Limits {
+            uint32_t maxWorkRequests;
+            uint32_t maxReceiveQueueSize;
+            uint8_t maxInitiatorReads;
+            uint8_t maxResponderReads;
+        };
+
+    private:
         friend class CompletionQueuePair;
 
         friend class ReceiveQueue;
 
         friend class QueuePair;
 
+        friend class AddressHandle;
+
         /// The minimal number of entries for the completion queue
         static const int CQ_SIZE = 100;
 
+        /// The device and port
+        Rail rail;
         /// The port of the Infiniband device
         uint8_t ibport;
 
         /// The Infiniband devices
         ibv_device **devices;
+        /// The one of them in use
+        ibv_device *device;
         /// The verbs context
         ibv_context *context;
         /// The global protection domain
@@ -102,19 +143,118 @@ namespace rdma {
         std::unique_ptr<CompletionQueuePair> sharedCompletionQueuePair;
         std::unique_ptr<ReceiveQueue> sharedReceiveQueue;
 
+        /// Pre-registered memory for rings and control blocks
+        std::unique_ptr<MemorySlab> memorySlab;
+        /// Registrations of application memory
+        std::unique_ptr<RegistrationCache> registrationCache;
+
+        /// The NUMA node the device is attached to (-1 if unknown)
+        int numaNode;
+        /// The CPUs close to the device, in sysfs cpulist format (e.g. "0-7,16-23")
+        std::string localCpus;
+
+        /// Queried once, every queue pair is sized by them
+        Limits limits;
+
+        /// The index of the GID packets are sent from, -1 if addressed by LID only (InfiniBand)
+        int gidIndex = -1;
+        /// The GID at gidIndex
+        uint8_t gid[16] = {};
+
+        /// Use a GID with RoCE (prefer RoCE v2 and IPv4) or if RDMA_GID_INDEX is set
+        void selectGid();
+        /// Whether a thread has been pinned to the local CPUs
+        std::atomic<bool> pinnedThreads{false};
+
     public:
-        /// Constructor
+        /// Prefers memory of the device's NUMA node for all allocations of the calling thread within its lifetime,
+        /// e.g. for the queue buffers the verbs provider allocates in user space. Restores the thread's previous policy
+        /// afterwards, e.g. the one set by numactl
+        class LocalAllocationScope {
+            bool active;
+            int previousMode = 0;
+            /// Large enough for the most nodes the kernel supports
+            unsigned long previousNodes[1024 / (sizeof(unsigned long) * 8)] = {};
+        public:
+            LocalAllocationScope(const Network &network);
+
+            ~LocalAllocationScope();
+
+            LocalAllocationScope(LocalAllocationScope const &) = delete;
+
+            LocalAllocationScope &operator=(LocalAllocationScope const &) = delete;
+        };
+
+        /// Constructor, on the rail selectRail() picks
         Network();
 
+        /// Constructor, on the given rail
+        explicit Network(const Rail &rail);
+
+        /// The active ports of all devices
+        static std::vector<Rail> listRails();
+
+        /// Find the rail <device>[:<port>], the first active port of the device if the port is omitted
+        static Rail findRail(const std::string &name);
+
+        /// The rail RDMA_DEVICE (<device>[:<port>]) names, otherwise the first one attached to the NUMA node of the
+        /// calling thread, otherwise the first one
+        static Rail selectRail();
+
+        /// The NUMA node of the CPU the calling thread runs on
+        static int getCurrentNumaNode();
+
         /// Destructor
         ~Network();
 
+        /// Get the device and port
+        const Rail &getRail() const { return rail; }
+
         /// Get the LID
         uint16_t getLID();
 
+        /// Get the active MTU of the port in bytes, the maximal size of a datagram
+        size_t getMtu();
+
+        /// Whether packets carry a global routing header, i.e. remote queue pairs are addressed by their GID
+        bool usesGlobalRouting() const { return gidIndex >= 0; }
+
+        /// Get the index of the GID used as source address (-1 without global routing)
+        int getGidIndex() const { return gidIndex; }
+
+        /// Get the GID used as source address (all zeros without global routing)
+        const uint8_t *getGID() const { return gid; }
+
+        /// Route to the address by its GID with global routing, by its LID otherwise
+        void setRoute(ibv_ah_attr &attributes, const Address &address) const;
+
         /// Get the protection domain
         ibv_pd *getProtectionDomain() { return protectionDomain; }
 
+        /// Get the receive queue shared by all queue pairs created without a dedicated one
+        ReceiveQueue &getSharedReceiveQueue() { return *sharedReceiveQueue; }
+
+        /// Get the slab of pre-registered memory
+        MemorySlab &getMemorySlab() { return *memorySlab; }
+
+        /// Get the cache of registrations of application memory
+        RegistrationCache &getRegistrationCache() { return *registrationCache; }
+
+        /// Get the maximal number of entries of a completion queue supported by the device
+        int getMaxCompletionQueueSize();
+
+        /// Get the limits of the device for queue pairs and receive queues
+        const Limits &getLimits() const { return limits; }
+
+        /// Get the NUMA node of the device (-1 if unknown)
+        int getNumaNode() const { return numaNode; }
+
+        /// Restrict the calling thread to the CPUs close to the device
+        void pinThreadToLocalNode();
+
+        /// Restrict the calling thread to the index-th CPU close to the device (counting modulo their number)
+        void pinThreadToLocalCpu(unsigned index);
+
         /// Print the capabilities of the RDMA host channel adapter
         void printCapabilities();
     };
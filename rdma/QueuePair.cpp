@@ -19,20 +19,29 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 // ---------------------------------------------------------------------------
 #include "QueuePair.hpp"
+#include "Backend.hpp"
 #include "WorkRequest.hpp"
 #include "Network.hpp"
 #include "ReceiveQueue.hpp"
 #include "CompletionQueuePair.hpp"
 //---------------------------------------------------------------------------
+#include <infiniband/verbs.h>
+#include <algorithm>
+#include <cstdlib>
 #include <cstring>
 #include <iostream>
 #include <iomanip>
+#include <random>
 //---------------------------------------------------------------------------
 using namespace std;
 //---------------------------------------------------------------------------
 namespace rdma {
-
-    static const uint32_t maxInlineSize = 512;
+//---------------------------------------------------------------------------
+static uint32_t randomPsn()
+{
+   static thread_local mt19937 generator{random_device{}()};
+   return generator() & 0xffffff; // PSNs have 24 bits
+}
 //---------------------------------------------------------------------------
 QueuePair::QueuePair(Network &network)
         : QueuePair(network, *network.sharedCompletionQueuePair, *network.sharedReceiveQueue)
@@ -49,38 +58,95 @@ QueuePair::QueuePair(Network &network, CompletionQueuePair &completionQueuePair)
 {
 }
 //---------------------------------------------------------------------------
-QueuePair::QueuePair(Network &network, CompletionQueuePair &completionQueuePair, ReceiveQueue& receiveQueue)
+QueuePair::QueuePair(Network &network, CompletionQueuePair &completionQueuePair, const Profile &profile)
+        : QueuePair(network, completionQueuePair, *network.sharedReceiveQueue, Type::ReliableConnection, profile)
+{
+}
+//---------------------------------------------------------------------------
+const QueuePair::Profile &QueuePair::Profile::latency()
+{
+   static const Profile profile{"latency", 256, 512, 16};
+   return profile;
+}
+//---------------------------------------------------------------------------
+const QueuePair::Profile &QueuePair::Profile::streaming()
+{
+   static const Profile profile{"streaming", 4096, 64, 16};
+   return profile;
+}
+//---------------------------------------------------------------------------
+const QueuePair::Profile &QueuePair::Profile::idleHeavy()
+{
+   // Still room for the 64 datagrams or fragments the two-sided transports keep in flight
+   static const Profile profile{"idle", 128, 64, 2};
+   return profile;
+}
+//---------------------------------------------------------------------------
+const QueuePair::Profile &QueuePair::Profile::byName(const string &name)
+{
+   if (name == "latency") {
+      return latency();
+   } else if (name == "streaming") {
+      return streaming();
+   } else if (name == "idle") {
+      return idleHeavy();
+   }
+   string reason = "unknown queue pair profile " + name + ", expected latency, streaming or idle";
+   cerr << reason << endl;
+   throw NetworkException(reason);
+}
+//---------------------------------------------------------------------------
+const QueuePair::Profile &QueuePair::Profile::standard()
+{
+   static const Profile &profile = getenv("RDMA_QP_PROFILE") ? byName(getenv("RDMA_QP_PROFILE")) : latency();
+   return profile;
+}
+//---------------------------------------------------------------------------
+QueuePair::QueuePair(Network &network, CompletionQueuePair &completionQueuePair, ReceiveQueue& receiveQueue, Type type,
+                     const Profile &profile)
         : network(network)
           , completionQueuePair(completionQueuePair)
+          , psn(randomPsn())
+          , requested(profile)
+          , granted(profile)
 {
+   const auto &limits = network.getLimits();
+   requested.sendWorkRequests = min(requested.sendWorkRequests, limits.maxWorkRequests);
+   requested.readsAndAtomics = min(requested.readsAndAtomics, min(limits.maxInitiatorReads, limits.maxResponderReads));
+
    ibv_qp_init_attr queuePairAttributes;
    memset(&queuePairAttributes, 0, sizeof(queuePairAttributes));
    queuePairAttributes.qp_context = nullptr;                       // Associated context of the QP
    queuePairAttributes.send_cq = completionQueuePair.sendQueue;    // CQ to be associated with the Send Queue (SQ)
    queuePairAttributes.recv_cq = completionQueuePair.receiveQueue; // CQ to be associated with the Receive Queue (RQ)
    queuePairAttributes.srq = receiveQueue.queue;                   // SRQ handle if QP is to be associated with an SRQ, otherwise NULL
-   queuePairAttributes.cap.max_send_wr = 16351;                    // Requested max number of outstanding WRs in the SQ
-   queuePairAttributes.cap.max_recv_wr = 16351;                    // Requested max number of outstanding WRs in the RQ
-   queuePairAttributes.cap.max_send_sge = 1;                       // Requested max number of scatter/gather elements in a WR in the SQ
+   queuePairAttributes.cap.max_send_wr = requested.sendWorkRequests; // Requested max number of outstanding WRs in the SQ
+   queuePairAttributes.cap.max_recv_wr = 0;                        // Requested max number of outstanding WRs in the RQ (unused with an SRQ)
+   queuePairAttributes.cap.max_send_sge = 3;                       // Requested max number of scatter/gather elements in a WR in the SQ (header, payload, footer)
    queuePairAttributes.cap.max_recv_sge = 1;                       // Requested max number of scatter/gather elements in a WR in the RQ
-    queuePairAttributes.cap.max_inline_data = maxInlineSize;        // Requested max number of bytes that can be posted inline to the SQ, otherwise 0
-   queuePairAttributes.qp_type = IBV_QPT_RC;                       // QP Transport Service Type: IBV_QPT_RC (reliable connection), IBV_QPT_UC (unreliable connection), or IBV_QPT_UD (unreliable datagram)
+   queuePairAttributes.cap.max_inline_data = requested.inlineSize; // Requested max number of bytes that can be posted inline to the SQ, otherwise 0
+   queuePairAttributes.qp_type = type == Type::UnreliableDatagram ? IBV_QPT_UD : IBV_QPT_RC; // QP Transport Service Type: IBV_QPT_RC (reliable connection), IBV_QPT_UC (unreliable connection), or IBV_QPT_UD (unreliable datagram)
    queuePairAttributes.sq_sig_all = 0;                             // If set, each Work Request (WR) submitted to the SQ generates a completion entry
 
-   // Create queue pair
-   qp = ::ibv_create_qp(network.protectionDomain, &queuePairAttributes);
+   // Create queue pair, with its buffers close to the device
+   Network::LocalAllocationScope localAllocation(network);
+   qp = Backend::get().createQp(network.protectionDomain, &queuePairAttributes);
    if (!qp) {
       string reason = "creating the queue pair failed with error " + to_string(errno) + ": " + strerror(errno);
       cerr << reason << endl;
       throw NetworkException(reason);
    }
+   // The provider rounds the queue up and reports what it actually allocated
+   granted.sendWorkRequests = queuePairAttributes.cap.max_send_wr;
+   granted.inlineSize = queuePairAttributes.cap.max_inline_data;
+   granted.readsAndAtomics = requested.readsAndAtomics;
 
    cout << "create qp: " << qp << endl;
 }
 //---------------------------------------------------------------------------
 QueuePair::~QueuePair()
 {
-   int status = ::ibv_destroy_qp(qp);
+   int status = Backend::get().destroyQp(qp);
    if (status != 0) {
       string reason = "destroying the queue pair failed with error " + to_string(errno) + ": " + strerror(errno);
       cerr << reason << endl;
@@ -95,10 +161,24 @@ uint32_t QueuePair::getQPN()
    return qp->qp_num;
 }
 //---------------------------------------------------------------------------
+Address QueuePair::getAddress()
+{
+   Address address{};
+   address.qpn = getQPN();
+   address.lid = network.getLID();
+   memcpy(address.gid, network.getGID(), sizeof(address.gid));
+   address.psn = psn;
+   address.mtu = static_cast<uint32_t>(network.getMtu());
+   return address;
+}
+//---------------------------------------------------------------------------
 void QueuePair::connect(const Address &address, unsigned retryCount)
 {
-   uint32_t remotePSN = 0;
-   uint32_t localPSN = 0;
+   // The path MTU must not exceed the active MTU of either side, which is usually 1024 with RoCE on a 1500B Ethernet
+   // MTU. The other side drops larger packets
+   const size_t mtu = min<size_t>(network.getMtu(), max<uint32_t>(address.mtu, 256));
+   const auto pathMtu = static_cast<ibv_mtu>(IBV_MTU_256 + __builtin_ctzl(mtu / 256));
+   const bool globalRouting = network.usesGlobalRouting();
 
    struct ibv_qp_attr attributes{};
 
@@ -108,7 +188,7 @@ void QueuePair::connect(const Address &address, unsigned retryCount)
    attributes.pkey_index = 0;               // Partition the queue pair belongs to
    attributes.port_num = network.ibport;    // The local physical port
    attributes.qp_access_flags = IBV_ACCESS_REMOTE_WRITE | IBV_ACCESS_REMOTE_READ | IBV_ACCESS_REMOTE_ATOMIC;  // Allowed access flags of the remote operations for incoming packets (i.e., none, RDMA read, RDMA write, or atomics)
-   if (::ibv_modify_qp(qp, &attributes, IBV_QP_STATE | IBV_QP_PKEY_INDEX | IBV_QP_PORT | IBV_QP_ACCESS_FLAGS)) {
+   if (Backend::get().modifyQp(qp, &attributes, IBV_QP_STATE | IBV_QP_PKEY_INDEX | IBV_QP_PORT | IBV_QP_ACCESS_FLAGS)) {
       string reason = "failed to transition QP to INIT state";
       cerr << reason << endl;
       throw NetworkException(reason);
@@ -117,17 +197,13 @@ void QueuePair::connect(const Address &address, unsigned retryCount)
    // RTR (ready to receive)
    memset(&attributes, 0, sizeof(attributes));
    attributes.qp_state = IBV_QPS_RTR;
-   attributes.path_mtu = IBV_MTU_4096;             // Maximum payload size
+   attributes.path_mtu = pathMtu;                  // Maximum payload size
    attributes.dest_qp_num = address.qpn;           // The remote QP number
-   attributes.rq_psn = remotePSN;                  // The packet sequence number of received packets
-   attributes.max_dest_rd_atomic = 16;             // The number of outstanding RDMA reads & atomic operations (destination)
+   attributes.rq_psn = address.psn;                // The packet sequence number of received packets
+   attributes.max_dest_rd_atomic = granted.readsAndAtomics; // The number of outstanding RDMA reads & atomic operations (destination)
    attributes.min_rnr_timer = 12;                  // The time before a RNR NACK is sent
-   attributes.ah_attr.is_global = 0;               // Whether there is a global routing header
-   attributes.ah_attr.dlid = address.lid;          // The LID of the remote host
-   attributes.ah_attr.sl = 0;                      // The service level (which determines the virtual lane)
-   attributes.ah_attr.src_path_bits = 0;           // Use the port base LID
-   attributes.ah_attr.port_num = network.ibport;   // The local physical port
-   if (::ibv_modify_qp(qp, &attributes, IBV_QP_STATE | IBV_QP_AV | IBV_QP_PATH_MTU | IBV_QP_DEST_QPN | IBV_QP_RQ_PSN | IBV_QP_MAX_DEST_RD_ATOMIC | IBV_QP_MIN_RNR_TIMER)) {
+   network.setRoute(attributes.ah_attr, address);  // By LID (InfiniBand) or GID (RoCE)
+   if (Backend::get().modifyQp(qp, &attributes, IBV_QP_STATE | IBV_QP_AV | IBV_QP_PATH_MTU | IBV_QP_DEST_QPN | IBV_QP_RQ_PSN | IBV_QP_MAX_DEST_RD_ATOMIC | IBV_QP_MIN_RNR_TIMER)) {
       string reason = "failed to transition QP to RTR state";
       cerr << reason << endl;
       throw NetworkException(reason);
@@ -136,22 +212,68 @@ void QueuePair::connect(const Address &address, unsigned retryCount)
    // RTS (ready to send)
    memset(&attributes, 0, sizeof(attributes));
    attributes.qp_state = IBV_QPS_RTS;
-   attributes.sq_psn = localPSN;       // The packet sequence number of sent packets
-   attributes.timeout = 0;             // The minimum timeout before retransmitting the packet (0 = infinite)
-   attributes.retry_cnt = retryCount;  // How often to retry sending (7 = infinite)
+   attributes.sq_psn = psn;            // The packet sequence number of sent packets
+   // InfiniBand is lossless, but Ethernet may drop packets (e.g. without PFC), which have to be retransmitted in time
+   attributes.timeout = globalRouting ? 14 : 0; // The minimum timeout before retransmitting the packet (4.096us * 2^14 = 67ms, 0 = infinite)
+   attributes.retry_cnt = globalRouting ? 7 : retryCount;  // How often to retry sending (at most 7)
    attributes.rnr_retry = retryCount;  // How often to retry sending when RNR NACK was received (7 = infinite)
-   attributes.max_rd_atomic = 128;     // The number of outstanding RDMA reads & atomic operations (initiator)
-   if (::ibv_modify_qp(qp, &attributes, IBV_QP_STATE | IBV_QP_TIMEOUT | IBV_QP_RETRY_CNT | IBV_QP_RNR_RETRY | IBV_QP_SQ_PSN | IBV_QP_MAX_QP_RD_ATOMIC)) {
+   attributes.max_rd_atomic = granted.readsAndAtomics; // The number of outstanding RDMA reads & atomic operations (initiator)
+   if (Backend::get().modifyQp(qp, &attributes, IBV_QP_STATE | IBV_QP_TIMEOUT | IBV_QP_RETRY_CNT | IBV_QP_RNR_RETRY | IBV_QP_SQ_PSN | IBV_QP_MAX_QP_RD_ATOMIC)) {
+      string reason = "failed to transition QP to RTS state";
+      cerr << reason << endl;
+      throw NetworkException(reason);
+   }
+}
+// -------------------------------------------------------------------------
+void QueuePair::activateDatagrams(uint32_t qkey)
+{
+   struct ibv_qp_attr attributes{};
+
+   // INIT
+   memset(&attributes, 0, sizeof(attributes));
+   attributes.qp_state = IBV_QPS_INIT;
+   attributes.pkey_index = 0;               // Partition the queue pair belongs to
+   attributes.port_num = network.ibport;    // The local physical port
+   attributes.qkey = qkey;                  // Only datagrams with this key are accepted
+   if (Backend::get().modifyQp(qp, &attributes, IBV_QP_STATE | IBV_QP_PKEY_INDEX | IBV_QP_PORT | IBV_QP_QKEY)) {
+      string reason = "failed to transition QP to INIT state";
+      cerr << reason << endl;
+      throw NetworkException(reason);
+   }
+
+   // RTR (ready to receive), there is no remote side to set up
+   memset(&attributes, 0, sizeof(attributes));
+   attributes.qp_state = IBV_QPS_RTR;
+   if (Backend::get().modifyQp(qp, &attributes, IBV_QP_STATE)) {
+      string reason = "failed to transition QP to RTR state";
+      cerr << reason << endl;
+      throw NetworkException(reason);
+   }
+
+   // RTS (ready to send)
+   memset(&attributes, 0, sizeof(attributes));
+   attributes.qp_state = IBV_QPS_RTS;
+   attributes.sq_psn = 0;              // The packet sequence number of sent packets
+   if (Backend::get().modifyQp(qp, &attributes, IBV_QP_STATE | IBV_QP_SQ_PSN)) {
       string reason = "failed to transition QP to RTS state";
       cerr << reason << endl;
       throw NetworkException(reason);
    }
 }
 // -------------------------------------------------------------------------
+void QueuePair::modify(ibv_qp_attr &attributes, int mask)
+{
+   if (Backend::get().modifyQp(qp, &attributes, mask)) {
+      string reason = "failed to transition QP to state " + to_string(attributes.qp_state);
+      cerr << reason << endl;
+      throw NetworkException(reason);
+   }
+}
+// -------------------------------------------------------------------------
 void QueuePair::postWorkRequest(const WorkRequest &workRequest)
 {
    ibv_send_wr *badWorkRequest = nullptr;
-   int status = ::ibv_post_send(qp, workRequest.wr.get(), &badWorkRequest);
+   int status = Backend::get().postSend(qp, workRequest.wr.get(), &badWorkRequest);
    if (status != 0) {
       string reason = "posting the work request failed with error " + to_string(status) + ": " + strerror(status);
       cerr << reason << endl;
@@ -205,7 +327,7 @@ void QueuePair::printQueuePairDetails()
    memset(&init_attr, 0, sizeof(init_attr));
 
    const int allFlags = IBV_QP_STATE | IBV_QP_CUR_STATE | IBV_QP_EN_SQD_ASYNC_NOTIFY | IBV_QP_ACCESS_FLAGS | IBV_QP_PKEY_INDEX | IBV_QP_PORT | IBV_QP_QKEY | IBV_QP_AV | IBV_QP_PATH_MTU | IBV_QP_TIMEOUT | IBV_QP_RETRY_CNT | IBV_QP_RNR_RETRY | IBV_QP_RQ_PSN | IBV_QP_MAX_QP_RD_ATOMIC | IBV_QP_ALT_PATH | IBV_QP_MIN_RNR_TIMER | IBV_QP_SQ_PSN | IBV_QP_MAX_DEST_RD_ATOMIC | IBV_QP_PATH_MIG_STATE | IBV_QP_CAP | IBV_QP_DEST_QPN;
-   if (::ibv_query_qp(qp, &attr, allFlags, &init_attr)) {
+   if (Backend::get().queryQp(qp, &attr, allFlags, &init_attr)) {
       string reason = "Error, querying the queue pair details.";
       cerr << reason << endl;
       throw NetworkException(reason);
@@ -222,7 +344,11 @@ void QueuePair::printQueuePairDetails()
    cout << left << setw(44) << "sq_psn:" << attr.sq_psn << endl;
    cout << left << setw(44) << "dest_qp_num:" << attr.dest_qp_num << endl;
    cout << left << setw(44) << "qp_access_flags:" << queuePairAccessFlagsToString(attr.qp_access_flags) << endl;
-   cout << left << setw(44) << "cap:" << "<not impl>" << endl;
+   cout << left << setw(44) << "profile:" << granted.name << endl;
+   cout << left << setw(44) << "cap.max_send_wr:" << init_attr.cap.max_send_wr << " (requested " << requested.sendWorkRequests << ")" << endl;
+   cout << left << setw(44) << "cap.max_recv_wr:" << init_attr.cap.max_recv_wr << endl;
+   cout << left << setw(44) << "cap.max_send_sge:" << init_attr.cap.max_send_sge << endl;
+   cout << left << setw(44) << "cap.max_inline_data:" << granted.inlineSize << " (requested " << requested.inlineSize << ")" << endl;
    cout << left << setw(44) << "ah_attr:" << "<not impl>" << endl;
    cout << left << setw(44) << "alt_ah_attr:" << "<not impl>" << endl;
    cout << left << setw(44) << "pkey_index:" << attr.pkey_index << endl;
@@ -241,7 +367,7 @@ void QueuePair::printQueuePairDetails()
 }
 
     uint32_t QueuePair::getMaxInlineSize() {
-        return maxInlineSize;
+        return granted.inlineSize;
     }
 //---------------------------------------------------------------------------
 } // End of namespace rdma
@@ -20,12 +20,15 @@
 //---------------------------------------------------------------------------
 #pragma once
 //---------------------------------------------------------------------------
+#include <cstdint>
 #include <memory>
+#include <string>
 
 //---------------------------------------------------------------------------
 struct ibv_send_wr;
 //---------------------------------------------------------------------------
 struct ibv_qp;
+struct ibv_qp_attr;
 struct ibv_cq;
 //---------------------------------------------------------------------------
 namespace rdma {
@@ -41,6 +44,43 @@ namespace rdma {
 
 //---------------------------------------------------------------------------
     class QueuePair {
+    public:
+        /// The transport service of the queue pair
+        enum class Type : uint8_t {
+            /// Connected to a single remote queue pair, reliable, supports one-sided operations
+            ReliableConnection,
+            /// Sends (MTU sized) datagrams to any remote datagram queue pair, which may get lost
+            UnreliableDatagram
+        };
+
+        /// The resources a queue pair asks for, sized for what the connection does. Requests are clamped to the limits
+        /// of the device, receives always go to a (shared) receive queue
+        struct Profile {
+            const char *name;
+            /// Outstanding work requests of the send queue
+            uint32_t sendWorkRequests;
+            /// Bytes a work request may carry inline, every entry of the send queue has room for them
+            uint32_t inlineSize;
+            /// Outstanding RDMA reads and atomics, as initiator and as responder
+            uint8_t readsAndAtomics;
+
+            /// Small messages, one at a time: short send queue, large inline size
+            static const Profile &latency();
+
+            /// Bulk transfers: many writes in flight, which are too large to be inlined anyway
+            static const Profile &streaming();
+
+            /// Thousands of mostly idle connections: as little host and NIC memory per queue pair as possible
+            static const Profile &idleHeavy();
+
+            /// The profile "latency", "streaming" or "idle"
+            static const Profile &byName(const std::string &name);
+
+            /// The profile of connections which don't pick one: RDMA_QP_PROFILE, latency without it
+            static const Profile &standard();
+        };
+
+    private:
         QueuePair(QueuePair const &) = delete;
 
         QueuePair &operator=(QueuePair const &) = delete;
@@ -51,22 +91,45 @@ namespace rdma {
 
         CompletionQueuePair &completionQueuePair;
 
+        /// The first packet sequence number we send, random so stale packets of a previous connection are dropped
+        uint32_t psn;
+
+        /// What was asked for, within the limits of the device
+        Profile requested;
+        /// What the device granted
+        Profile granted;
+
     public:
         QueuePair(Network &network); // Uses shared completion and receive Queue
         QueuePair(Network &network, ReceiveQueue &receiveQueue); // Uses shared completion Queue
         QueuePair(Network &network, CompletionQueuePair &completionQueuePair); // Uses shared receive Queue
-        QueuePair(Network &network, CompletionQueuePair &completionQueuePair, ReceiveQueue &receiveQueue);
+        QueuePair(Network &network, CompletionQueuePair &completionQueuePair, const Profile &profile); // Uses shared receive Queue
+        QueuePair(Network &network, CompletionQueuePair &completionQueuePair, ReceiveQueue &receiveQueue,
+                  Type type = Type::ReliableConnection, const Profile &profile = Profile::standard());
 
         ~QueuePair();
 
         uint32_t getQPN();
 
+        /// The address the remote side connects to
+        Address getAddress();
+
         void connect(const Address &address, unsigned retryCount = 0);
 
+        /// Make an unreliable datagram queue pair ready to send and receive, accepting datagrams with the given qkey
+        void activateDatagrams(uint32_t qkey);
+
+        /// Change the attributes in mask, e.g. the ones the ConnectionManager computed for the next state
+        void modify(ibv_qp_attr &attributes, int mask);
+
         void postWorkRequest(const WorkRequest &workRequest);
 
+        /// The inline size the device granted
         uint32_t getMaxInlineSize();
 
+        /// The resources the device granted, named after the requested profile
+        const Profile &getProfile() const { return granted; }
+
         /// Print detailed information about this queue pair
         void printQueuePairDetails();
 
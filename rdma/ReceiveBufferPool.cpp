@@ -0,0 +1,51 @@
+#include "ReceiveBufferPool.hpp"
+#include "Network.hpp"
+//---------------------------------------------------------------------------
+using namespace std;
+//---------------------------------------------------------------------------
+namespace rdma {
+//---------------------------------------------------------------------------
+    ReceiveBufferPool::ReceiveBufferPool(Network &network, ReceiveQueue &receiveQueue, size_t bufferSize,
+                                         size_t bufferCount) :
+            receiveQueue(receiveQueue), bufferSize(bufferSize), bufferCount(bufferCount),
+            memory(network.getMemorySlab(), network.getMemorySlab().allocate(bufferSize * bufferCount,
+                                                                             MemoryRegion::Permission::LocalWrite,
+                                                                             4096)) {
+        vector<ReceiveQueue::Buffer> buffers;
+        for (uint64_t id = 0; id != bufferCount; ++id) {
+            buffers.push_back(bufferWithId(id));
+            if (buffers.size() == REFILL_BATCH) {
+                receiveQueue.postReceives(buffers);
+                buffers.clear();
+            }
+        }
+        receiveQueue.postReceives(buffers);
+    }
+
+//---------------------------------------------------------------------------
+    ReceiveQueue::Buffer ReceiveBufferPool::bufferWithId(uint64_t id) const {
+        return ReceiveQueue::Buffer{id, MemoryRegion::Slice(memory.as<uint8_t>() + id * bufferSize, bufferSize,
+                                                             memory.slice.lkey)};
+    }
+
+//---------------------------------------------------------------------------
+    const uint8_t *ReceiveBufferPool::getBuffer(uint64_t id) const {
+        return memory.as<uint8_t>() + id * bufferSize;
+    }
+
+//---------------------------------------------------------------------------
+    void ReceiveBufferPool::release(uint64_t id) {
+        vector<ReceiveQueue::Buffer> batch;
+        {
+            lock_guard<mutex> lock(guard);
+            released.push_back(bufferWithId(id));
+            if (released.size() < REFILL_BATCH) {
+                return;
+            }
+            batch.swap(released);
+        }
+        receiveQueue.postReceives(batch);
+    }
+//---------------------------------------------------------------------------
+} // End of namespace rdma
+//---------------------------------------------------------------------------
@@ -0,0 +1,53 @@
+#pragma once
+//---------------------------------------------------------------------------
+#include "MemorySlab.hpp"
+#include "ReceiveQueue.hpp"
+//---------------------------------------------------------------------------
+#include <cstdint>
+#include <mutex>
+#include <vector>
+//---------------------------------------------------------------------------
+namespace rdma {
+//---------------------------------------------------------------------------
+    class Network;
+
+//---------------------------------------------------------------------------
+/// Equally sized buffers kept posted to a (shared) receive queue. The id of a work completion is the index of the
+/// buffer the message was received into. Consumed buffers are handed back with release() and posted again in batches,
+/// so the receive memory depends on the number of buffers, not on the number of connections using the queue.
+class ReceiveBufferPool {
+    ReceiveQueue &receiveQueue;
+    const size_t bufferSize;
+    const size_t bufferCount;
+    MemorySlab::Allocation memory;
+    /// Released buffers not yet posted again
+    std::vector<ReceiveQueue::Buffer> released;
+    /// Protect released from concurrent access
+    std::mutex guard;
+
+    ReceiveQueue::Buffer bufferWithId(uint64_t id) const;
+
+public:
+    /// Number of released buffers posted with a single work request
+    static const size_t REFILL_BATCH = 32;
+
+    /// Constructor, posts all buffers
+    ReceiveBufferPool(Network &network, ReceiveQueue &receiveQueue, size_t bufferSize, size_t bufferCount);
+
+    /// The buffer a completion with the given id was received into
+    const uint8_t *getBuffer(uint64_t id) const;
+
+    size_t getBufferSize() const { return bufferSize; }
+
+    size_t getBufferCount() const { return bufferCount; }
+
+    /// Hand a consumed buffer back, to be posted again
+    void release(uint64_t id);
+
+    ReceiveBufferPool(ReceiveBufferPool const &) = delete;
+
+    ReceiveBufferPool &operator=(ReceiveBufferPool const &) = delete;
+};
+//---------------------------------------------------------------------------
+} // End of namespace rdma
+//---------------------------------------------------------------------------
@@ -19,10 +19,12 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 // ---------------------------------------------------------------------------
 #include "ReceiveQueue.hpp"
+#include "Backend.hpp"
 #include "WorkRequest.hpp"
 #include "Network.hpp"
 //---------------------------------------------------------------------------
 #include <infiniband/verbs.h>
+#include <algorithm>
 #include <cstring>
 #include <iostream>
 #include <iomanip>
@@ -31,14 +33,15 @@ using namespace std;
 //---------------------------------------------------------------------------
 namespace rdma {
 //---------------------------------------------------------------------------
-ReceiveQueue::ReceiveQueue(Network &network)
+ReceiveQueue::ReceiveQueue(Network &network, uint32_t size)
 {
    // Create receive queue
     struct ibv_srq_init_attr srq_init_attr{};
    memset(&srq_init_attr, 0, sizeof(srq_init_attr));
-   srq_init_attr.attr.max_wr = 16351;
+   srq_init_attr.attr.max_wr = min(size, network.getLimits().maxReceiveQueueSize);
    srq_init_attr.attr.max_sge = 1;
-   queue = ibv_create_srq(network.protectionDomain, &srq_init_attr);
+   Network::LocalAllocationScope localAllocation(network);
+   queue = Backend::get().createSrq(network.protectionDomain, &srq_init_attr);
    if (!queue) {
       string reason = "could not create receive queue";
       cerr << reason << endl;
@@ -51,7 +54,7 @@ ReceiveQueue::~ReceiveQueue()
    int status;
 
    // Destroy the receive queue
-   status = ::ibv_destroy_srq(queue);
+   status = Backend::get().destroySrq(queue);
    if (status != 0) {
       string reason = "destroying the receive queue failed with error " + to_string(errno) + ": " + strerror(errno);
       cerr << reason << endl;
@@ -59,5 +62,32 @@ ReceiveQueue::~ReceiveQueue()
    }
 }
 //---------------------------------------------------------------------------
+void ReceiveQueue::postReceives(const vector<Buffer> &buffers)
+{
+   if (buffers.empty()) {
+      return;
+   }
+
+   vector<ibv_sge> scatterElements(buffers.size());
+   vector<ibv_recv_wr> workRequests(buffers.size());
+   for (size_t i = 0; i != buffers.size(); ++i) {
+      scatterElements[i].addr = reinterpret_cast<uintptr_t>(buffers[i].slice.address);
+      scatterElements[i].length = buffers[i].slice.size;
+      scatterElements[i].lkey = buffers[i].slice.lkey;
+      workRequests[i].wr_id = buffers[i].id;
+      workRequests[i].sg_list = &scatterElements[i];
+      workRequests[i].num_sge = 1;
+      workRequests[i].next = i + 1 != buffers.size() ? &workRequests[i + 1] : nullptr;
+   }
+
+   ibv_recv_wr *badWorkRequest = nullptr;
+   int status = Backend::get().postSrqRecv(queue, workRequests.data(), &badWorkRequest);
+   if (status != 0) {
+      string reason = "posting receive buffers failed with error " + to_string(errno) + ": " + strerror(errno);
+      cerr << reason << endl;
+      throw NetworkException(reason);
+   }
+}
+//---------------------------------------------------------------------------
 } // End of namespace rdma
 //---------------------------------------------------------------------------
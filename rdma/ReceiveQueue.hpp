@@ -19,6 +19,7 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 //---------------------------------------------------------------------------
 #pragma once
+#include "MemoryRegion.hpp"
 //---------------------------------------------------------------------------
 #include <vector>
 #include <cstdint>
@@ -44,10 +45,22 @@ namespace rdma {
         /// The receive queue
         ibv_srq *queue;
     public:
-        /// Ctor
-        ReceiveQueue(Network &network);
+        /// A buffer to receive into, the work completion carries its id
+        struct Buffer {
+            uint64_t id;
+            MemoryRegion::Slice slice;
+        };
+
+        /// The number of entries of the queue shared by the queue pairs of a network
+        static const uint32_t DEFAULT_SIZE = 16351;
+
+        /// Ctor, the size is clamped to the limit of the device
+        ReceiveQueue(Network &network, uint32_t size = DEFAULT_SIZE);
 
         ~ReceiveQueue();
+
+        /// Post the buffers with a single (chained) work request
+        void postReceives(const std::vector<Buffer> &buffers);
     };
 //---------------------------------------------------------------------------
 } // End of namespace rdma
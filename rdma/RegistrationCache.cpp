@@ -0,0 +1,88 @@
+#include "RegistrationCache.hpp"
+//---------------------------------------------------------------------------
+#include <algorithm>
+//---------------------------------------------------------------------------
+using namespace std;
+//---------------------------------------------------------------------------
+namespace rdma {
+//---------------------------------------------------------------------------
+    static const uintptr_t pageSize = 4096;
+
+//---------------------------------------------------------------------------
+    RegistrationCache::RegistrationCache(ibv_pd *protectionDomain, size_t capacity) : protectionDomain(
+            protectionDomain), capacity(capacity) {
+    }
+
+//---------------------------------------------------------------------------
+    RegistrationCache::~RegistrationCache() = default;
+
+//---------------------------------------------------------------------------
+    void RegistrationCache::erase(map<uintptr_t, Entry>::iterator entry) {
+        registeredBytes -= entry->second.end - entry->first;
+        lru.erase(entry->second.lruPosition);
+        entries.erase(entry); // deregisters, once the last handle is gone
+    }
+
+//---------------------------------------------------------------------------
+    RegistrationCache::Handle RegistrationCache::lookup(const void *address, size_t size) {
+        const auto begin = reinterpret_cast<uintptr_t>(address);
+        const auto end = begin + size;
+
+        lock_guard<mutex> lock(guard);
+
+        // Find the last registration starting at or before address
+        auto entry = entries.upper_bound(begin);
+        if (entry != entries.begin()) {
+            --entry;
+            if (entry->second.end >= end) {
+                lru.splice(lru.begin(), lru, entry->second.lruPosition);
+                return Handle{entry->second.region,
+                              entry->second.region->slice(begin - entry->first, size)};
+            }
+        }
+
+        // Miss: replace all overlapping registrations by one covering their union
+        auto registerBegin = begin & ~(pageSize - 1);
+        auto registerEnd = (end + pageSize - 1) & ~(pageSize - 1);
+        auto overlapping = entries.upper_bound(registerBegin);
+        if (overlapping != entries.begin() && prev(overlapping)->second.end > registerBegin) {
+            --overlapping;
+        }
+        while (overlapping != entries.end() && overlapping->first < registerEnd) {
+            registerBegin = min(registerBegin, overlapping->first);
+            registerEnd = max(registerEnd, overlapping->second.end);
+            erase(overlapping++);
+        }
+
+        auto region = make_shared<MemoryRegion>(reinterpret_cast<void *>(registerBegin), registerEnd - registerBegin,
+                                                protectionDomain, MemoryRegion::Permission::None);
+        lru.push_front(registerBegin);
+        entries[registerBegin] = Entry{registerEnd, region, lru.begin()};
+        registeredBytes += registerEnd - registerBegin;
+
+        // Evict the least recently used registrations, but never the one we just made
+        while (registeredBytes > capacity && lru.back() != registerBegin) {
+            erase(entries.find(lru.back()));
+        }
+
+        return Handle{region, region->slice(begin - registerBegin, size)};
+    }
+
+//---------------------------------------------------------------------------
+    void RegistrationCache::invalidate(const void *address, size_t size) {
+        const auto begin = reinterpret_cast<uintptr_t>(address);
+        const auto end = begin + size;
+
+        lock_guard<mutex> lock(guard);
+
+        auto entry = entries.upper_bound(begin);
+        if (entry != entries.begin() && prev(entry)->second.end > begin) {
+            --entry;
+        }
+        while (entry != entries.end() && entry->first < end) {
+            erase(entry++);
+        }
+    }
+//---------------------------------------------------------------------------
+} // End of namespace rdma
+//---------------------------------------------------------------------------
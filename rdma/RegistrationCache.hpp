@@ -0,0 +1,69 @@
+#pragma once
+//---------------------------------------------------------------------------
+#include "MemoryRegion.hpp"
+//---------------------------------------------------------------------------
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+//---------------------------------------------------------------------------
+struct ibv_pd;
+//---------------------------------------------------------------------------
+namespace rdma {
+//---------------------------------------------------------------------------
+/// Pin-down cache of memory registrations for arbitrary (application) memory, so work requests can use it directly
+/// without paying ibv_reg_mr() on every call. Registrations are page aligned, overlapping ones are merged and the least
+/// recently used ones are dropped once more than the capacity is registered. The memory is only ever the source of
+/// local reads, so it is registered without write or remote access, which also works for read-only mappings.
+/// A registration pins the physical pages it was created for, so it gets stale when its virtual memory is unmapped and
+/// mapped again. Owners of the memory have to call invalidate() before unmapping it.
+class RegistrationCache {
+public:
+    /// A registered slice. Keeps its registration alive, even when it is dropped from the cache in the meantime
+    struct Handle {
+        std::shared_ptr<MemoryRegion> region;
+        MemoryRegion::Slice slice;
+    };
+
+    /// Default number of bytes kept registered
+    static const size_t DEFAULT_CAPACITY = 1024 * 1024 * 1024;
+
+private:
+    struct Entry {
+        uintptr_t end;
+        std::shared_ptr<MemoryRegion> region;
+        std::list<uintptr_t>::iterator lruPosition;
+    };
+
+    ibv_pd *protectionDomain;
+    const size_t capacity;
+    size_t registeredBytes = 0;
+    /// The registrations, by start address. They never overlap
+    std::map<uintptr_t, Entry> entries;
+    /// Start addresses of the registrations, most recently used first
+    std::list<uintptr_t> lru;
+    /// Protect the cache from concurrent access
+    std::mutex guard;
+
+    void erase(std::map<uintptr_t, Entry>::iterator entry);
+
+public:
+    /// Constructor
+    RegistrationCache(ibv_pd *protectionDomain, size_t capacity = DEFAULT_CAPACITY);
+
+    /// Destructor
+    ~RegistrationCache();
+
+    /// Get a registered slice covering [address, address + size)
+    Handle lookup(const void *address, size_t size);
+
+    /// Drop all registrations overlapping [address, address + size)
+    void invalidate(const void *address, size_t size);
+
+    RegistrationCache(RegistrationCache const &) = delete;
+
+    RegistrationCache &operator=(RegistrationCache const &) = delete;
+};
+//---------------------------------------------------------------------------
+} // End of namespace rdma
+//---------------------------------------------------------------------------
@@ -0,0 +1,108 @@
+#include "SharedCompletionQueue.hpp"
+#include "Backend.hpp"
+#include "Network.hpp"
+//---------------------------------------------------------------------------
+#include <infiniband/verbs.h>
+#include <algorithm>
+#include <iostream>
+#include <limits>
+//---------------------------------------------------------------------------
+using namespace std;
+//---------------------------------------------------------------------------
+namespace rdma {
+//---------------------------------------------------------------------------
+    SharedCompletionQueue::SharedCompletionQueue(Network &network, int size) :
+            queues(network, min(size, network.getMaxCompletionQueueSize())) {
+    }
+
+//---------------------------------------------------------------------------
+    void SharedCompletionQueue::pollBatch() {
+        pollBatch(queues.sendQueue, &Endpoint::sendCompletions);
+        pollBatch(queues.receiveQueue, &Endpoint::receiveCompletions);
+    }
+
+//---------------------------------------------------------------------------
+    void SharedCompletionQueue::pollBatch(ibv_cq *completionQueue, Endpoint::Completions Endpoint::*completions) {
+        ibv_wc polled[CompletionQueuePair::POLL_BATCH];
+        int count = Backend::get().pollCq(completionQueue, CompletionQueuePair::POLL_BATCH, polled);
+        if (count < 0) {
+            string reason = "failed to poll completions";
+            cerr << reason << endl;
+            throw NetworkException(reason);
+        }
+
+        // Failed completions are routed as well, they are reported to their owner instead of whoever polls
+        for (int i = 0; i != count; ++i) {
+            const auto &completion = polled[i];
+
+            // Completions of queue pairs destroyed in the meantime have no endpoint anymore
+            auto endpoint = endpoints.find(completion.qp_num);
+            if (endpoint == endpoints.end()) {
+                continue;
+            }
+            auto &target = endpoint->second->*completions;
+            const CompletionRing::Completion routed{completion.wr_id, completion.opcode, completion.status};
+            if (not target.overflow.empty() || not target.ring.push(routed)) {
+                target.overflow.push_back(routed);
+            }
+        }
+    }
+
+//---------------------------------------------------------------------------
+    SharedCompletionQueue::Endpoint::Endpoint(SharedCompletionQueue &queue) : queue(queue) {
+    }
+
+//---------------------------------------------------------------------------
+    SharedCompletionQueue::Endpoint::~Endpoint() {
+        lock_guard<mutex> lock(queue.guard);
+        for (const auto qpn : qpns) {
+            queue.endpoints.erase(qpn);
+        }
+    }
+
+//---------------------------------------------------------------------------
+    void SharedCompletionQueue::Endpoint::attach(uint32_t qpn) {
+        lock_guard<mutex> lock(queue.guard);
+        qpns.push_back(qpn);
+        queue.endpoints[qpn] = this;
+    }
+
+//---------------------------------------------------------------------------
+    uint64_t SharedCompletionQueue::Endpoint::pollSendCompletionQueue() {
+        return poll(sendCompletions);
+    }
+
+//---------------------------------------------------------------------------
+    uint64_t SharedCompletionQueue::Endpoint::pollRecvCompletionQueue() {
+        return poll(receiveCompletions);
+    }
+
+//---------------------------------------------------------------------------
+    uint64_t SharedCompletionQueue::Endpoint::poll(Completions &completions) {
+        CompletionRing::Completion completion;
+        if (completions.ring.pop(completion)) {
+            CompletionQueuePair::checkStatus(completion);
+            return completion.wrId;
+        }
+
+        // Someone else polling is routing completions for us as well
+        {
+            unique_lock<mutex> lock(queue.guard, try_to_lock);
+            if (lock.owns_lock()) {
+                // Our spilled completions come before anything polled now
+                auto &overflow = completions.overflow;
+                while (not overflow.empty() && completions.ring.push(overflow.front())) {
+                    overflow.pop_front();
+                }
+                queue.pollBatch();
+            }
+        }
+        if (completions.ring.pop(completion)) {
+            CompletionQueuePair::checkStatus(completion);
+            return completion.wrId;
+        }
+        return numeric_limits<uint64_t>::max();
+    }
+//---------------------------------------------------------------------------
+} // End of namespace rdma
+//---------------------------------------------------------------------------
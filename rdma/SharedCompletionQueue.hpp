@@ -0,0 +1,93 @@
+#pragma once
+//---------------------------------------------------------------------------
+#include "CompletionQueuePair.hpp"
+#include "CompletionRing.hpp"
+//---------------------------------------------------------------------------
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+//---------------------------------------------------------------------------
+namespace rdma {
+//---------------------------------------------------------------------------
+    class Network;
+
+//---------------------------------------------------------------------------
+/// One large completion queue (pair) shared by many queue pairs, so the number of completion queues and the memory and
+/// NIC context they use stay constant as the number of connections grows.
+/// Each queue pair gets an Endpoint. Whichever endpoint polls routes the completions to their owners by qp_num, the
+/// other endpoints only pick up what has been routed to them. An endpoint whose owner stops consuming never holds up
+/// the others: once its ring is full, its completions spill into a list, which it drains itself.
+class SharedCompletionQueue {
+public:
+    /// The completions of the queue pairs of a single connection
+    class Endpoint {
+        friend class SharedCompletionQueue;
+
+        SharedCompletionQueue &queue;
+        /// The attached queue pairs
+        std::vector<uint32_t> qpns;
+        struct Completions {
+            /// Filled by the polling endpoint (under the queue's guard), drained by the owner
+            CompletionRing ring;
+            /// What didn't fit into the ring, in order and under the queue's guard. Later completions go here as
+            /// long as it isn't empty
+            std::deque<CompletionRing::Completion> overflow;
+        };
+        Completions sendCompletions;
+        Completions receiveCompletions;
+
+        uint64_t poll(Completions &completions);
+
+    public:
+        /// Constructor
+        Endpoint(SharedCompletionQueue &queue);
+
+        /// Destructor, completions arriving later for the queue pairs are dropped
+        ~Endpoint();
+
+        /// Route the completions of the queue pair with the given number to this endpoint, in addition to those of
+        /// the queue pairs attached before
+        void attach(uint32_t qpn);
+
+        /// Poll the next send completion of the queue pairs, numeric_limits<uint64_t>::max() if there is none
+        uint64_t pollSendCompletionQueue();
+
+        /// Poll the next receive completion of the queue pairs, numeric_limits<uint64_t>::max() if there is none
+        uint64_t pollRecvCompletionQueue();
+
+        Endpoint(Endpoint const &) = delete;
+
+        Endpoint &operator=(Endpoint const &) = delete;
+    };
+
+    /// Default number of entries, capped by what the device supports
+    static const int DEFAULT_SIZE = 32768;
+
+private:
+    CompletionQueuePair queues;
+    /// The endpoints by qp_num
+    std::unordered_map<uint32_t, Endpoint *> endpoints;
+    /// Protect the endpoints and polling of the completion queue
+    std::mutex guard;
+
+    /// Route up to one batch of completions of both queues to their endpoints, guard must be held
+    void pollBatch();
+
+    void pollBatch(ibv_cq *completionQueue, Endpoint::Completions Endpoint::*completions);
+
+public:
+    /// Constructor
+    SharedCompletionQueue(Network &network, int size = DEFAULT_SIZE);
+
+    /// The queues to create queue pairs with
+    CompletionQueuePair &getCompletionQueuePair() { return queues; }
+
+    SharedCompletionQueue(SharedCompletionQueue const &) = delete;
+
+    SharedCompletionQueue &operator=(SharedCompletionQueue const &) = delete;
+};
+//---------------------------------------------------------------------------
+} // End of namespace rdma
+//---------------------------------------------------------------------------
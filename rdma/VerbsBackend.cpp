@@ -0,0 +1,153 @@
+#include "VerbsBackend.hpp"
+//---------------------------------------------------------------------------
+#include <infiniband/verbs.h>
+//---------------------------------------------------------------------------
+namespace rdma {
+//---------------------------------------------------------------------------
+ibv_device **VerbsBackend::getDeviceList(int *count)
+{
+   return ::ibv_get_device_list(count);
+}
+//---------------------------------------------------------------------------
+void VerbsBackend::freeDeviceList(ibv_device **devices)
+{
+   ::ibv_free_device_list(devices);
+}
+//---------------------------------------------------------------------------
+ibv_context *VerbsBackend::openDevice(ibv_device *device)
+{
+   return ::ibv_open_device(device);
+}
+//---------------------------------------------------------------------------
+int VerbsBackend::closeDevice(ibv_context *context)
+{
+   return ::ibv_close_device(context);
+}
+//---------------------------------------------------------------------------
+int VerbsBackend::queryDevice(ibv_context *context, ibv_device_attr *attributes)
+{
+   return ::ibv_query_device(context, attributes);
+}
+//---------------------------------------------------------------------------
+int VerbsBackend::queryPort(ibv_context *context, uint8_t port, ibv_port_attr *attributes)
+{
+   return ::ibv_query_port(context, port, attributes);
+}
+//---------------------------------------------------------------------------
+int VerbsBackend::queryGid(ibv_context *context, uint8_t port, int index, ibv_gid *gid)
+{
+   return ::ibv_query_gid(context, port, index, gid);
+}
+//---------------------------------------------------------------------------
+ibv_pd *VerbsBackend::allocPd(ibv_context *context)
+{
+   return ::ibv_alloc_pd(context);
+}
+//---------------------------------------------------------------------------
+int VerbsBackend::deallocPd(ibv_pd *protectionDomain)
+{
+   return ::ibv_dealloc_pd(protectionDomain);
+}
+//---------------------------------------------------------------------------
+ibv_mr *VerbsBackend::regMr(ibv_pd *protectionDomain, void *address, size_t length, int access)
+{
+   return ::ibv_reg_mr(protectionDomain, address, length, access);
+}
+//---------------------------------------------------------------------------
+int VerbsBackend::deregMr(ibv_mr *memoryRegion)
+{
+   return ::ibv_dereg_mr(memoryRegion);
+}
+//---------------------------------------------------------------------------
+ibv_comp_channel *VerbsBackend::createCompChannel(ibv_context *context)
+{
+   return ::ibv_create_comp_channel(context);
+}
+//---------------------------------------------------------------------------
+int VerbsBackend::destroyCompChannel(ibv_comp_channel *channel)
+{
+   return ::ibv_destroy_comp_channel(channel);
+}
+//---------------------------------------------------------------------------
+ibv_cq *VerbsBackend::createCq(ibv_context *context, int entries, ibv_comp_channel *channel)
+{
+   return ::ibv_create_cq(context, entries, nullptr, channel, 0);
+}
+//---------------------------------------------------------------------------
+int VerbsBackend::destroyCq(ibv_cq *completionQueue)
+{
+   return ::ibv_destroy_cq(completionQueue);
+}
+//---------------------------------------------------------------------------
+int VerbsBackend::reqNotifyCq(ibv_cq *completionQueue, int solicitedOnly)
+{
+   return ::ibv_req_notify_cq(completionQueue, solicitedOnly);
+}
+//---------------------------------------------------------------------------
+int VerbsBackend::getCqEvent(ibv_comp_channel *channel, ibv_cq **completionQueue, void **context)
+{
+   return ::ibv_get_cq_event(channel, completionQueue, context);
+}
+//---------------------------------------------------------------------------
+void VerbsBackend::ackCqEvents(ibv_cq *completionQueue, unsigned count)
+{
+   ::ibv_ack_cq_events(completionQueue, count);
+}
+//---------------------------------------------------------------------------
+int VerbsBackend::pollCq(ibv_cq *completionQueue, int entries, ibv_wc *completions)
+{
+   return ::ibv_poll_cq(completionQueue, entries, completions);
+}
+//---------------------------------------------------------------------------
+ibv_srq *VerbsBackend::createSrq(ibv_pd *protectionDomain, ibv_srq_init_attr *attributes)
+{
+   return ::ibv_create_srq(protectionDomain, attributes);
+}
+//---------------------------------------------------------------------------
+int VerbsBackend::destroySrq(ibv_srq *receiveQueue)
+{
+   return ::ibv_destroy_srq(receiveQueue);
+}
+//---------------------------------------------------------------------------
+int VerbsBackend::postSrqRecv(ibv_srq *receiveQueue, ibv_recv_wr *workRequests, ibv_recv_wr **badWorkRequest)
+{
+   return ::ibv_post_srq_recv(receiveQueue, workRequests, badWorkRequest);
+}
+//---------------------------------------------------------------------------
+ibv_qp *VerbsBackend::createQp(ibv_pd *protectionDomain, ibv_qp_init_attr *attributes)
+{
+   return ::ibv_create_qp(protectionDomain, attributes);
+}
+//---------------------------------------------------------------------------
+int VerbsBackend::destroyQp(ibv_qp *queuePair)
+{
+   return ::ibv_destroy_qp(queuePair);
+}
+//---------------------------------------------------------------------------
+int VerbsBackend::modifyQp(ibv_qp *queuePair, ibv_qp_attr *attributes, int mask)
+{
+   return ::ibv_modify_qp(queuePair, attributes, mask);
+}
+//---------------------------------------------------------------------------
+int VerbsBackend::queryQp(ibv_qp *queuePair, ibv_qp_attr *attributes, int mask, ibv_qp_init_attr *initAttributes)
+{
+   return ::ibv_query_qp(queuePair, attributes, mask, initAttributes);
+}
+//---------------------------------------------------------------------------
+int VerbsBackend::postSend(ibv_qp *queuePair, ibv_send_wr *workRequests, ibv_send_wr **badWorkRequest)
+{
+   return ::ibv_post_send(queuePair, workRequests, badWorkRequest);
+}
+//---------------------------------------------------------------------------
+ibv_ah *VerbsBackend::createAh(ibv_pd *protectionDomain, ibv_ah_attr *attributes)
+{
+   return ::ibv_create_ah(protectionDomain, attributes);
+}
+//---------------------------------------------------------------------------
+int VerbsBackend::destroyAh(ibv_ah *addressHandle)
+{
+   return ::ibv_destroy_ah(addressHandle);
+}
+//---------------------------------------------------------------------------
+} // End of namespace rdma
+//---------------------------------------------------------------------------
@@ -0,0 +1,70 @@
+#pragma once
+//---------------------------------------------------------------------------
+#include "Backend.hpp"
+//---------------------------------------------------------------------------
+namespace rdma {
+//---------------------------------------------------------------------------
+/// Forwards to libibverbs, i.e. to the HCA
+    class VerbsBackend : public Backend {
+    public:
+        ibv_device **getDeviceList(int *count) override;
+
+        void freeDeviceList(ibv_device **devices) override;
+
+        ibv_context *openDevice(ibv_device *device) override;
+
+        int closeDevice(ibv_context *context) override;
+
+        int queryDevice(ibv_context *context, ibv_device_attr *attributes) override;
+
+        int queryPort(ibv_context *context, uint8_t port, ibv_port_attr *attributes) override;
+
+        int queryGid(ibv_context *context, uint8_t port, int index, ibv_gid *gid) override;
+
+        ibv_pd *allocPd(ibv_context *context) override;
+
+        int deallocPd(ibv_pd *protectionDomain) override;
+
+        ibv_mr *regMr(ibv_pd *protectionDomain, void *address, size_t length, int access) override;
+
+        int deregMr(ibv_mr *memoryRegion) override;
+
+        ibv_comp_channel *createCompChannel(ibv_context *context) override;
+
+        int destroyCompChannel(ibv_comp_channel *channel) override;
+
+        ibv_cq *createCq(ibv_context *context, int entries, ibv_comp_channel *channel) override;
+
+        int destroyCq(ibv_cq *completionQueue) override;
+
+        int reqNotifyCq(ibv_cq *completionQueue, int solicitedOnly) override;
+
+        int getCqEvent(ibv_comp_channel *channel, ibv_cq **completionQueue, void **context) override;
+
+        void ackCqEvents(ibv_cq *completionQueue, unsigned count) override;
+
+        int pollCq(ibv_cq *completionQueue, int entries, ibv_wc *completions) override;
+
+        ibv_srq *createSrq(ibv_pd *protectionDomain, ibv_srq_init_attr *attributes) override;
+
+        int destroySrq(ibv_srq *receiveQueue) override;
+
+        int postSrqRecv(ibv_srq *receiveQueue, ibv_recv_wr *workRequests, ibv_recv_wr **badWorkRequest) override;
+
+        ibv_qp *createQp(ibv_pd *protectionDomain, ibv_qp_init_attr *attributes) override;
+
+        int destroyQp(ibv_qp *queuePair) override;
+
+        int modifyQp(ibv_qp *queuePair, ibv_qp_attr *attributes, int mask) override;
+
+        int queryQp(ibv_qp *queuePair, ibv_qp_attr *attributes, int mask, ibv_qp_init_attr *initAttributes) override;
+
+        int postSend(ibv_qp *queuePair, ibv_send_wr *workRequests, ibv_send_wr **badWorkRequest) override;
+
+        ibv_ah *createAh(ibv_pd *protectionDomain, ibv_ah_attr *attributes) override;
+
+        int destroyAh(ibv_ah *addressHandle) override;
+    };
+//---------------------------------------------------------------------------
+} // End of namespace rdma
+//---------------------------------------------------------------------------
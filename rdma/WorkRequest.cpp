@@ -19,6 +19,7 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 // ---------------------------------------------------------------------------
 #include "WorkRequest.hpp"
+#include "AddressHandle.hpp"
 #include "Network.hpp"
 #include "QueuePair.hpp"
 //---------------------------------------------------------------------------
@@ -31,13 +32,15 @@ namespace rdma {
 //---------------------------------------------------------------------------
     WorkRequest::WorkRequest() {
         wr = unique_ptr<ibv_send_wr>(new ibv_send_wr());
-        wr->sg_list = new ibv_sge();
+        wr->sg_list = new ibv_sge[1]();
         reset();
     }
 
 //---------------------------------------------------------------------------
     WorkRequest::~WorkRequest() {
-        delete wr->sg_list;
+        if (wr) { // moved-from requests don't own anything
+            delete[] wr->sg_list;
+        }
     }
 
 //---------------------------------------------------------------------------
@@ -111,7 +114,7 @@ namespace rdma {
     }
 
     void RDMAWorkRequest::setLocalAddress(const std::vector<MemoryRegion::Slice> localAddresses) {
-        delete wr->sg_list;
+        delete[] wr->sg_list;
         wr->sg_list = new ibv_sge[localAddresses.size()]();
         wr->num_sge = localAddresses.size();
         for (size_t i = 0; i < localAddresses.size(); ++i) {
@@ -119,8 +122,6 @@ namespace rdma {
             wr->sg_list[i].length = localAddresses[i].size;
             wr->sg_list[i].lkey = localAddresses[i].lkey;
         }
-
-        // TODO: manage a sensible way of keeping track of the new'ed array
     }
 
 //---------------------------------------------------------------------------
@@ -136,6 +137,31 @@ namespace rdma {
         }
     }
 
+//---------------------------------------------------------------------------
+    SendWorkRequest::SendWorkRequest() {
+        wr->opcode = IBV_WR_SEND;
+    }
+
+    void SendWorkRequest::setLocalAddress(const MemoryRegion::Slice &localAddress) {
+        wr->sg_list->addr = reinterpret_cast<uintptr_t>(localAddress.address);
+        wr->sg_list->length = localAddress.size;
+        wr->sg_list->lkey = localAddress.lkey;
+    }
+
+    void SendWorkRequest::setSendInline(bool flag) {
+        if (flag) {
+            wr->send_flags |= IBV_SEND_INLINE;
+        } else {
+            wr->send_flags &= ~IBV_SEND_INLINE;
+        }
+    }
+
+    void DatagramWorkRequest::setDestination(const AddressHandle &addressHandle, uint32_t qpn, uint32_t qkey) {
+        wr->wr.ud.ah = addressHandle.getHandle();
+        wr->wr.ud.remote_qpn = qpn;
+        wr->wr.ud.remote_qkey = qkey;
+    }
+
 //---------------------------------------------------------------------------
     ReadWorkRequest::ReadWorkRequest() {
         wr->opcode = IBV_WR_RDMA_READ;
@@ -215,7 +241,7 @@ namespace rdma {
         wr.setLocalAddress(localAddress);
         wr.setRemoteAddress(remoteAddress);
         wr.setCompletion(completion);
-        wr.setId(42);
+        wr.setId(ReadWorkRequest::getId());
     }
 
     ReadWorkRequestBuilder &ReadWorkRequestBuilder::setNextWorkRequest(const WorkRequest *workRequest) {
@@ -233,6 +259,7 @@ namespace rdma {
         wr.setLocalAddress(localAddress);
         wr.setRemoteAddress(remoteAddress);
         wr.setCompletion(completion);
+        wr.setId(ReadWorkRequest::getId());
     }
 
     WriteWorkRequestBuilder::WriteWorkRequestBuilder(const MemoryRegion &localAddress,
@@ -155,6 +155,26 @@ namespace rdma {
         WriteWorkRequest build();
     };
 
+//---------------------------------------------------------------------------
+    class SendWorkRequest : public WorkRequest { // Two-sided, consumes a receive posted by the remote side
+    public:
+        SendWorkRequest();
+
+        /// Local memory address (location to be sent from)
+        void setLocalAddress(const MemoryRegion::Slice &localAddress);
+
+        /// Sets the IBV_SEND_INLINE flag, see WriteWorkRequest::setSendInline()
+        void setSendInline(bool flag);
+    };
+
+    class AddressHandle;
+
+    class DatagramWorkRequest : public SendWorkRequest { // Send on an unreliable datagram queue pair
+    public:
+        /// The remote queue pair, reached through the address handle, which has to accept the qkey
+        void setDestination(const AddressHandle &addressHandle, uint32_t qpn, uint32_t qkey);
+    };
+
 //---------------------------------------------------------------------------
     class AtomicWorkRequest : public WorkRequest { // Fetch_Add & Compare_Swap
     public:
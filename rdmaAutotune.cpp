@@ -0,0 +1,251 @@
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include "tcpWrapper.h"
+#include "RDMAMessageBuffer.h"
+#include "StreamMultiplexer.h"
+#include "Tuning.h"
+
+using namespace std;
+using namespace rdma;
+
+namespace {
+    /// One measurement, the client sends it over TCP and both sides set up a fresh connection for it
+    struct Trial {
+        enum Kind : uint32_t {
+            PingPong, Stream, Multiplexed, Idle, Done
+        };
+        Kind kind;
+        uint32_t inln;
+        uint64_t ringSize;
+        uint64_t messageSize;
+        uint64_t messages;
+        uint64_t signalInterval;
+        double creditReturnFraction;
+    };
+
+    /// Destroying a queue pair drops writes still in flight, so both sides wait until the client got everything
+    void finish(int sock, bool isClient) {
+        uint8_t done = 1;
+        if (isClient) {
+            tcp_write(sock, &done, sizeof(done));
+        } else {
+            tcp_read(sock, &done, sizeof(done));
+        }
+    }
+
+    void serve(int sock) {
+        for (;;) {
+            Trial trial;
+            tcp_read(sock, &trial, sizeof(trial));
+            if (trial.kind == Trial::Done) {
+                return;
+            }
+            vector<uint8_t> buffer(trial.messageSize);
+            if (trial.kind == Trial::Multiplexed) {
+                auto stream = StreamMultiplexer::openStream(sock);
+                stream->setCreditReturnFraction(trial.creditReturnFraction);
+                for (size_t i = 0; i < trial.messages; ++i) {
+                    stream->receive(buffer.data(), buffer.size());
+                }
+                stream->send(buffer.data(), 1);
+                finish(sock, false);
+                continue;
+            }
+            RDMAMessageBuffer rdma(trial.ringSize, sock);
+            rdma.setInlineThreshold(numeric_limits<size_t>::max());
+            rdma.setSignalInterval(trial.signalInterval);
+            for (size_t i = 0; i < trial.messages && trial.kind != Trial::Idle; ++i) {
+                const auto received = rdma.receive(buffer.data(), buffer.size());
+                if (trial.kind == Trial::PingPong) {
+                    rdma.send(buffer.data(), received, trial.inln != 0);
+                }
+            }
+            if (trial.kind == Trial::Stream) {
+                rdma.send(buffer.data(), 1);
+            }
+            finish(sock, false);
+        }
+    }
+
+    /// Runs a trial against the server, returns the seconds taken by its messages
+    double run(int sock, Trial trial) {
+        tcp_write(sock, &trial, sizeof(trial));
+        vector<uint8_t> data(trial.messageSize, 'x');
+        if (trial.kind == Trial::Multiplexed) {
+            auto stream = StreamMultiplexer::openStream(sock);
+            const auto start = chrono::steady_clock::now();
+            for (size_t i = 0; i < trial.messages; ++i) {
+                stream->send(data.data(), data.size());
+            }
+            stream->receive();
+            const auto end = chrono::steady_clock::now();
+            finish(sock, true);
+            return chrono::duration<double>(end - start).count();
+        }
+
+        RDMAMessageBuffer rdma(trial.ringSize, sock);
+        rdma.setInlineThreshold(numeric_limits<size_t>::max());
+        rdma.setSignalInterval(trial.signalInterval);
+        const auto start = chrono::steady_clock::now();
+        if (trial.kind == Trial::Idle) {
+            // Nothing arrives, so this is the cost of checking a connection in a sweep without work
+            size_t found = 0;
+            for (size_t i = 0; i < trial.messages; ++i) {
+                found += rdma.hasData();
+            }
+            if (found != 0) {
+                throw runtime_error{"data arrived on an idle connection"};
+            }
+        }
+        for (size_t i = 0; i < trial.messages && trial.kind != Trial::Idle; ++i) {
+            rdma.send(data.data(), data.size(), trial.inln != 0);
+            if (trial.kind == Trial::PingPong) {
+                rdma.receive(data.data(), data.size());
+            }
+        }
+        if (trial.kind == Trial::Stream) {
+            rdma.receive(data.data(), data.size());
+        }
+        const auto end = chrono::steady_clock::now();
+        finish(sock, true);
+        return chrono::duration<double>(end - start).count();
+    }
+
+    /// Index of the first candidate within tolerance of the fastest
+    size_t pick(const vector<double> &seconds, double tolerance) {
+        const auto best = *min_element(seconds.begin(), seconds.end());
+        for (size_t i = 0; i != seconds.size(); ++i) {
+            if (seconds[i] * tolerance <= best) {
+                return i;
+            }
+        }
+        return 0;
+    }
+
+    Tuning tune(int sock, stringstream &report) {
+        static const size_t FRAMING = 2 * sizeof(uint64_t);
+        static const size_t LATENCY_RING = 16 * 1024;
+        static const size_t PINGS = 4096;
+        static const size_t STREAMED_BYTES = 16 * 1024 * 1024;
+        Tuning tuning;
+
+        // Inline writes save the NIC a DMA read, but copy the data through the doorbell, which stops paying off at some
+        // size. The threshold is the largest write where inlining still wins
+        const auto maxInline = QueuePair::Profile::standard().inlineSize;
+        double roundTrip = 0;
+        tuning.inlineThreshold = 0;
+        for (size_t write = 32; write <= max<size_t>(maxInline, 32); write += 32) {
+            Trial trial{Trial::PingPong, 1, LATENCY_RING, write - FRAMING, PINGS, 0, 0};
+            const auto inlined = run(sock, trial);
+            trial.inln = 0;
+            const auto copied = run(sock, trial);
+            if (write <= maxInline && inlined < copied) {
+                tuning.inlineThreshold = write;
+            }
+            if (roundTrip == 0) {
+                roundTrip = min(inlined, copied) / PINGS;
+            }
+            cout << write << "B writes: " << inlined / PINGS * 1e6 << "us inline, " << copied / PINGS * 1e6
+                 << "us not inline" << endl;
+        }
+        report << "round trip of 16B messages: " << roundTrip * 1e6 << "us" << endl;
+
+        // The smallest ring that still gets close to the best streaming throughput leaves the most memory to others
+        vector<size_t> ringSizes;
+        vector<double> seconds;
+        for (size_t ringSize = 16 * 1024; ringSize <= 1024 * 1024; ringSize *= 2) {
+            const size_t messageSize = 4096;
+            const Trial trial{Trial::Stream, 1, ringSize, messageSize, STREAMED_BYTES / messageSize, 0, 0};
+            ringSizes.push_back(ringSize);
+            seconds.push_back(run(sock, trial));
+            cout << ringSize / 1024 << "K ring: " << STREAMED_BYTES * 8 / seconds.back() / 1e9 << " Gbit/s" << endl;
+        }
+        tuning.ringSize = ringSizes[pick(seconds, 0.95)];
+
+        // Signaling more often costs completions, signaling rarely keeps the send queue full for longer
+        const vector<size_t> intervals{8, 16, 32, 64, 128, 0};
+        seconds.clear();
+        for (const auto interval : intervals) {
+            const size_t messageSize = 64;
+            const Trial trial{Trial::Stream, 1, tuning.ringSize, messageSize, 64 * 1024, interval, 0};
+            seconds.push_back(run(sock, trial));
+            cout << "signal interval " << interval << ": " << trial.messages / seconds.back() / 1e6 << "M messages/s"
+                 << endl;
+        }
+        tuning.signalInterval = intervals[pick(seconds, 1.0)];
+
+        // Small batches return credit early, large ones save frames
+        const vector<double> fractions{1.0 / 16, 1.0 / 8, 1.0 / 4, 1.0 / 2};
+        seconds.clear();
+        for (const auto fraction : fractions) {
+            const size_t messageSize = 1024;
+            const Trial trial{Trial::Multiplexed, 1, 0, messageSize, STREAMED_BYTES / 4 / messageSize, 0, fraction};
+            seconds.push_back(run(sock, trial));
+            cout << "credit return at " << fraction << " of the window: "
+                 << STREAMED_BYTES / 4 * 8 / seconds.back() / 1e9 << " Gbit/s" << endl;
+        }
+        tuning.creditReturnFraction = fractions[pick(seconds, 1.0)];
+
+        // Spinning for about two round trips catches the answer to a request just sent without the latency of a yield
+        const size_t checks = 1024 * 1024;
+        const auto check = run(sock, Trial{Trial::Idle, 1, LATENCY_RING, 1, checks, 0, 0}) / checks;
+        report << "check of an idle connection: " << check * 1e9 << "ns" << endl;
+        tuning.spinBudget = min<size_t>(max<size_t>(static_cast<size_t>(2 * roundTrip / check), 64), 1024 * 1024);
+
+        Trial done{Trial::Done, 0, 0, 0, 0, 0, 0};
+        tcp_write(sock, &done, sizeof(done));
+        return tuning;
+    }
+}
+
+// Measures the parameters of Tuning against the local hardware and writes them to a file, which RDMA_TUNING points
+// processes to
+int main(int argc, char **argv) {
+    if (argc < 3 || (argv[1][0] == 'c' && argc < 4)) {
+        cout << "Usage: " << argv[0] << " <client / server> <Port> [IP (if client)] [Output file (if client)]" << endl;
+        return -1;
+    }
+    const auto isClient = argv[1][0] == 'c';
+    const auto port = ::atoi(argv[2]);
+
+    sockaddr_in addr;
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (isClient) {
+        inet_pton(AF_INET, argv[3], &addr.sin_addr);
+        const string output = argc > 4 ? argv[4] : "rdma_tuning.conf";
+
+        auto sock = tcp_socket();
+        tcp_connect(sock, addr);
+        tcp_setBlocking(sock);
+
+        stringstream report;
+        report << "Measured by rdmaAutotune against " << argv[3] << " on " << RDMANetworking::sharedNetwork().getRail()
+               << " with the " << QueuePair::Profile::standard().name << " queue pair profile" << endl;
+        const auto tuning = tune(sock, report);
+        tuning.save(output, report.str());
+        cout << report.str();
+        cout << "Wrote " << output << ", point RDMA_TUNING to it" << endl;
+        close(sock);
+    } else {
+        addr.sin_addr.s_addr = INADDR_ANY;
+
+        auto sock = tcp_socket();
+        tcp_bind(sock, addr);
+        listen(sock, SOMAXCONN);
+        sockaddr_in inAddr;
+
+        auto acced = tcp_accept(sock, inAddr);
+        tcp_setBlocking(acced);
+        serve(acced);
+        close(acced);
+        close(sock);
+    }
+    return 0;
+}
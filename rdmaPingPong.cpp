@@ -1,3 +1,4 @@
+#include <array>
 #include <iostream>
 #include <netinet/in.h>
 #include <arpa/inet.h>
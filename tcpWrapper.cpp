@@ -1,4 +1,5 @@
 #include <netinet/in.h>
+#include <cerrno>
 #include <iostream>
 #include <fcntl.h>
 #include <unistd.h>
@@ -23,16 +24,39 @@ void tcp_connect(int sock, sockaddr_in &addr) {
 }
 
 void tcp_write(int sock, void *buffer, std::size_t size) {
-    if (send(sock, buffer, size, 0) < 0) {
-        perror("send");
-        throw std::runtime_error{"error write'ing"};
+    // send() may return after writing only a part of the buffer
+    auto data = reinterpret_cast<const char *>(buffer);
+    while (size > 0) {
+        const auto written = send(sock, data, size, MSG_NOSIGNAL);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("send");
+            throw std::runtime_error{"error write'ing"};
+        }
+        data += written;
+        size -= written;
     }
 }
 
 void tcp_read(int sock, void *buffer, std::size_t size) {
-    if (recv(sock, buffer, size, 0) < 0) {
-        perror("recv");
-        throw std::runtime_error{"error read'ing"};
+    // recv() returns what has arrived so far, which may be less than requested
+    auto data = reinterpret_cast<char *>(buffer);
+    while (size > 0) {
+        const auto received = recv(sock, data, size, 0);
+        if (received < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("recv");
+            throw std::runtime_error{"error read'ing"};
+        }
+        if (received == 0) {
+            throw std::runtime_error{"connection closed while read'ing"};
+        }
+        data += received;
+        size -= received;
     }
 }
 